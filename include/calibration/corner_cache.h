@@ -0,0 +1,65 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+On-disk cache of the detected calibration board corners.
+Every image has its own entry named after a 64-bit key which combines
+the image path, the image file content and the detector parameters.
+Entry format (binary, native endianness):
+    char[4]     magic "VGCC"
+    uint32_t    format version
+    uint64_t    key
+    uint8_t     1 if the pattern has been found, 0 otherwise
+    uint32_t    number of corners N
+    double[2N]  corner coordinates u0, v0, u1, v1, ...
+*/
+
+#pragma once
+
+#include <cstdint>
+
+#include "std.h"
+#include "io.h"
+#include "eigen.h"
+
+class CornerCache
+{
+public:
+    CornerCache(const string & cacheDir, int Nx, int Ny, int initRadius, bool improveDetection,
+            int maxDetectionSize);
+
+    //the cache is disabled if the directory cannot be created
+    bool enabled() const { return _enabled; }
+
+    uint64_t computeKey(const string & imageName, const vector<uint8_t> & fileData) const;
+
+    //returns false if there is no valid entry for the key
+    bool load(uint64_t key, bool & patternIsFound, Vector2dVec & cornerVec) const;
+
+    void store(uint64_t key, bool patternIsFound, const Vector2dVec & cornerVec) const;
+
+private:
+    string entryName(uint64_t key) const;
+
+    string _cacheDir;
+    bool _enabled;
+    uint64_t _paramHash;
+};
+
+//reads the whole file into fileData, returns false if the file cannot be open
+bool readFileData(const string & fileName, vector<uint8_t> & fileData);
+
@@ -47,7 +47,10 @@ double findMinDistance(const Vector2dVec & cornerVec, const int rows, const int
 class CornerDetector
 {
 public:
-    CornerDetector(int Nx, int Ny, int initRadius = 5, bool improveDetection = true, bool debug = false);
+    //if maxDetectionSize > 0, larger images are downscaled by a power of 2 to fit it,
+    //the pattern is detected on the small image and then refined at full resolution
+    CornerDetector(int Nx, int Ny, int initRadius = 5, bool improveDetection = true, bool debug = false,
+            int maxDetectionSize = 0);
     
     virtual ~CornerDetector() {}
     
@@ -61,6 +64,10 @@ public:
     //out : _src, _imgrad, _resp, _avgVal
     void computeResponse(const double SIGMA_1, const double SIGMA_2);
     
+    const Mat32f & response() const { return _resp; }
+    const Mat32f & gradientNorm() const { return _imgrad; }
+    double averageResponse() const { return _avgVal; }
+    
     //out : _hypHeap, _detected
     void selectCandidates();
     
@@ -86,6 +93,12 @@ public:
     
     void improveCorners(Vector2dVec & pointVec);   
     
+    //pointVec is given in the downscaled image and is transformed to the full resolution
+    void refineCorners(Vector2dVec & pointVec);
+    
+    //sharp gradients as in computeResponse, used for the subpixel refinement
+    void computeGradient(const Mat8u & img, Mat32f & gradx, Mat32f & grady) const;
+    
     int initPoin(const Vector2i & pt, double * data);
     
     Vector2iVec getCircle(const Vector2i & pt, const int radius) const;
@@ -122,8 +135,14 @@ private:
     
     Mat8u _img;
     
+    //multi-resolution detection
+    Mat8u _imgFull;
+    int _scale; // _imgFull size / _img size
+    double _sigma1, _sigma2; // filters used for the last response computation
+    
     const bool IMPROVE_DETECTION;
     int INIT_RADIUS;
+    const int MAX_DETECTION_SIZE;
     
     //STRUCTURES AND FUNCTIONS
     
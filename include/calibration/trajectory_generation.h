@@ -31,6 +31,8 @@ class ITrajectory
 public:
     ITrajectory() {}
     virtual ~ITrajectory() {}
+    // fills up trajVec and covVec from scratch
+    // it is called concurrently to compute the gradients, so it must not modify the object
     virtual void compute(const double * params, vector<Transf> & trajVec, 
             vector<Matrix6d> & covVec) const = 0;
     virtual int paramSize() const = 0;
@@ -39,6 +41,8 @@ public:
 
 const double DIFF_EPS = 1e-8; //FIXME
 
+// The gradients are computed by central differences,
+// the perturbed costs are evaluated in parallel
 struct TrajectoryQuality : FirstOrderFunction
 {
     // the class takes the ownership of traj
@@ -68,10 +72,26 @@ struct TrajectoryVisualQuality : FirstOrderFunction
     // the class takes the ownership of traj
     TrajectoryVisualQuality(const vector<ITrajectory*> & trajVec, 
             const ptree & params, const ICamera * camera);
-            
+    
+    // The cost is a sum of independent contributions of the trajectories,
+    // a perturbation of one parameter changes the contribution of one trajectory only.
+    // The other contributions are computed once per call, 
+    // and the perturbed costs are evaluated in parallel
     virtual bool Evaluate(const double * params,
             double * residual, double * jacobian) const;
     
+    // the information matrix and the penalties of one trajectory
+    struct TrajectoryTerm
+    {
+        Matrix6d H;
+        double cost;
+    };
+    
+    TrajectoryTerm EvaluateTrajectory(int trajIdx, const double * trajParams) const;
+    
+    // -log(det(H)) + cost
+    double totalCost(const Matrix6d & H, double cost) const;
+    
     Matrix6d visualCov(const Transf & camPose) const;
     
     //TODO to think how to regularize for different cameras
@@ -98,6 +118,7 @@ struct TrajectoryVisualQuality : FirstOrderFunction
     
     ICamera * _camera;
     vector<ITrajectory*> _trajVec;
+    vector<int> _paramOffsetVec; // where the parameters of each trajectory begin
     int _paramSize;
     Transf _xiCam, _xiBoard;
     Vector3dVec _board;
@@ -33,6 +33,22 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 
 
 
+//settings of the global optimization, "solver" block of the calibration file
+struct SolverParameters
+{
+    //ceres linear solver name, the ceres default if empty
+    string linearSolver;
+    //"poses_first" -- per-image transformations are eliminated first (Schur-type solvers)
+    //"auto" -- the ordering is computed by ceres
+    string ordering = "auto";
+    int numThreads = 1;
+    int maxIterations = 1000;
+    double functionTolerance = 1e-15;
+    double gradientTolerance = 1e-15;
+    double parameterTolerance = 1e-15;
+    bool progressToStdout = true;
+};
+
 struct TransformInfo {
     bool global;
     bool prior;
@@ -75,8 +91,15 @@ struct ImageData
     bool doNotSolve = false;
     bool doNotSolveGlobal = false;
     bool saveOutlierImages = false;
+    bool useCornerCache = true;
     double drawScale = 7;
     
+    //where the detected corners are stored between the runs
+    string cornerCacheDir;
+    
+    //larger images are detected coarse-to-fine, 0 to always detect at full resolution
+    int maxDetectionSize = 0;
+    
     int getFirstExtractedIdx() const
     {
         int i = 0;
@@ -103,6 +126,11 @@ protected:
     map<string, ICamera*> cameraMap;
     map<string, bool> cameraConstantMap; //TODO make a structure
     Problem globalProblem;
+    SolverParameters solverParams;
+    
+    //sequences with residuals between consecutive transformations (odometry)
+    //they cannot be eliminated first by Schur-type solvers
+    set<string> linkedSequenceSet;
     
     //reprojection problem descriptors
     vector<ImageData> dataVec;
@@ -114,6 +142,10 @@ protected:
     
     void parseData();
     
+    void parseSolver(const ptree & node);
+    
+    void setSolverOptions(Solver::Options & options);
+    
     void initTransformChainInfo(ImageData & data, const ptree & node);
     
     void initGrid(ImageData & data, const ptree & node);
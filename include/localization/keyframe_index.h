@@ -0,0 +1,56 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Spatial index of the keyframe positions
+A voxel hash, every cell contains the indices of the keyframes inside it
+*/
+
+#pragma once
+
+#include <unordered_map>
+
+#include "std.h"
+#include "eigen.h"
+
+class KeyframeIndex
+{
+public:
+    KeyframeIndex(const double cellSize) : _cellSize(max(cellSize, 1e-3)) {}
+    
+    // idx is the index of the keyframe in the map, they are supposed to be consecutive
+    void insert(const int idx, const Vector3d & position);
+    
+    // changes the position of an inserted keyframe
+    void move(const int idx, const Vector3d & position);
+    
+    // indices of all the keyframes closer than radius to position, in the increasing order
+    void radiusSearch(const Vector3d & position, const double radius, vector<int> & idxVec) const;
+    
+    int size() const { return _positionVec.size(); }
+    
+    void clear();
+    
+private:
+    int64_t cellIndex(const double x) const;
+    uint64_t cellKey(const int64_t cx, const int64_t cy, const int64_t cz) const;
+    
+    double _cellSize;
+    std::unordered_map<uint64_t, vector<int>> _cellMap;
+    Vector3dVec _positionVec;
+};
+
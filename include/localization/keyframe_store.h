@@ -0,0 +1,100 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Keyframe image storage with a memory budget
+The images which do not fit into the budget are kept PNG-compressed
+and decompressed on demand, the least recently used ones are compressed first
+The budget covers the uncompressed and the compressed images. The compressed data
+is the only copy of a cold frame and is never released, so once it alone exceeds
+the budget the store keeps only the most recently used image uncompressed and
+grows by the compressed size of each new keyframe
+*/
+
+#pragma once
+
+#include "std.h"
+#include "ocv.h"
+#include "io.h"
+
+struct KeyframeStoreStats
+{
+    int frameCount = 0;
+    int rawCount = 0;           // frames available uncompressed
+    size_t rawBytes = 0;        // memory used by the uncompressed images
+    size_t compressedBytes = 0; // memory used by the compressed images
+    int hitCount = 0;           // image() calls served without decompression
+    int missCount = 0;          // image() calls which required decompression
+    int compressionCount = 0;
+};
+
+std::ostream & operator << (std::ostream & os, const KeyframeStoreStats & stats);
+
+class KeyframeStore
+{
+public:
+    // memoryBudget limits the total size of the uncompressed and compressed images, in bytes
+    // the most recently used image is always kept uncompressed
+    KeyframeStore(const size_t memoryBudget) : _memoryBudget(memoryBudget) {}
+    
+    // the image is copied, returns its index
+    int push(const Mat8u & img);
+    
+    // the image data is neither copied nor compressed and must outlive the store,
+    // used for the read-only images of a memory-mapped map file
+    int pushExternal(const Mat8u & img);
+    
+    // the returned header shares the data with the store,
+    // it stays valid after the image is compressed
+    Mat8u image(const int idx);
+    
+    Mat8u back() { return image(size() - 1); }
+    
+    int size() const { return _entryVec.size(); }
+    bool empty() const { return _entryVec.empty(); }
+    
+    const KeyframeStoreStats & stats() const { return _stats; }
+    
+    // the memory in use, compared against the budget
+    size_t memoryUsage() const { return _stats.rawBytes + _stats.compressedBytes; }
+    
+private:
+    struct Entry
+    {
+        Mat8u img; // empty if the frame is only available compressed
+        vector<uint8_t> compressed; // empty until the first eviction, then kept
+        bool external = false; // img refers to memory the store does not own
+        bool inLru = false;
+        list<int>::iterator lruIter; // position in _lruList if inLru
+    };
+    
+    // moves the frame to the front of the LRU list
+    void touch(const int idx);
+    
+    // compresses the least recently used images until the budget is respected
+    void enforceBudget(const int keepIdx);
+    
+    // reports the memory use through the profiler counters
+    void reportMemory() const;
+    
+    size_t _memoryBudget;
+    vector<Entry> _entryVec;
+    // uncompressed images the store owns, the most recently used first
+    list<int> _lruList;
+    KeyframeStoreStats _stats;
+};
+
@@ -0,0 +1,146 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Binary map file: the keyframe images and poses, and the active frame
+(the frame the tracking is relative to) with its depth map.
+The file is memory-mapped for reading, the images and the depth arrays are views into the mapping.
+Format (binary, native endianness, every block starts at a multiple of 8 bytes):
+    MapFileHeader
+    data blocks     uint8_t images (rows x cols, row-major) and double arrays
+    MapFrameRecord  keyframeCount keyframes followed by activeCount active frames, at tableOffset
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+
+#include "geometry/geometry.h"
+#include "projection/generic_camera.h"
+#include "reconstruction/depth_map.h"
+
+const uint32_t MAP_FILE_VERSION = 1;
+
+struct MapFileHeader
+{
+    char magic[4];              // "VGMP"
+    uint32_t version;
+    uint32_t keyframeCount;
+    uint32_t activeCount;       // 1 if the active frame is stored, 0 otherwise
+    uint64_t tableOffset;       // position of the frame records
+    uint64_t fileSize;          // to detect truncated files
+    double xiLocal[6];          // tracking pose wrt the active frame at the saving time
+};
+
+struct MapFrameRecord
+{
+    double xi[6];
+    int32_t rows, cols;         // image size
+    uint64_t imageOffset;
+    int32_t scale, u0, v0, uMax, vMax, xMax, yMax;  // depth map ScaleParameters
+    int32_t hMax;               // number of hypotheses, 0 if there is no depth map
+    uint64_t depthOffset;       // values, sigmas, costs, xMax*yMax*hMax doubles each
+};
+
+// a depth map stored in a MapFile, valid as long as the file is mapped
+struct DepthMapView : public ScaleParameters
+{
+    int hMax = 0;
+    const double * valPtr = NULL;
+    const double * sigmaPtr = NULL;
+    const double * costPtr = NULL;
+
+    bool empty() const { return hMax == 0; }
+
+    // copies the data into a depth map of the camera
+    DepthMap toDepthMap(const ICamera * camera) const;
+};
+
+// writes to fileName.tmp which is renamed to fileName by close()
+class MapWriter
+{
+public:
+    // throws std::runtime_error if the file cannot be created
+    MapWriter(const string & fileName);
+
+    // removes the temporary file if close has not been called
+    ~MapWriter();
+
+    void addKeyframe(const Transf & xi, const Mat8u & img);
+
+    void setActiveFrame(const Transf & xi, const Mat8u & img, const DepthMap & depth,
+            const Transf & xiLocal);
+
+    // writes the frame records and the header
+    void close();
+
+private:
+    // returns the offset of the block
+    uint64_t writeBlock(const void * data, const size_t size);
+    uint64_t writeImage(const Mat8u & img);
+    MapFrameRecord makeRecord(const Transf & xi, const Mat8u & img);
+    void check();
+
+    string _fileName;
+    string _tmpName;
+    ofstream _file;
+    uint64_t _offset;
+    vector<MapFrameRecord> _keyframeVec;
+    vector<MapFrameRecord> _activeVec;
+    Transf _xiLocal;
+    bool _closed = false;
+};
+
+// read-only memory mapping of a map file
+class MapFile
+{
+public:
+    // throws std::runtime_error if the file cannot be mapped or is not a valid map file
+    MapFile(const string & fileName);
+
+    ~MapFile();
+
+    MapFile(const MapFile &) = delete;
+    MapFile & operator = (const MapFile &) = delete;
+
+    int keyframeCount() const { return _headerPtr->keyframeCount; }
+    Transf keyframePose(const int idx) const;
+    // the image refers to the read-only mapping, it must not be written
+    Mat8u keyframeImage(const int idx) const;
+
+    bool hasActiveFrame() const { return _headerPtr->activeCount > 0; }
+    Transf activePose() const;
+    Mat8u activeImage() const;
+    DepthMapView activeDepth() const;
+    Transf activeLocalPose() const { return Transf(_headerPtr->xiLocal); }
+
+private:
+    void validate(const string & fileName) const;
+    const MapFrameRecord & record(const int idx) const;
+    Mat8u imageView(const MapFrameRecord & rec) const;
+
+    const uint8_t * _dataPtr;
+    size_t _size;
+    const MapFileHeader * _headerPtr;
+    const MapFrameRecord * _recordPtr;
+};
+
@@ -21,6 +21,12 @@ SLAM system
 
 #pragma once
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+
 #include "std.h"
 #include "eigen.h"
 #include "ocv.h"
@@ -34,6 +40,10 @@ SLAM system
 #include "reconstruction/eucm_sgm.h"
 #include "localization/sparse_odom.h"
 #include "localization/photometric.h"
+#include "localization/keyframe_index.h"
+#include "localization/keyframe_store.h"
+#include "localization/sensor_sync.h"
+#include "localization/map_file.h"
 
 struct MappingParameters
 {
@@ -48,6 +58,12 @@ struct MappingParameters
             else if (pname == "min_stereo_base") minStereoBase = item.second.get_value<double>();
             else if (pname == "dist_thresh") maxDistance = item.second.get_value<double>();
             else if (pname == "normalize_scale") normalizeScale = item.second.get_value<bool>();
+            else if (pname == "asynchronous_mapping") asyncMapping = item.second.get_value<bool>();
+            else if (pname == "guided_matching") guidedMatching = item.second.get_value<bool>();
+            else if (pname == "keyframe_memory_budget") 
+            {
+                keyframeMemoryBudget = item.second.get_value<double>() * (1 << 20);
+            }
         }
         
     }
@@ -66,6 +82,16 @@ struct MappingParameters
     //beyond this distance the points are not used for the localization
     double maxDistance = 5;
     bool normalizeScale = true;
+    
+    //the keyframe images beyond this size are stored compressed, in bytes (MB in the parameter file)
+    size_t keyframeMemoryBudget = 256 << 20;
+    
+    //the SGM, the depth merging, the motion stereo and the MI localization
+    //run in a background thread, feedImage only does the tracking
+    bool asyncMapping = false;
+    
+    //the sparse initialization matches along the odometry-predicted epipolar curves
+    bool guidedMatching = false;
 };
 
 
@@ -75,6 +101,39 @@ struct Frame
     Transf xi; //the position is defined in the global frame
 };
 
+//a task for the mapping thread
+struct MappingJob
+{
+    enum Type {JOB_KEYFRAME, JOB_STEREO, JOB_RELOCALIZE};
+    Type type;
+    int frameId; //the inter frame the job refers to
+    Mat8u img; //new inter frame for JOB_KEYFRAME, the current image for JOB_STEREO
+    Transf xiLocal; //pose of img wrt the inter frame
+    
+    //JOB_RELOCALIZE
+    int mapIdx;
+    Transf xiFrame; //inter frame pose at the request time
+    Transf xiMap;
+    Transf zetaOdom;
+    Transf appliedCorrection; //PhotometricMapping::_appliedCorrection at the request time
+};
+
+//the depth map published by the mapping thread
+struct DepthSnapshot
+{
+    int frameId;
+    DepthMap depth;
+};
+
+//the pose xiOld of the inter frame frameId has been corrected into xiNew by the MI localization
+struct PoseCorrection
+{
+    int frameId;
+    Transf xiOld;
+    Transf xiNew;
+    Transf appliedCorrection; //see MappingJob
+};
+
 //Speed estimation and extrapolation are to be added
 //Assumed that the data arrives in the chronological order
 
@@ -84,6 +143,8 @@ class PhotometricMapping
 public:
     PhotometricMapping(const ptree & params);
     
+    ~PhotometricMapping();
+    
     //true if the frame has been inserted
     bool constructMap(const Transf & xi, const Mat8u & img);
     
@@ -91,13 +152,19 @@ public:
     
     void feedImage(const Mat8u & img);
     
+    //feeds all the images ready in sync with their interpolated odometry, returns their number
+    int feedSynchronized(SensorSync & sync);
+    
     void pushInterFrame(const Mat8u & img);
     
     void reInit(const Transf & xi);
     
+    //appends a keyframe to the map and to the spatial index
+    void addKeyframe(const Mat8u & img, const Transf & xi);
+    
     int selectMapFrame(const Transf & xi, const double K = 4); //-1 means that there is no matching frame
     
-    Transf localizeMI(); //localizes the inter frame wrt _frameVec[_mapIdx]
+    Transf localizeMI(); //localizes the inter frame wrt the keyframe _mapIdx
     Transf localizePhoto(const Mat8u & img); //localizes the image wrt interFrame
     
     Transf getCameraMotion(const Transf & xi) const;
@@ -106,8 +173,33 @@ public:
     bool checkDistance(const Transf & xi1, const Transf & xi2, const double K = 1.) const;
     
     void improveStereo(const Mat8u & img);
+    
+    //blocks until the mapping thread has processed all the jobs and applies their results
+    void waitMapping();
+    
+    //number of stereo refinements skipped because the mapping thread was busy
+    int droppedJobCount();
+    
+    //writes the keyframes and, once the system is initialized, the inter frame with its depth map
+    void saveMap(const string & fileName);
+    
+    //appends the keyframes of a saved map, their images stay memory-mapped
+    //if resume is true and the map has an inter frame, the tracking restarts from it
+    //in MAP_LOCALIZE (MAP_SLAM if there is no keyframe around),
+    //which assumes that the robot has not moved since the map was saved;
+    //otherwise the usual initialization relocalizes the robot against the keyframes
+    void loadMap(const string & fileName, const bool resume = true);
 //private:
 
+    //asynchronous mapping
+    void pushInterFrameAsync(const Mat8u & img);
+    void pushMappingJob(MappingJob & job, const bool droppable);
+    void mappingLoop();
+    void processMappingJob(const MappingJob & job);
+    void publishDepth();
+    //takes the latest depth snapshot and the pose corrections, called by the tracking
+    void adoptMappingResults();
+
     enum State {MAP_BEGIN, MAP_INIT, MAP_LOCALIZE, MAP_SLAM};
     enum WarningType {WARNING_NONE, WARNING_SCALE, WARNING_ROTATION};
     
@@ -123,7 +215,11 @@ public:
     int _mapIdx; //currently active map frame
     bool _odomInit;
     Frame _interFrame;
-    vector<Frame> _frameVec;
+    vector<Transf> _frameXiVec; //keyframe poses
+    vector<int> _frameIdVec; //inter frame each keyframe comes from, -1 for the loaded ones
+    KeyframeStore _frameStore; //keyframe images
+    KeyframeIndex _frameIndex; //keyframe positions, for selectMapFrame
+    vector<std::shared_ptr<MapFile>> _mapFileVec; //loaded maps, own the external keyframe images
     DepthMap _depth;
     Transf _xiLocal; //current base pose estimation in the local frame
     Transf _xiLocalOld; //for VO scale rectification
@@ -144,6 +240,32 @@ public:
     MotionStereo _motionStereo;
     
     ScalePhotometric _localizer;
+    
+    int _interFrameId = 0;
+    std::mutex _storeMutex; //_frameStore is read by the mapping thread
+    
+    //mapping thread and its job queue
+    std::thread _mappingThread;
+    std::mutex _jobMutex;
+    std::condition_variable _jobCondition;
+    std::condition_variable _idleCondition;
+    std::deque<MappingJob> _jobQueue;
+    bool _mappingBusy = false;
+    bool _stopMapping = false;
+    int _droppedJobCount = 0;
+    
+    //results of the mapping thread
+    std::shared_ptr<const DepthSnapshot> _depthSnapshotPtr; //accessed with atomic_load/store
+    std::shared_ptr<const DepthSnapshot> _adoptedSnapshotPtr;
+    std::mutex _correctionMutex;
+    vector<PoseCorrection> _correctionVec;
+    //all the corrections applied by adoptMappingResults, composed on the left
+    Transf _appliedCorrection = Transf(0, 0, 0, 0, 0, 0);
+    
+    //state of the mapping thread, the latest processed inter frame
+    int _mapperFrameId = 0;
+    Mat8u _mapperImg;
+    DepthMap _mapperDepth;
 };
 
 
@@ -32,10 +32,14 @@ Relative camera pose estimation based on photometric error and depth map
 #include "reconstruction/eucm_sgm.h"
 #include "localization/photometric.h"
 #include "localization/sparse_odom.h"
+#include "localization/keyframe_store.h"
+#include "localization/sensor_sync.h"
+#include "localization/map_file.h"
 
 //TODO make a parameter structure
 const double MIN_INIT_DIST = 0.25;   // minimal distance traveled befor VO is used
 const double MIN_STEREO_BASE = 0.05; // minimal acceptable stereo base
+const double KEYFRAME_MEMORY_BUDGET = 64; // MB, default of "keyframe_memory_budget"
 
 //constants to create new keyframes, TODO put elsewhere
 const double MAX_DIST = 0.4;
@@ -49,12 +53,24 @@ public:
         
     ~MonoOdometry();
     
+    //the odometry is integrated from the origin, except after loadMap
+    //where the first measurement only becomes the reference of the next ones
     void feedWheelOdometry(const Transf xiOdomNew);
     void feedImage(const Mat8u & imageNew);
     
+    //feeds all the images ready in sync with their interpolated odometry, returns their number
+    int feedSynchronized(SensorSync & sync);
+    
     
     Transf getCameraMotion() const;
     
+    //writes the keyframes with their relative poses, and the depth map of the actual keyframe
+    void saveMap(const string & fileName);
+    
+    //restores a saved state, must be called before the first image
+    //the robot is assumed to be where it was when the map was saved
+    void loadMap(const string & fileName);
+    
 //private:
 
     void pushKeyFrame(const Mat8u & imageNew);
@@ -64,7 +80,8 @@ public:
     
     EnhancedCamera * _camera;
     // memory
-    vector<Mat8u> imageVec; //.back() is the actual key frame
+    KeyframeStore imageStore; //.back() is the actual key frame
+    std::shared_ptr<MapFile> mapFilePtr; //owns the images of a loaded map
     vector<Transf> transfVec;
     vector<Matrix6d> poseCovarVec;
     
@@ -75,6 +92,7 @@ public:
     Transf _xiGlobal;
     // the last WO measuremen to compute odometry increment
     Transf _xiOdom; 
+    bool _odomInit = true; //false until the first measurement after loadMap
     
     // camera position wrt wheel odometry frame
     Transf _xiBaseCam; 
@@ -0,0 +1,103 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Ingestion of timestamped images and wheel odometry coming from different threads
+Each stream goes through a bounded lock-free queue which drops the oldest
+elements under overload. The consumer gets every image together with
+the odometry interpolated at the image timestamp.
+*/
+
+#pragma once
+
+#include <deque>
+
+#include "std.h"
+#include "json.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "geometry/geometry.h"
+#include "utils/spsc_queue.h"
+
+struct TimedImage
+{
+    double time;
+    Mat8u img;
+};
+
+struct TimedPose
+{
+    double time;
+    Transf xi;
+};
+
+struct SensorSyncParameters
+{
+    SensorSyncParameters(const ptree & params)
+    {
+        for (auto & item : params)
+        {
+            const string & pname = item.first;
+            if (pname == "image_queue_size") imageQueueSize = item.second.get_value<int>();
+            else if (pname == "odometry_queue_size") odometryQueueSize = item.second.get_value<int>();
+            else if (pname == "max_odometry_gap") maxOdometryGap = item.second.get_value<double>();
+        }
+    }
+    
+    SensorSyncParameters() {}
+    
+    //queue capacities, beyond them the oldest elements are dropped
+    int imageQueueSize = 4;
+    int odometryQueueSize = 256;
+    
+    //an image is dropped if one of the two odometry measurements around it
+    //is farther than that, in seconds
+    double maxOdometryGap = 0.1;
+};
+
+//linear interpolation on SE(3) between the poses xi0 at t0 and xi1 at t1
+Transf interpolatePose(const TimedPose & pose0, const TimedPose & pose1, const double t);
+
+class SensorSync
+{
+public:
+    SensorSync(const SensorSyncParameters & params);
+    
+    //producer side, each of them must be called from a single thread
+    //the data of each stream is assumed to arrive in the chronological order
+    void pushImage(const double t, const Mat8u & img);
+    void pushOdometry(const double t, const Transf & xi);
+    
+    //consumer side
+    //false if no image is ready, that is the odometry after the next image has not arrived yet
+    bool pop(TimedImage & image, Transf & xi);
+    
+    uint64_t droppedImageCount() const { return _imageQueue.droppedCount() + _unmatchedCount; }
+    uint64_t droppedOdometryCount() const { return _odometryQueue.droppedCount(); }
+    
+private:
+    SensorSyncParameters _params;
+    SpscQueue<TimedImage> _imageQueue;
+    SpscQueue<TimedPose> _odometryQueue;
+    
+    //consumer state
+    std::deque<TimedPose> _odometryBuffer; //the odometry received so far, chronological
+    TimedImage _pendingImage;
+    bool _hasPendingImage;
+    uint64_t _unmatchedCount;
+};
+
@@ -28,12 +28,15 @@ Relative camera pose estimation based on photometric error and depth map
 
 #include "geometry/geometry.h"
 #include "projection/generic_camera.h"
+#include "reconstruction/triangulator.h"
 
 //TODO make a parameter structure
 //const double MIN_INIT_DIST = 0.25;   // minimal distance traveled befor VO is used
 //const double MIN_STEREO_BASE = 0.25; // minimal acceptable stereo base
  // Feature matching threshold
 
+enum DescriptorType {DESCRIPTOR_PATCH, DESCRIPTOR_BINARY};
+
 class SparseOdometry
 {
 public:
@@ -45,6 +48,8 @@ public:
     camera(cameraPtr->clone()),
 //    detector(25, 3, 1),
     numRansacPoints(2),
+    guidedMatching(false),
+    descriptorType(DESCRIPTOR_PATCH),
     MIN_STEREO_BASE(minDist),
     _g(0)
     { }
@@ -53,6 +58,21 @@ public:
     
     void feedData(const Mat8u & imageNew, const Transf xiOdomNew);
     
+    // matches desc1 against desc2 with cross-check, comparing only the keypoints
+    // which lie close to the epipolar curves predicted by the camera motion dxi
+    void guidedMatch(const Transf dxi, vector<DMatch> & matchVec) const;
+    
+    // brute-force matching is used otherwise, which is the default
+    // the guided matching assumes the odometry error to stay within the search window
+    void setGuidedMatching(bool val) { guidedMatching = val; }
+    
+    // DESCRIPTOR_PATCH -- 81 Gaussian-weighted intensities, L1 distance
+    // DESCRIPTOR_BINARY -- 256 intensity comparisons, Hamming distance
+    void setDescriptorType(DescriptorType val) { descriptorType = val; }
+    
+    // distance between desc1[idx1] and desc2[idx2] for the current descriptor type
+    float descriptorDistance(int idx1, int idx2) const;
+    
       
     double computeTransfSparse(const Vector3dVec & xVec1, const Vector3dVec & xVec2, 
             const Vector2dVec & pVec2, const vector<double> & sizeVec, const Transf xiOdom, Transf & xiOut, bool report = false);
@@ -69,6 +89,12 @@ public:
     Vector2dVec reprojectPoints(const Vector3dVec & cloud1,
     const Vector3dVec & cloud2, const Transf dxi);
     
+    // reprojection error of a single match for the camera motion dxi
+    // triangulator must be set to dxi, it is shared by all the matches of a hypothesis
+    // DOUBLE_BIG if the triangulated point cannot be projected
+    double reprojectionError(const Triangulator & triangulator, const Transf & dxi,
+        const Vector3d & x1, const Vector3d & x2, const Vector2d & p2) const;
+    
     const Transf & getIncrement() const { return xiIncr; }
     const Transf & getIntegrated() const { return xiLocal; }
     
@@ -82,6 +108,7 @@ private:
 //    vector<KeyPoint> keypointVec2;
     
     Mat32f desc1, desc2;
+    Mat8u binDesc1, binDesc2;
     
     Mat8u imageOld;
     
@@ -91,6 +118,9 @@ private:
     // 1 or 2 points rely on the odometry estimation
     const int numRansacPoints; 
     
+    bool guidedMatching;
+    DescriptorType descriptorType;
+    
     
     // state
     Transf xiLocal; // integrated VO path
@@ -108,6 +138,8 @@ private:
     mt19937 _g;
     
     const int distThresh = 2500; //for descriptor comparison
+    const int binaryDistThresh = 64; //out of 256 bits
+    const double searchRadius = 20; //guided matching window around the epipolar curve, in pixels
     const double MIN_STEREO_BASE;  // minimal acceptable stereo base
 };
 
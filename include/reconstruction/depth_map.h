@@ -24,6 +24,8 @@ NOTE:
 
 #pragma once
 
+#include <memory>
+
 #include "io.h"
 #include "std.h"
 #include "eigen.h"
@@ -51,6 +53,17 @@ enum ReconstructionFlags : uint32_t
 // Performs a filtered merge on the input depths and sigmas
 void filter(double & v1, double & s1, const double v2, const double s2);
 
+// Pixel counts of DepthMap::fuse, for monitoring
+struct DepthFusionStats
+{
+    int newValid = 0;       // valid pixels in the new depth map before the noise filter
+    int noiseRejected = 0;  // removed by the noise filter
+    int inserted = 0;       // filled an empty pixel
+    int fused = 0;          // consistent depths merged with filter()
+    int replaced = 0;       // inconsistent, the new depth is closer and replaces the old one
+    int discarded = 0;      // inconsistent, the new depth is farther and is dropped
+};
+
 class DepthMap : public ScaleParameters
 {
 public:
@@ -66,7 +79,8 @@ public:
             sigmaVec(depth.sigmaVec),
             costVec(depth.costVec),
             hMax(depth.hMax),
-            hStep(depth.hStep) {}
+            hStep(depth.hStep),
+            bearingPtr(std::atomic_load(&depth.bearingPtr)) {}
 
     //basic constructor for multi-hypothesis
     DepthMap(const ICamera * camera, const ScaleParameters & params, const int hMax = 1):
@@ -101,6 +115,7 @@ public:
             costVec = other.costVec;
             hMax = other.hMax;
             hStep = other.hStep;
+            std::atomic_store(&bearingPtr, std::atomic_load(&other.bearingPtr));
         }
         return *this;
     }
@@ -175,6 +190,12 @@ public:
     
     Vector2dVec getPointVec(const std::vector<int> & idxVec) const;
     Vector2dVec getPointVec() const;
+    
+    // unit bearing vectors of all the depth map points, zero if the point cannot be reconstructed
+    // computed on the first call and shared between the copies of the depth map,
+    // recomputed if the scale parameters have changed since
+    // safe to call concurrently, the caller keeps the vector alive as long as it holds the pointer
+    std::shared_ptr<const Vector3dVec> getBearingVec() const;
 
     //TODO overload instead of default args
     vector<int> getIdxVec(const Vector2dVec & queryPointVec = Vector2dVec()) const;
@@ -198,6 +219,8 @@ public:
     //   use ALL_HYPOTHESES with QUERY_POINT.
     // To use IMAGE_VALUES, insert the value vector into result.valVec. This should
     //   only be used along with QUERY_POINT
+    // The vectors of result are resized in place, reuse the same pack for every frame
+    //   to keep their capacity. The pixel grid points use the cached bearing vectors
     void reconstruct(MHPack & result, const uint32_t reconstFlags = 0 ) const;
     
     //TODO make it bool and make it return a mask
@@ -217,6 +240,10 @@ public:
             Transformation<double> TcameraPlane, const Vector3dVec & polygonVec);
     
     void merge(const DepthMap & depth2);
+    
+    // Equivalent to depth2.filterNoise() followed by merge(depth2),
+    // done in one row-parallel pass without modifying depth2
+    DepthFusionStats fuse(const DepthMap & depth2);
 
     /*
     Takes the depthmap from the first image, reconstructs the pointcloud
@@ -230,7 +257,14 @@ public:
     void wrapDepth(const DepthMap& dMap1, const DepthMap& dMap2,
             const Transformation<double> T12, DepthMap& output) const;
 
-    DepthMap wrapDepth(const Transformation<double> T12) const;
+    /*
+    Forward-warps the first hypothesis layer into the frame T12 in a single pass:
+    every point is reconstructed from the cached bearing vectors, transformed, projected
+    and z-buffered; the nearest point wins.
+    With splatRadius > 0 every point also covers the (2 splatRadius + 1)^2 neighborhood
+    of its projection, which fills the holes caused by the resampling
+    */
+    DepthMap wrapDepth(const Transformation<double> T12, const int splatRadius = 0) const;
 
     // Filters all hypotheses to remove noise, using either a median filter or 
     // average filter, depending on the number of matching neighbour hypotheses
@@ -264,4 +298,13 @@ private:
     int hStep; // Step to get to the next hypothesis
     
     ICamera * cameraPtr;
+    
+    // the bearing vectors with the scale parameters they were computed for
+    // always accessed with std::atomic_load / std::atomic_store
+    struct BearingCache
+    {
+        ScaleParameters params;
+        Vector3dVec bearingVec;
+    };
+    mutable std::shared_ptr<const BearingCache> bearingPtr;
 };
@@ -0,0 +1,143 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Precomputed rasterization of the epipolar curves in the second image.
+For a given stereo transformation every epipolar plane is sampled once into
+a sequence of 8-connected pixels. The curve of any point is then an index into
+the sequence of its plane, stepping along it costs an increment.
+The sequences are computed on the first request, the table is not thread-safe.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+#include "std.h"
+#include "eigen.h"
+
+#include "geometry/geometry.h"
+#include "projection/eucm.h"
+#include "reconstruction/eucm_epipolar.h"
+
+// one epipolar plane, ordered by the polar angle in the plane
+// the angle is 0 at the epipole and +-pi at the anti-epipole
+struct EpipolarSequence
+{
+    // -1 where the curve is out of the image or not projected,
+    // a single entry stands for a long invisible part
+    vector<int16_t> uVec, vVec;
+    vector<float> angleVec;
+    
+    // the whole plane is visible, the indices wrap around
+    bool closed = false;
+    bool ready = false;
+};
+
+// walks along a precomputed curve, the same interface as CurveRasterizer
+// (u, v) is (-1, -1) out of the image
+class EpipolarRaster
+{
+public:
+    int u, v;
+    
+    EpipolarRaster() : u(-1), v(-1), _seqPtr(NULL), _idx(0), _eps(1), _block(0), _blockDir(0) {}
+    
+    // if blockDir is not 0 the indices beyond block in the direction blockDir are out of the image
+    // it is used when the curve starts out of the image and enters it at the entry block
+    EpipolarRaster(const EpipolarSequence * seqPtr, const int idx, const int eps,
+            const int block = 0, const int blockDir = 0) :
+        _seqPtr(seqPtr), _idx(idx), _eps(eps), _block(block), _blockDir(blockDir)
+    {
+        move(0);
+    }
+    
+    void setStep(const int step) { _eps *= step; }
+    
+    void step() { move(_eps); }
+    
+    void steps(const int n) { move(_eps * n); }
+    
+private:
+    void move(const int n)
+    {
+        _idx += n;
+        int idx = _idx;
+        const int size = _seqPtr == NULL ? 0 : _seqPtr->uVec.size();
+        if (size > 0 and _seqPtr->closed)
+        {
+            idx %= size;
+            if (idx < 0) idx += size;
+        }
+        if (idx < 0 or idx >= size or (_idx - _block) * _blockDir > 0)
+        {
+            u = -1;
+            v = -1;
+        }
+        else
+        {
+            u = _seqPtr->uVec[idx];
+            v = _seqPtr->vVec[idx];
+        }
+    }
+    
+    const EpipolarSequence * _seqPtr;
+    int _idx;
+    int _eps;
+    int _block;
+    int _blockDir;
+};
+
+class EpipolarTable
+{
+public:
+    // the curves are rasterized within [0, uMax) x [0, vMax)
+    EpipolarTable(const EnhancedCamera * camera2, const int uMax, const int vMax);
+    
+    // drops all the sequences, curves must be already initialized with T12
+    void setTransformation(const EnhancedEpipolar & curves, const Transf & T12);
+    
+    // the curve of the point X1 given in the first camera frame, 
+    // starts at the projection of X2 given in the second camera frame and 
+    // goes towards the epipole, that is in the direction of the decreasing depth
+    // X2 must belong to the epipolar plane of X1
+    EpipolarRaster raster(const Vector3d & X1, const Vector3d & X2) const;
+    
+private:
+    // the sequences are created on demand
+    const EpipolarSequence & sequence(const int planeIdx) const;
+    
+    void rasterize(const int planeIdx, EpipolarSequence & seq) const;
+    
+    // polar angle of X2 in the plane
+    double angle(const int planeIdx, const Vector3d & X2) const;
+    
+    const EnhancedCamera * _camera;
+    const EnhancedEpipolar * _curves;
+    const int _uMax, _vMax;
+    
+    // about two samples per pixel at the image center
+    int _sampleCount;
+    vector<double> _angleVec, _cosVec, _sinVec;
+    
+    // the epipole direction and the planes rotated into the second frame
+    Vector3d _epipoleDir;
+    Matrix3d _R21;
+    
+    mutable vector<EpipolarSequence> _sequenceVec;
+};
+
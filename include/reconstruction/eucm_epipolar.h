@@ -93,6 +93,17 @@ public:
     
     //TODO separate function?
     Polynomial2 computePolynomial(Vector3d plane) const;
+    
+    // the discretization of the epipolar planes, valid after initialize()
+    // the plane index is in [0, numberSteps], numberSteps is the same plane as 0
+    int planeCount() const { return nSteps; }
+    int planeIndex(const Vector3d & X) const { return index(X); }
+    
+    // a vector of the plane orthogonal to the baseline, in the first camera frame
+    Vector3d planeDirection(int idx) const;
+    
+    // the unit vector pointing from the second camera center to the first one
+    const Vector3d & baseDirection() const { return zBase; }
 private:
     
     void prepareCamera(CameraIdx camIdx);
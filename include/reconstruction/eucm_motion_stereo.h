@@ -43,11 +43,16 @@ struct MotionStereoParameters : public StereoParameters
         {
             const string & pname = item.first;
             if (pname == "gradient_thresh") gradientThresh = item.second.get_value<int>();
+            else if (pname == "subpixel_samples") subpixelSamples = item.second.get_value<int>();
         }
     }
     
     MotionStereoParameters(const StereoParameters & stereoParams) : StereoParameters(stereoParams) {}
     int gradientThresh = 2;
+    
+    //samples per pixel along the epipolar curves in the second image,
+    //with more than one the image is interpolated and the depth is refined accordingly
+    int subpixelSamples = 1;
 };
 
 
@@ -59,6 +64,10 @@ public:
         EnhancedStereo(cam1, cam2, params),
         _params(params)
     {
+        if (params.subpixelSamples < 1)
+        {
+            throw std::runtime_error("MotionStereo : subpixel_samples must be positive");
+        }
     }
 
     virtual ~MotionStereo()
@@ -103,7 +112,19 @@ public:
     
     bool sampleImage(const Mat8u & img2);
     
-    void reconstruct(double & dist, double & sigma, double & cost);
+    // fills gsampleVec, guVec and gvVec, starting HALF_LENGTH steps before the raster
+    template<class Raster>
+    bool sampleCurve(Raster & raster, const Mat8u & img2);
+    
+    // the same with _params.subpixelSamples interpolated samples per step
+    bool sampleCurveSubpixel(const Mat8u & img2);
+    
+    // matches the descriptor along the sampled curve,
+    // a match better than cost is queued for the triangulation
+    void match(const int depthIdx, const double cost);
+    
+    // triangulates all the queued matches at once and fuses them into depth
+    void reconstructMatches(DepthMap & depth);
     
 private:
     
@@ -156,6 +177,11 @@ private:
     
     vector<uint8_t> gdescriptor;
     vector<uint8_t> gsampleVec;
-    vector<int> guVec, gvVec;
+    vector<double> guVec, gvVec;
+    
+    //matches waiting for the triangulation
+    Vector2dVec _pt11Vec, _pt12Vec, _pt21Vec, _pt22Vec;
+    vector<int> _matchIdxVec;
+    vector<int> _matchCostVec;
 };
 
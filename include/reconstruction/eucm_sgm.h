@@ -25,6 +25,8 @@ NOTE:
 
 #pragma once
 
+#include <memory>
+
 #include "std.h"
 #include "ocv.h"
 #include "eigen.h"
@@ -51,6 +53,10 @@ struct SgmParameters : public StereoParameters
             else if (pname == "image_based_cost")       imageBasedCost = item.second.get_value<bool>();
             else if (pname == "salient_points_only")    salientPoints = item.second.get_value<bool>();
             else if (pname == "use_uv_cache")           useUVCache = item.second.get_value<bool>();
+            else if (pname == "pyramid_levels")         pyramidLevels = item.second.get_value<int>();
+            else if (pname == "disparity_band")         dispBand = item.second.get_value<int>();
+            else if (pname == "prior_sigma_scale")      priorSigmaScale = item.second.get_value<double>();
+            else if (pname == "prior_disparity_margin") priorDispMargin = item.second.get_value<int>();
         }
     }
     
@@ -67,6 +73,17 @@ struct SgmParameters : public StereoParameters
     
     //precompute all the epipolar curves
     bool useUVCache = true;
+    
+    //coarse-to-fine search: the whole disparity range is searched only at the coarsest level,
+    //each finer level searches dispBand disparities on each side of the upsampled coarse result
+    //1 means no pyramid
+    int pyramidLevels = 1;
+    int dispBand = 6;
+    
+    //with a depth prior only the disparities of [depth - k*sigma, depth + k*sigma] are matched,
+    //extended by priorDispMargin on each side
+    double priorSigmaScale = 3;
+    int priorDispMargin = 2;
 };
 
 //TODO revamp, take MotionStereo as a model
@@ -79,12 +96,19 @@ public:
             EnhancedStereo(cam1, cam2, params),
             _params(params)
     { 
+        if (params.useEpipolarTable)
+        {
+            _epipolarTable.reset(new EpipolarTable(_camera2, params.uMax, params.vMax));
+        }
         setTransformation(T12);
         assert(params.dispMax % 2 == 0);
+        assert(params.pyramidLevels > 0);
+        _dispWidth = params.pyramidLevels > 1 ? min(params.dispMax, 2 * params.dispBand) : params.dispMax;
         createBuffer();
         computeReconstructed();
         computeRotated();
         computePinf();
+        if (params.pyramidLevels > 1) createCoarseLevel();
         if (params.useUVCache) computeUVCache();
     }
     
@@ -93,11 +117,39 @@ public:
     }
     
     // precompute coordinates for different disparities to speedup the computation
+    // the whole disparity range is cached, so it does not depend on the disparity bands
     void computeUVCache();
     
+    template<class Raster>
+    void fillUVCache(Raster & raster, int x, int y);
+    
     // An interface function
     void computeStereo(const Mat8u & img1, const Mat8u & img2, DepthMap & depthMap);
     
+    // the matching is restricted by the prior depth map of the first camera, 
+    // which must have the same ScaleParameters
+    // the pixels without a prior are matched along the whole range
+    void computeStereo(const Mat8u & img1, const Mat8u & img2, const DepthMap & prior,
+            DepthMap & depthMap);
+    
+    // everything but the depth reconstruction, the result is in disparity()
+    void computeDisparity(const Mat8u & img1, const Mat8u & img2, const DepthMap * prior = NULL);
+    
+    // the same stereo setup for the images downscaled by cv::pyrDown
+    void createCoarseLevel();
+    
+    // restricts _searchBegin and _searchEnd to the disparities allowed by the prior
+    void computePriorRange(const DepthMap & prior);
+    
+    // number of curve steps between the infinity point and the projection of X1
+    // returns -1 if X1 is not projected
+    int priorDisparity(const int idx, const Vector3d & X1) const;
+    
+    // runs the stereo on the downscaled images and sets _dispOffset around the coarse disparity
+    // the pixels without a coarse estimate take the band of the closest pixel which has one,
+    // they are skipped only if the coarse level has no estimate at all
+    void computeDisparityBand(const Mat8u & img1, const Mat8u & img2);
+    
     //// EPIPOLAR GEOMETRY
     
     // computes reconstVec -- reconstruction of every pixel of the first image
@@ -121,7 +173,9 @@ public:
     
     void computeDynamicProgramming();
     
-    void computeDynamicStep(const int* inCost, const uint8_t * error, int * outCost);
+    // shift is the disparity offset of the current pixel minus that of the previous one
+    void computeDynamicStep(const int* inCost, const uint8_t * error, int * outCost,
+            const int shift = 0);
     void computeDynamicStep2(const int* inCost, const uint32_t * error, int * outCost);
     void reconstructDisparityMH();
     void reconstructDisparity();  // using the result of the dynamic programming
@@ -136,10 +190,23 @@ public:
     CurveRasterizer<int, Polynomial2> getCurveRasteriser(CameraIdx camIdx, int idx,
                                                          uint32_t * flags = NULL) const;
     
+    // the curve in the second image from the precomputed table,
+    // starts at the projection of the point at infinity
+    EpipolarRaster getEpipolarRaster(int idx) const
+    {
+        return _epipolarTable->raster(_reconstVec[idx], _reconstRotVec[idx]);
+    }
+    
+    // samples the whole sampleVec along the curve, starting HALF_LENGTH steps before the raster
+    // returns false if the curve leaves the image
+    template<class Raster>
+    bool sampleCurve(Raster & raster, const Mat8u & img2, const int step,
+            vector<uint8_t> & sampleVec) const;
+    
     void skipPixel(int x, int y);
     
     // reconstruction
-    void fillGaps(uint8_t * const data, const int step);
+    void fillGaps(uint8_t * const data, const int step, const int length);
     
     Mat32s & disparity() { return _smallDisparity; }
     
@@ -160,6 +227,19 @@ private:
     int _jumpCost;
     
     const int DISPARITY_MARGIN = 20;
+    
+    // the buffers of the pixel (x, y) store the disparities 
+    // [_dispOffset(y, x), _dispOffset(y, x) + _dispWidth), the offset is 0 without the pyramid
+    int _dispWidth;
+    Mat32s _dispOffset;
+    std::unique_ptr<EnhancedSgm> _coarseSgm;
+    
+    // the matching costs are computed for the buffer indices [_searchBegin, _searchEnd),
+    // the rest of the buffer gets the maximum error
+    Mat32s _searchBegin, _searchEnd;
+    
+    // _params.dispMax + 2 * DISPARITY_MARGIN curve points per pixel, 
+    // starting DISPARITY_MARGIN steps before the infinity point
     Mat32s _uCache, _vCache;
     Mat8u _errorBuffer;
     Mat8u _costBuffer; //TODO maybe merge with salientBuffer
@@ -25,6 +25,8 @@ NOTE:
 
 #pragma once
 
+#include <memory>
+
 #include "std.h"
 #include "eigen.h"
 #include "json.h"
@@ -36,6 +38,7 @@ NOTE:
 #include "reconstruction/epipoles.h"
 #include "reconstruction/epipolar_descriptor.h"
 #include "reconstruction/eucm_epipolar.h"
+#include "reconstruction/epipolar_table.h"
 
 struct StereoParameters : public ScaleParameters
 {
@@ -68,6 +71,14 @@ struct StereoParameters : public ScaleParameters
     int descRespThresh = 5;
     
     int numEpipolarPlanes = 2000;
+    
+    //EnhancedSgm only: sample the epipolar curves in the second image from precomputed
+    //per-plane tables instead of rasterizing them pixel by pixel
+    //every SGM object builds its own table for its transformation, so it only pays off
+    //for a fixed-rig stereo object reused over many frames with dense depth grids;
+    //the mapping creates a new SGM object per keyframe, where the table is always cold
+    //MotionStereo ignores it, its transformation changes every frame
+    bool useEpipolarTable = false;
 };
 
 /*
@@ -78,6 +89,10 @@ returns a verctor of costs for each possible disparity value
 vector<int> compareDescriptor(const vector<uint8_t> & desc,
         const vector<uint8_t> & sampleVec, int flawCost);
 
+//the triangulated points which are farther are rejected
+//FIXME
+const double TRIANGULATE_DIST_MAX = 100;
+
 class EnhancedStereo
 {
 public:
@@ -104,6 +119,18 @@ public:
     
     bool triangulate(const Vector2d pt11, const Vector2d pt12, const Vector2d pt21,
         const Vector2d pt22, double & d, double & sigma) const;
+    
+    // batched triangulate(pt11, pt12, pt21, pt22, d, sigma)
+    // d and sigma are OUT_OF_RANGE where the points cannot be reconstructed
+    void triangulate(const Vector2dVec & pt11Vec, const Vector2dVec & pt12Vec,
+        const Vector2dVec & pt21Vec, const Vector2dVec & pt22Vec,
+        vector<double> & dVec, vector<double> & sigmaVec) const;
+    
+    // the same for the reconstructed directions, p in the first frame and q in the second one
+    // d is the distance along p1, sigma is its difference to the one given by (p2, q2)
+    void triangulate(const DirectionBatch & p1Batch, const DirectionBatch & p2Batch,
+        const DirectionBatch & q1Batch, const DirectionBatch & q2Batch,
+        double * d, double * sigma) const;
         
     const StereoEpipoles & epipoles() const { return _epipolarCurves.getEpipoles(); }
     
@@ -112,6 +139,9 @@ protected:
     StereoParameters _params;
     EnhancedCamera *_camera1, *_camera2;
     EnhancedEpipolar _epipolarCurves;
+    // created by EnhancedSgm with useEpipolarTable, NULL otherwise
+    // it is not shared between the stereo objects, its sequences depend on the transformation
+    std::unique_ptr<EpipolarTable> _epipolarTable;
     EpipolarDescriptor _epipolarDescriptor;
     
     const int HALF_LENGTH;
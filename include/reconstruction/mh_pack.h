@@ -25,6 +25,12 @@ struct MHPack
 
     Data datatype; // datatype of the values in cloud
 
+    // Scratch buffers of DepthMap::reconstruct, not a part of the result
+    // Keeping the pack between the calls avoids any allocation in the steady state
+    std::vector<int> queryIdxBuffer;
+    Vector2dVec queryPointBuffer;
+    std::vector<int> chunkOffsetBuffer;
+
     // Default constructor
     MHPack() :
         datatype(NO_DATA) {}
@@ -27,6 +27,48 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 // linear extrapolation otherwise
 double regDiv(double num, double denom, double EPS);
 
+// direction vectors stored as a structure of arrays,
+// the batched triangulation runs over contiguous coordinates
+struct DirectionBatch
+{
+    DirectionBatch() {}
+    
+    DirectionBatch(const Vector3dVec & dirVec)
+    {
+        resize(dirVec.size());
+        for (int i = 0; i < dirVec.size(); i++) set(i, dirVec[i]);
+    }
+    
+    int size() const { return xVec.size(); }
+    
+    void resize(const int n)
+    {
+        xVec.resize(n);
+        yVec.resize(n);
+        zVec.resize(n);
+    }
+    
+    void clear() { resize(0); }
+    
+    void set(const int i, const Vector3d & X)
+    {
+        xVec[i] = X[0];
+        yVec[i] = X[1];
+        zVec[i] = X[2];
+    }
+    
+    void push_back(const Vector3d & X)
+    {
+        xVec.push_back(X[0]);
+        yVec.push_back(X[1]);
+        zVec.push_back(X[2]);
+    }
+    
+    Vector3d get(const int i) const { return Vector3d(xVec[i], yVec[i], zVec[i]); }
+    
+    vector<double> xVec, yVec, zVec;
+};
+
 
 class Triangulator
 {
@@ -107,31 +149,29 @@ public:
         }
     }
     
+    /*
+    the pairs are copied into a DirectionBatch only when it pays off:
+    with no jacobians and enough pairs to be split between the threads.
+    Otherwise, like for the cost functions evaluated by ceres, the scalar solver is used
+    */
     void computeRegular(const Vector3dVec & pVec, const Vector3dVec & qVec,
         double * res1, double * res2 = NULL,
-        double * jac1 = NULL, double * jac2 = NULL) const
-    {
-        assert(pVec.size() == qVec.size());
-        assert(res1 != NULL or res2 != NULL);
-        if (jac1 != NULL)
-        {
-            assert(res1 != NULL);
-        }
-        if (jac2 != NULL)
-        {
-            assert(res2 != NULL);
-        }
-        for (int i = 0; i < pVec.size(); i++)
-        {
-            computeRegular(pVec[i], qVec[i],
-                    res1 != NULL ? res1 + i : NULL,
-                    res2 != NULL ? res2 + i : NULL,
-                    jac1 != NULL ? jac1 + 6 * i : NULL,
-                    jac2 != NULL ? jac2 + 6 * i : NULL);
-        }
-    }
+        double * jac1 = NULL, double * jac2 = NULL) const;
+    
+    /*
+    Batched computeRegular, the results are laid out as for the vector overloads.
+    The batch is split into chunks solved in parallel, 
+    the jacobians, if requested, are computed by the scalar solver
+    */
+    void computeRegular(const DirectionBatch & pBatch, const DirectionBatch & qBatch,
+        double * res1, double * res2 = NULL,
+        double * jac1 = NULL, double * jac2 = NULL) const;
     
 private:
+    // closed-form solution for the pairs in [begin, end) without jacobians
+    void computeRegularRange(const DirectionBatch & pBatch, const DirectionBatch & qBatch,
+        const int begin, const int end, double * res1, double * res2) const;
+    
     Matrix3d R;
     Vector3d t;
     double eps;
@@ -25,6 +25,7 @@ STL types and methods
 #include <vector>
 #include <array>
 #include <map>
+#include <set>
 #include <queue>
 #include <list>
 #include <algorithm>
@@ -40,6 +41,7 @@ using std::list;
 using std::array;
 using std::pair;
 using std::map;
+using std::set;
 using Array6d = array<double, 6>;
 using std::make_pair;
 
@@ -0,0 +1,44 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Pass/fail reporting for the self-checking test programs
+*/
+
+#pragma once
+
+#include <iostream>
+#include <string>
+
+inline int & checkFailCount()
+{
+    static int failCount = 0;
+    return failCount;
+}
+
+inline void check(const bool condition, const std::string & name)
+{
+    std::cout << (condition ? "    OK     " : "    FAILED ") << name << std::endl;
+    if (not condition) checkFailCount()++;
+}
+
+// prints the summary, the result is the exit code of the test
+inline int checkSummary()
+{
+    std::cout << (checkFailCount() == 0 ? "ALL PASSED" : "SOME FAILED") << std::endl;
+    return checkFailCount() == 0 ? 0 : 1;
+}
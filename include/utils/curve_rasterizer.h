@@ -46,19 +46,19 @@ struct Polynomial2
 //    Polynomial2(const std::array<double, 6> & coeffs) : coeffArr(coeffs) {}
 //    std::array<double, 6> coeffArr;
     double kuu, kuv, kvv, ku, kv, k1;
-    double operator() (int u, int v) const
+    double operator() (double u, double v) const
     {
         return (kuu*u + kuv*v + ku)*u 
                 + (kvv*v + kv)*v 
                 + k1;
     }
     
-    double gradu(int u, int v) const
+    double gradu(double u, double v) const
     {
         return 2*kuu*u + kuv*v + ku;
     }
     
-    double gradv(int u, int v) const
+    double gradv(double u, double v) const
     {
         return kuv*u + 2*kvv*v + + kv;
     }
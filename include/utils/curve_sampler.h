@@ -0,0 +1,153 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Sub-pixel sampling of images along implicit curves
+*/
+
+#pragma once
+
+#include "std.h"
+#include "ocv.h"
+#include "eigen.h"
+
+// walks along an implicit curve with a constant sub-pixel step,
+// the same interface as CurveRasterizer but with real coordinates
+// the step length is measured like CurveRasterizer does it, along the dominant direction,
+// so that K steps of 1/K cover the same distance as one rasterizer step
+template<class Surface>
+struct CurveSampler
+{
+    double u, v;
+    double eps;
+    Surface surf;
+    
+    // goes towards goal, which does not have to be on the curve
+    // the starting point is projected onto the curve
+    CurveSampler(const Vector2d & pt, const Vector2d & goal, const Surface & surf,
+            const double length = 1) :
+        u(pt[0]), v(pt[1]), surf(surf)
+    {
+        project();
+        const double fu = surf.gradu(u, v);
+        const double fv = surf.gradv(u, v);
+        eps = (fu*(goal[1] - v) - fv*(goal[0] - u) > 0) ? length : -length;
+    }
+    
+    void setStep(const double step)
+    {
+        eps *= step;
+    }
+    
+    void step()
+    {
+        move(eps);
+    }
+    
+    void steps(const int nsteps)
+    {
+        for (int i = 0; i < abs(nsteps); i++)
+        {
+            move(nsteps > 0 ? eps : -eps);
+        }
+    }
+    
+private:
+    // along the tangent, then back onto the curve along the gradient
+    void move(const double ds)
+    {
+        const double fu = surf.gradu(u, v);
+        const double fv = surf.gradv(u, v);
+        const double norm = max(abs(fu), abs(fv));
+        if (norm == 0) return;
+        u -= ds * fv / norm;
+        v += ds * fu / norm;
+        project();
+    }
+    
+    // one Newton iteration is enough for steps shorter than a pixel
+    void project()
+    {
+        const double fu = surf.gradu(u, v);
+        const double fv = surf.gradv(u, v);
+        const double norm2 = fu * fu + fv * fv;
+        if (norm2 == 0) return;
+        const double delta = surf(u, v) / norm2;
+        u -= delta * fu;
+        v -= delta * fv;
+    }
+};
+
+// bilinear interpolation of an 8-bit image with the precision of 1/SUBPIXEL_COUNT pixel
+// the weights of every sub-pixel position are precomputed in fixed point,
+// so that a sample costs four multiplications and no floating point arithmetic
+class BilinearSampler
+{
+public:
+    static const int SUBPIXEL_BITS = 4;
+    static const int SUBPIXEL_COUNT = 1 << SUBPIXEL_BITS;
+    
+    BilinearSampler(const Mat8u & img) : _img(img) {}
+    
+    // the interpolation domain is [0, cols - 1) x [0, rows - 1)
+    bool inside(const double u, const double v) const
+    {
+        const int ui = round(u * SUBPIXEL_COUNT);
+        const int vi = round(v * SUBPIXEL_COUNT);
+        return ui >= 0 and vi >= 0 and 
+                ui < (_img.cols - 1) * SUBPIXEL_COUNT and vi < (_img.rows - 1) * SUBPIXEL_COUNT;
+    }
+    
+    // (u, v) must be inside
+    uint8_t operator() (const double u, const double v) const
+    {
+        const int ui = round(u * SUBPIXEL_COUNT);
+        const int vi = round(v * SUBPIXEL_COUNT);
+        const int u0 = ui >> SUBPIXEL_BITS;
+        const int v0 = vi >> SUBPIXEL_BITS;
+        const array<int, 4> & w = weightTable()[(vi & SUBPIXEL_MASK) * SUBPIXEL_COUNT + (ui & SUBPIXEL_MASK)];
+        const uint8_t * row0 = _img.ptr(v0) + u0;
+        const uint8_t * row1 = _img.ptr(v0 + 1) + u0;
+        return (w[0] * row0[0] + w[1] * row0[1] + w[2] * row1[0] + w[3] * row1[1] 
+                + WEIGHT_HALF) >> (2 * SUBPIXEL_BITS);
+    }
+    
+private:
+    static const int SUBPIXEL_MASK = SUBPIXEL_COUNT - 1;
+    static const int WEIGHT_HALF = 1 << (2 * SUBPIXEL_BITS - 1);
+    
+    // the four weights sum up to SUBPIXEL_COUNT^2
+    static const vector<array<int, 4>> & weightTable()
+    {
+        static const vector<array<int, 4>> table = []()
+        {
+            vector<array<int, 4>> res(SUBPIXEL_COUNT * SUBPIXEL_COUNT);
+            for (int dv = 0; dv < SUBPIXEL_COUNT; dv++)
+            {
+                for (int du = 0; du < SUBPIXEL_COUNT; du++)
+                {
+                    res[dv * SUBPIXEL_COUNT + du] = {(SUBPIXEL_COUNT - du) * (SUBPIXEL_COUNT - dv),
+                            du * (SUBPIXEL_COUNT - dv), (SUBPIXEL_COUNT - du) * dv, du * dv};
+                }
+            }
+            return res;
+        }();
+        return table;
+    }
+    
+    const Mat8u & _img;
+};
@@ -0,0 +1,48 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Data-parallel loops on top of the OpenCV thread pool
+*/
+
+#pragma once
+
+#include "ocv.h"
+
+template<typename Function>
+class RangeLoopBody : public cv::ParallelLoopBody
+{
+public:
+    RangeLoopBody(const Function & f) : _f(f) {}
+
+    virtual void operator()(const cv::Range & range) const
+    {
+        _f(range.start, range.end);
+    }
+
+private:
+    const Function & _f;
+};
+
+// calls f(begin, end) on disjoint subranges of [begin, end) in parallel
+// f must be safe to call concurrently on different subranges
+template<typename Function>
+void parallelFor(int begin, int end, const Function & f)
+{
+    if (end <= begin) return;
+    cv::parallel_for_(cv::Range(begin, end), RangeLoopBody<Function>(f));
+}
@@ -0,0 +1,380 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Hierarchical scoped timers and counters
+
+    PROFILE_SCOPE("sgm.cost");                      //times the enclosing block
+    PROFILE_COUNT("sgm.pixels", xMax * yMax);       //accumulates a value
+
+Every thread accumulates into its own buffer, the buffers are only merged
+when a report is written. The instrumentation is compiled in by default and
+costs a single atomic load per scope while the profiler is disabled;
+define VISGEOM_NO_PROFILING to compile it out completely.
+
+    Profiler::instance().setEnabled(true);
+    ...
+    Profiler::instance().frameMark();               //once per processed frame
+    ...
+    Profiler::instance().writeChromeTrace("trace.json");   //chrome://tracing
+    Profiler::instance().writeSummary(cout);        //aggregate statistics and histograms
+    Profiler::instance().writeReport("run");        //both, to run_trace.json and run_profile.txt
+
+The calib and mapping tools enable it with --profile <output_prefix>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "std.h"
+#include "io.h"
+
+//timer durations are binned in powers of two of microseconds
+const int PROFILE_HISTOGRAM_SIZE = 24;
+
+struct ProfileStat
+{
+    ProfileStat() :
+        count(0), total(0),
+        minVal(std::numeric_limits<double>::max()),
+        maxVal(std::numeric_limits<double>::lowest())
+    {
+        fill(histogram.begin(), histogram.end(), 0);
+    }
+
+    void add(double val)
+    {
+        count++;
+        total += val;
+        minVal = min(minVal, val);
+        maxVal = max(maxVal, val);
+    }
+
+    void merge(const ProfileStat & other)
+    {
+        count += other.count;
+        total += other.total;
+        minVal = min(minVal, other.minVal);
+        maxVal = max(maxVal, other.maxVal);
+        for (int i = 0; i < PROFILE_HISTOGRAM_SIZE; i++)
+        {
+            histogram[i] += other.histogram[i];
+        }
+    }
+
+    double mean() const { return count > 0 ? total / count : 0; }
+
+    uint64_t count;
+    double total, minVal, maxVal;
+    array<uint64_t, PROFILE_HISTOGRAM_SIZE> histogram;
+};
+
+//a finished scope, times in microseconds since the profiler start
+struct ProfileEvent
+{
+    const char * name;
+    double begin, duration;
+};
+
+struct ProfileCounterEvent
+{
+    const char * name;
+    double time, value;
+};
+
+//per-thread accumulation buffer, the mutex is only contended while a report is written
+struct ThreadProfile
+{
+    ThreadProfile(int id) : threadId(id) {}
+
+    std::mutex mtx;
+    int threadId;
+    vector<ProfileEvent> eventVec;
+    vector<ProfileCounterEvent> counterVec;
+    //keyed by the literal pointer, merged by name when reporting
+    std::unordered_map<const char *, ProfileStat> timerMap, counterMap;
+};
+
+class Profiler
+{
+public:
+    //trace events kept per thread, the aggregate statistics are never truncated
+    static const size_t MAX_TRACE_EVENTS = 1 << 20;
+
+    static Profiler & instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    void setEnabled(bool val) { _enabled.store(val, std::memory_order_relaxed); }
+    bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+
+    //if false only the aggregate statistics are collected
+    void setTraceEnabled(bool val) { _traceEnabled.store(val, std::memory_order_relaxed); }
+    bool traceEnabled() const { return _traceEnabled.load(std::memory_order_relaxed); }
+
+    //microseconds since the profiler creation
+    double now() const
+    {
+        return std::chrono::duration<double, std::micro>(clock_::now() - _start).count();
+    }
+
+    ThreadProfile & threadProfile()
+    {
+        thread_local std::shared_ptr<ThreadProfile> profilePtr;
+        if (not profilePtr)
+        {
+            std::lock_guard<std::mutex> lock(_registryMutex);
+            profilePtr = std::make_shared<ThreadProfile>(_profileVec.size());
+            _profileVec.push_back(profilePtr);
+        }
+        return *profilePtr;
+    }
+
+    void recordScope(ThreadProfile & profile, const char * name, double begin, double end)
+    {
+        const double duration = end - begin;
+        std::lock_guard<std::mutex> lock(profile.mtx);
+        ProfileStat & stat = profile.timerMap[name];
+        stat.add(duration);
+        stat.histogram[histogramBin(duration)]++;
+        if (traceEnabled() and profile.eventVec.size() < MAX_TRACE_EVENTS)
+        {
+            profile.eventVec.push_back(ProfileEvent{name, begin, duration});
+        }
+    }
+
+    void count(const char * name, double value)
+    {
+        if (not enabled()) return;
+        ThreadProfile & profile = threadProfile();
+        std::lock_guard<std::mutex> lock(profile.mtx);
+        profile.counterMap[name].add(value);
+        if (traceEnabled() and profile.counterVec.size() < MAX_TRACE_EVENTS)
+        {
+            profile.counterVec.push_back(ProfileCounterEvent{name, now(), value});
+        }
+    }
+
+    //marks the beginning of a new frame in the trace
+    void frameMark()
+    {
+        if (not enabled()) return;
+        std::lock_guard<std::mutex> lock(_registryMutex);
+        if (_frameVec.size() < MAX_TRACE_EVENTS) _frameVec.push_back(now());
+    }
+
+    int frameCount() const
+    {
+        std::lock_guard<std::mutex> lock(_registryMutex);
+        return _frameVec.size();
+    }
+
+    //drops everything recorded so far, the thread buffers stay registered
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(_registryMutex);
+        for (auto & profilePtr : _profileVec)
+        {
+            std::lock_guard<std::mutex> profileLock(profilePtr->mtx);
+            profilePtr->eventVec.clear();
+            profilePtr->counterVec.clear();
+            profilePtr->timerMap.clear();
+            profilePtr->counterMap.clear();
+        }
+        _frameVec.clear();
+    }
+
+    //statistics of all threads merged by name
+    void aggregate(map<string, ProfileStat> & timerMap, map<string, ProfileStat> & counterMap) const
+    {
+        timerMap.clear();
+        counterMap.clear();
+        std::lock_guard<std::mutex> lock(_registryMutex);
+        for (auto & profilePtr : _profileVec)
+        {
+            std::lock_guard<std::mutex> profileLock(profilePtr->mtx);
+            for (auto & x : profilePtr->timerMap) timerMap[x.first].merge(x.second);
+            for (auto & x : profilePtr->counterMap) counterMap[x.first].merge(x.second);
+        }
+    }
+
+    //times in ms, one histogram row per timer
+    void writeSummary(std::ostream & os) const
+    {
+        map<string, ProfileStat> timerMap, counterMap;
+        aggregate(timerMap, counterMap);
+        os << std::fixed << std::setprecision(3);
+        os << "TIMERS [ms] : name count total mean min max" << std::endl;
+        for (auto & x : timerMap)
+        {
+            const ProfileStat & stat = x.second;
+            os << "    " << x.first << " " << stat.count << " " << stat.total * 1e-3
+                << " " << stat.mean() * 1e-3 << " " << stat.minVal * 1e-3
+                << " " << stat.maxVal * 1e-3 << std::endl;
+            //bin i holds the durations in [2^(i-1), 2^i) us
+            os << "        histogram [us] :";
+            for (int i = 0; i < PROFILE_HISTOGRAM_SIZE; i++)
+            {
+                if (stat.histogram[i] == 0) continue;
+                os << " <" << (uint64_t(1) << i) << ":" << stat.histogram[i];
+            }
+            os << std::endl;
+        }
+        os << "COUNTERS : name count total mean min max" << std::endl;
+        for (auto & x : counterMap)
+        {
+            const ProfileStat & stat = x.second;
+            os << "    " << x.first << " " << stat.count << " " << stat.total
+                << " " << stat.mean() << " " << stat.minVal << " " << stat.maxVal << std::endl;
+        }
+        os.unsetf(std::ios::floatfield);
+    }
+
+    //Chrome trace-event format, open in chrome://tracing or ui.perfetto.dev
+    void writeChromeTrace(const string & fileName) const
+    {
+        std::ofstream file(fileName);
+        if (not file) throw std::runtime_error("Profiler: cannot open " + fileName);
+        file << std::fixed << std::setprecision(3);
+        file << "{\"traceEvents\":[" << std::endl;
+        bool first = true;
+        auto separator = [&]()
+        {
+            if (not first) file << "," << std::endl;
+            first = false;
+        };
+        std::lock_guard<std::mutex> lock(_registryMutex);
+        for (size_t i = 0; i < _frameVec.size(); i++)
+        {
+            separator();
+            file << "{\"name\":\"frame " << i << "\",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,\"tid\":0,\"ts\":"
+                << _frameVec[i] << "}";
+        }
+        for (auto & profilePtr : _profileVec)
+        {
+            std::lock_guard<std::mutex> profileLock(profilePtr->mtx);
+            for (auto & event : profilePtr->eventVec)
+            {
+                separator();
+                file << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":"
+                    << profilePtr->threadId << ",\"ts\":" << event.begin
+                    << ",\"dur\":" << event.duration << "}";
+            }
+            for (auto & event : profilePtr->counterVec)
+            {
+                separator();
+                file << "{\"name\":\"" << event.name << "\",\"ph\":\"C\",\"pid\":0,\"tid\":"
+                    << profilePtr->threadId << ",\"ts\":" << event.time
+                    << ",\"args\":{\"value\":" << event.value << "}}";
+            }
+        }
+        file << std::endl << "]}" << std::endl;
+    }
+
+    //<prefix>_trace.json and <prefix>_profile.txt
+    void writeReport(const string & prefix) const
+    {
+        writeChromeTrace(prefix + "_trace.json");
+        std::ofstream file(prefix + "_profile.txt");
+        if (not file) throw std::runtime_error("Profiler: cannot open " + prefix + "_profile.txt");
+        writeSummary(file);
+    }
+
+private:
+    typedef std::chrono::steady_clock clock_;
+
+    Profiler() : _enabled(false), _traceEnabled(true), _start(clock_::now()) {}
+
+    static int histogramBin(double duration)
+    {
+        int bin = 0;
+        uint64_t us = duration;
+        while (us > 0 and bin < PROFILE_HISTOGRAM_SIZE - 1)
+        {
+            us >>= 1;
+            bin++;
+        }
+        return bin;
+    }
+
+    std::atomic<bool> _enabled;
+    std::atomic<bool> _traceEnabled;
+    const clock_::time_point _start;
+
+    mutable std::mutex _registryMutex;
+    vector<std::shared_ptr<ThreadProfile>> _profileVec;
+    vector<double> _frameVec;
+};
+
+//times its own lifetime, the name must be a string literal
+//nested scopes of one thread show up as a call hierarchy in the trace
+class ProfileScope
+{
+public:
+    ProfileScope(const char * name) :
+        _name(name),
+        _profilePtr(NULL)
+    {
+        Profiler & profiler = Profiler::instance();
+        if (not profiler.enabled()) return;
+        _profilePtr = &profiler.threadProfile();
+        _begin = profiler.now();
+    }
+
+    ~ProfileScope()
+    {
+        if (_profilePtr == NULL) return;
+        Profiler & profiler = Profiler::instance();
+        profiler.recordScope(*_profilePtr, _name, _begin, profiler.now());
+    }
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope & operator = (const ProfileScope &) = delete;
+
+private:
+    const char * _name;
+    ThreadProfile * _profilePtr;
+    double _begin;
+};
+
+#ifndef VISGEOM_NO_PROFILING
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_COUNT(name, value) Profiler::instance().count(name, value)
+
+#else
+
+#define PROFILE_SCOPE(name) do {} while (false)
+#define PROFILE_COUNT(name, value) do { (void)(value); } while (false)
+
+#endif
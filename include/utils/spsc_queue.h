@@ -0,0 +1,136 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Bounded lock-free single-producer single-consumer queue
+When the queue is full, push overwrites the oldest element instead of blocking.
+Every element is held by a heap node and the slots are exchanged atomically,
+so an element is either popped or dropped, never both, and the consumer never
+skips an element which is still in the queue.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "std.h"
+
+template<typename T>
+class SpscQueue
+{
+public:
+    SpscQueue(const int capacity) :
+        _slotVec(capacity),
+        _head(0),
+        _next(0),
+        _droppedCount(0)
+    {
+        assert(capacity > 0);
+        for (auto & slot : _slotVec) slot.store(NULL);
+    }
+    
+    // the elements still queued are released without being counted as dropped
+    ~SpscQueue()
+    {
+        for (auto & slot : _slotVec) delete slot.load();
+    }
+    
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue & operator = (const SpscQueue &) = delete;
+    
+    // producer side
+    void push(T val)
+    {
+        const uint64_t seq = _head.load(std::memory_order_relaxed);
+        Node * node = new Node{seq, std::move(val)};
+        Node * old = slot(seq).exchange(node, std::memory_order_acq_rel);
+        if (old != NULL)
+        {
+            delete old;
+            _droppedCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        _head.store(seq + 1, std::memory_order_release);
+    }
+    
+    // consumer side, false if the queue is empty
+    bool pop(T & val)
+    {
+        while (true)
+        {
+            const uint64_t head = _head.load(std::memory_order_acquire);
+            if (_next >= head) return false;
+            // the older elements have been overwritten
+            if (head - _next > _slotVec.size()) _next = head - _slotVec.size();
+            Node * node = slot(_next).exchange(NULL, std::memory_order_acq_rel);
+            if (node != NULL and node->seq > _next)
+            {
+                // the producer has overwritten the element _next since head was read,
+                // the newer element is put back to be popped in its turn
+                Node * expected = NULL;
+                if (not slot(_next).compare_exchange_strong(expected, node, std::memory_order_acq_rel))
+                {
+                    // overwritten again meanwhile, the producer has found the slot empty
+                    delete node;
+                    _droppedCount.fetch_add(1, std::memory_order_relaxed);
+                }
+                _next++;
+                continue;
+            }
+            if (node == NULL or node->seq < _next)
+            {
+                // should not happen, the slot is written before the head is published
+                if (node != NULL) _droppedCount.fetch_add(1, std::memory_order_relaxed);
+                delete node;
+                _next++;
+                continue;
+            }
+            _next++;
+            val = std::move(node->val);
+            delete node;
+            return true;
+        }
+    }
+    
+    // consumer side, approximate since the producer goes on
+    int size() const
+    {
+        const uint64_t head = _head.load(std::memory_order_acquire);
+        return min<uint64_t>(head - min(head, _next), _slotVec.size());
+    }
+    
+    int capacity() const { return _slotVec.size(); }
+    
+    // number of elements overwritten before being popped
+    // once the producer is done, pushed == popped + droppedCount() + size()
+    uint64_t droppedCount() const { return _droppedCount.load(std::memory_order_relaxed); }
+    
+private:
+    struct Node
+    {
+        uint64_t seq;
+        T val;
+    };
+    
+    std::atomic<Node*> & slot(const uint64_t seq) { return _slotVec[seq % _slotVec.size()]; }
+    
+    vector<std::atomic<Node*>> _slotVec;
+    std::atomic<uint64_t> _head; // written by the producer only
+    uint64_t _next; // owned by the consumer
+    std::atomic<uint64_t> _droppedCount;
+};
+
@@ -0,0 +1,168 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "calibration/corner_cache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <sys/stat.h>
+
+#include "std.h"
+#include "io.h"
+#include "eigen.h"
+
+namespace
+{
+    const char CACHE_MAGIC[4] = {'V', 'G', 'C', 'C'};
+    const uint32_t CACHE_VERSION = 1;
+
+    //64-bit FNV-1a
+    const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+    const uint64_t FNV_PRIME = 1099511628211ULL;
+
+    uint64_t fnvUpdate(uint64_t hash, const void * data, size_t size)
+    {
+        const uint8_t * ptr = (const uint8_t *)data;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= ptr[i];
+            hash *= FNV_PRIME;
+        }
+        return hash;
+    }
+
+    template<typename T>
+    bool readValue(ifstream & file, T & val)
+    {
+        file.read((char*)&val, sizeof(T));
+        return bool(file);
+    }
+
+    template<typename T>
+    void writeValue(ofstream & file, const T & val)
+    {
+        file.write((const char*)&val, sizeof(T));
+    }
+}
+
+bool readFileData(const string & fileName, vector<uint8_t> & fileData)
+{
+    ifstream file(fileName, std::ios::binary | std::ios::ate);
+    if (not file) return false;
+    const std::streamsize size = file.tellg();
+    if (size <= 0) return false;
+    file.seekg(0, std::ios::beg);
+    fileData.resize(size);
+    file.read((char*)fileData.data(), size);
+    return bool(file);
+}
+
+CornerCache::CornerCache(const string & cacheDir, int Nx, int Ny,
+            int initRadius, bool improveDetection, int maxDetectionSize) :
+    _cacheDir(cacheDir),
+    _enabled(not cacheDir.empty())
+{
+    if (_enabled and _cacheDir.back() != '/') _cacheDir += '/';
+    if (_enabled and mkdir(_cacheDir.c_str(), 0755) != 0 and errno != EEXIST)
+    {
+        cout << "WARNING : cannot create the corner cache " << _cacheDir
+            << " -- " << strerror(errno) << endl;
+        _enabled = false;
+    }
+
+    //any change in the detector setting invalidates the cache
+    const int32_t paramArr[5] = {Nx, Ny, initRadius, int32_t(improveDetection), maxDetectionSize};
+    _paramHash = fnvUpdate(FNV_OFFSET, &CACHE_VERSION, sizeof(CACHE_VERSION));
+    _paramHash = fnvUpdate(_paramHash, paramArr, sizeof(paramArr));
+}
+
+uint64_t CornerCache::computeKey(const string & imageName, const vector<uint8_t> & fileData) const
+{
+    uint64_t key = fnvUpdate(_paramHash, imageName.data(), imageName.size());
+    return fnvUpdate(key, fileData.data(), fileData.size());
+}
+
+string CornerCache::entryName(uint64_t key) const
+{
+    std::ostringstream name;
+    name << _cacheDir << std::hex << std::setfill('0') << setw(16) << key << ".crn";
+    return name.str();
+}
+
+bool CornerCache::load(uint64_t key, bool & patternIsFound, Vector2dVec & cornerVec) const
+{
+    if (not _enabled) return false;
+    ifstream file(entryName(key), std::ios::binary | std::ios::ate);
+    if (not file) return false;
+    const std::streamoff fileSize = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    char magic[4];
+    uint32_t version;
+    uint64_t storedKey;
+    uint8_t found;
+    uint32_t count;
+    file.read(magic, 4);
+    if (not file or not std::equal(magic, magic + 4, CACHE_MAGIC)) return false;
+    if (not readValue(file, version) or version != CACHE_VERSION) return false;
+    if (not readValue(file, storedKey) or storedKey != key) return false;
+    if (not readValue(file, found) or not readValue(file, count)) return false;
+
+    //the count comes from the file, it must not exceed what is left of it
+    const std::streamoff dataSize = fileSize - file.tellg();
+    if (dataSize < 0 or uint64_t(count) * 2 * sizeof(double) != uint64_t(dataSize)) return false;
+    vector<double> valVec(2 * count);
+    const std::streamsize readSize = valVec.size() * sizeof(double);
+    file.read((char*)valVec.data(), readSize);
+    if (not file or file.gcount() != readSize) return false;
+
+    patternIsFound = found;
+    cornerVec.clear();
+    cornerVec.reserve(count);
+    for (int i = 0; i < count; i++)
+    {
+        cornerVec.emplace_back(valVec[2 * i], valVec[2 * i + 1]);
+    }
+    return true;
+}
+
+void CornerCache::store(uint64_t key, bool patternIsFound, const Vector2dVec & cornerVec) const
+{
+    if (not _enabled) return;
+    //write to a temporary file first, so that an interrupted run does not leave a broken entry
+    const string fileName = entryName(key);
+    const string tmpName = fileName + ".tmp";
+    {
+        ofstream file(tmpName, std::ios::binary | std::ios::trunc);
+        if (not file) return;
+        file.write(CACHE_MAGIC, 4);
+        writeValue(file, CACHE_VERSION);
+        writeValue(file, key);
+        writeValue(file, uint8_t(patternIsFound));
+        writeValue(file, uint32_t(cornerVec.size()));
+        for (auto & pt : cornerVec)
+        {
+            writeValue(file, pt[0]);
+            writeValue(file, pt[1]);
+        }
+        if (not file) return;
+    }
+    std::rename(tmpName.c_str(), fileName.c_str());
+}
+
@@ -23,6 +23,7 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 #include "io.h"
 
 #include "utils/curve_rasterizer.h"
+#include "utils/parallel.h"
 
 
 
@@ -197,18 +198,119 @@ void CornerDetector::improveCorners(Vector2dVec & pointVec)
     
 }
 
-CornerDetector::CornerDetector(int Nx, int Ny, int initRadius, bool improveDetection, bool debug) :
+void CornerDetector::refineCorners(Vector2dVec & pointVec)
+{
+    const double MAX_RADIUS = 7;
+    const int FILTER_MARGIN = 1 + ceil(_sigma2);
+    vector<double> radVec;
+    radVec.reserve(pointVec.size());
+    for (int i = 0; i < pointVec.size(); i++)
+    {
+        //same as in improveCorners, but the distances are taken at full resolution
+        double radMax = MAX_RADIUS;
+        if (i > _Nx) radMax = min( radMax, (pointVec[i] - pointVec[i - _Nx]).norm()*0.7*_scale );
+        else radMax = min( radMax, (pointVec[i] - pointVec[i + _Nx]).norm()*0.7*_scale );
+        if (i > 0) radMax = min( radMax, (pointVec[i] - pointVec[i - 1]).norm()*0.7*_scale );
+        else radMax = min( radMax, (pointVec[i] - pointVec[i + 1]).norm()*0.7*_scale );
+        radVec.push_back(radMax);
+    }
+    
+    const Rect imageRect(0, 0, _imgFull.cols, _imgFull.rows);
+    Mat32f gradx, grady;
+    for (int i = 0; i < pointVec.size(); i++)
+    {
+        //the line directions are initialized on the small image
+        array<double, 5> dataArr;
+        initPoin(round(pointVec[i]), dataArr.data());
+        
+        Vector2d x = (pointVec[i] + Vector2d(0.5, 0.5)) * _scale - Vector2d(0.5, 0.5);
+        dataArr[0] = (dataArr[0] + 0.5) * _scale - 0.5;
+        dataArr[1] = (dataArr[1] + 0.5) * _scale - 0.5;
+        
+        //the gradient is computed only in a window around the corner
+        //it must contain the samples of SubpixelCorner and the bicubic interpolation support
+        const int halfSize = ceil(MAX_RADIUS) + _scale + FILTER_MARGIN + 3;
+        Rect window(round(x[0]) - halfSize, round(x[1]) - halfSize, 2 * halfSize + 1, 2 * halfSize + 1);
+        window &= imageRect;
+        if (window.area() == 0)
+        {
+            //not refined, but all the corners must be at full resolution
+            pointVec[i] = x;
+            continue;
+        }
+        computeGradient(_imgFull(window), gradx, grady);
+        
+        const Vector2d offset(window.x, window.y);
+        x -= offset;
+        dataArr[0] -= window.x;
+        dataArr[1] -= window.y;
+        
+        ceres::GradientProblem problem(new SubpixelCorner(gradx, grady, x, 7, radVec[i]));
+        ceres::GradientProblemSolver::Options options;
+        options.logging_type = ceres::SILENT;
+        ceres::GradientProblemSolver::Summary summary;
+        ceres::Solve(options, problem, dataArr.data(), &summary);
+        
+        pointVec[i][0] = dataArr[0] + window.x;
+        pointVec[i][1] = dataArr[1] + window.y;
+    }
+}
+
+void CornerDetector::computeGradient(const Mat8u & img, Mat32f & gradx, Mat32f & grady) const
+{
+    Mat8u src1, src2;
+    const int FILTER_SIZE_1 = 3;
+    GaussianBlur(img, src1, Size(FILTER_SIZE_1, FILTER_SIZE_1), _sigma1, _sigma1);
+    const int FILTER_SIZE_2 = 1 + 2 * ceil(_sigma2);
+    GaussianBlur(img, src2, Size(FILTER_SIZE_2, FILTER_SIZE_2), _sigma2, _sigma2);
+    gradx.create(img.size());
+    grady.create(img.size());
+    gradx.setTo(0);
+    grady.setTo(0);
+    for (int v = 1; v < img.rows - 1; v++)
+    {
+        for (int u = 1; u < img.cols - 1; u++)
+        {
+            const int du2 = int(src2(v, u + 1)) - int(src2(v, u - 1));
+            const int dv2 = int(src2(v + 1, u)) - int(src2(v - 1, u));
+            gradx(v, u) = (float(int(src1(v, u + 1)) - int(src1(v, u - 1))) - 0.3f * du2) * 0.005f;
+            grady(v, u) = (float(int(src1(v + 1, u)) - int(src1(v - 1, u))) - 0.3f * dv2) * 0.005f;
+        }
+    }
+}
+
+CornerDetector::CornerDetector(int Nx, int Ny, int initRadius, bool improveDetection, bool debug,
+        int maxDetectionSize) :
     _Nx(Nx),
     _Ny(Ny),
     MAX_CANDIDATE_COUNT(10 * Nx * Ny),
     INIT_RADIUS(initRadius),
     IMPROVE_DETECTION(improveDetection),
-    DEBUG(debug)
+    DEBUG(debug),
+    MAX_DETECTION_SIZE(maxDetectionSize),
+    _scale(1),
+    _sigma1(0.7),
+    _sigma2(1.4)
 { }
 
 void CornerDetector::setImage(const Mat8u & img)
 {
-    img.copyTo(_img);
+    _scale = 1;
+    if (MAX_DETECTION_SIZE > 0)
+    {
+        while (max(img.cols, img.rows) > MAX_DETECTION_SIZE * _scale) _scale *= 2;
+    }
+    
+    if (_scale > 1)
+    {
+        img.copyTo(_imgFull);
+        resize(img, _img, Size(img.cols / _scale, img.rows / _scale), 0, 0, cv::INTER_AREA);
+    }
+    else
+    {
+        img.copyTo(_img);
+        _imgFull.release();
+    }
     
     _resp.create(_img.size());
     _imgrad.create(_img.size());
@@ -251,7 +353,13 @@ bool CornerDetector::detectPattern(Vector2dVec & ptVec)
         ptVec.emplace_back(pt[0], pt[1]);
     }
     
-    if (IMPROVE_DETECTION)
+    //the corners detected on the downscaled image are not precise enough,
+    //so they are always refined
+    if (_scale > 1)
+    {
+        refineCorners(ptVec);
+    }
+    else if (IMPROVE_DETECTION)
     {
         improveCorners(ptVec);
     }
@@ -268,50 +376,91 @@ void CornerDetector::computeResponse(const double SIGMA_1, const double SIGMA_2)
 //    const double SIGMA_2 = 2.5; //TODO make a parameter
     const int FILTER_SIZE_2 = 1 + 2 * ceil(SIGMA_2);
     GaussianBlur(_img, _src2, Size(FILTER_SIZE_2, FILTER_SIZE_2), SIGMA_2, SIGMA_2);
-    _imgrad.setTo(0);
-    _resp.setTo(0);
-    double acc = 0;
-    int count = 0;
-    const int SIZE = 1;
-    const int HSIZE = 1;
-    for (int v = SIZE; v < _img.rows - SIZE; v++)
+    _sigma1 = SIGMA_1;
+    _sigma2 = SIGMA_2;
+    
+    const int rows = _img.rows;
+    const int cols = _img.cols;
+    //the first and the last rows are not computed
+    fill(_imgrad[0], _imgrad[0] + cols, 0.f);
+    fill(_resp[0], _resp[0] + cols, 0.f);
+    fill(_imgrad[rows - 1], _imgrad[rows - 1] + cols, 0.f);
+    fill(_resp[rows - 1], _resp[rows - 1] + cols, 0.f);
+    
+    //per-row statistics, summed up afterwards so that the result does not depend on the scheduling
+    vector<double> accVec(rows, 0.);
+    vector<int> countVec(rows, 0);
+    
+    //gradients and the response are computed in one pass over the blurred images
+    //the response is kept in double, so _resp is exactly the same as in the scalar version,
+    //_avgVal only differs by the rounding of the per-row sums
+    parallelFor(1, rows - 1, [&](int vBegin, int vEnd)
     {
-        for (int u = SIZE; u < _img.cols - SIZE; u++)
+        vector<double> respBuf(cols);
+        for (int v = vBegin; v < vEnd; v++)
         {
-            //compute sharp gradient
-            double gxSharp = ( _src1(v, u + 1) - _src1(v, u - 1)  
-- 0.3*(_src2(v, u + 1) - _src2(v, u - 1)) ) / 2.;
-            double gySharp = ( _src1(v + 1, u) - _src1(v - 1, u) 
-- 0.3*(_src2(v + 1, u) - _src2(v - 1, u)) ) / 2.;
-//            double gxSharp = ( _src1(v, u + 1) - _src1(v, u - 1) ) / 2.;
-//            double gySharp = ( _src1(v + 1, u) - _src1(v - 1, u) ) / 2.;
-            _gradx(v, u) = gxSharp * 0.01;
-            _grady(v, u) = gySharp * 0.01;
-            _imgrad(v, u) = sqrt(gxSharp*gxSharp + gySharp*gySharp) * 0.01;
-            
-            
+            const uint8_t * __restrict src1Up = _src1[v - 1];
+            const uint8_t * __restrict src1 = _src1[v];
+            const uint8_t * __restrict src1Down = _src1[v + 1];
+            const uint8_t * __restrict src2Up = _src2[v - 1];
+            const uint8_t * __restrict src2 = _src2[v];
+            const uint8_t * __restrict src2Down = _src2[v + 1];
+            float * __restrict gradxRow = _gradx[v];
+            float * __restrict gradyRow = _grady[v];
+            float * __restrict imgradRow = _imgrad[v];
+            double * __restrict respBufRow = respBuf.data();
             
+            //branch-free, so that the compiler vectorizes it
+            for (int u = 1; u < cols - 1; u++)
+            {
+                const int du2 = int(src2[u + 1]) - int(src2[u - 1]);
+                const int dv2 = int(src2Down[u]) - int(src2Up[u]);
+                
+                //compute sharp gradient
+                const float gxSharp = (float(int(src1[u + 1]) - int(src1[u - 1])) - 0.3f * du2) * 0.5f;
+                const float gySharp = (float(int(src1Down[u]) - int(src1Up[u])) - 0.3f * dv2) * 0.5f;
+                gradxRow[u] = gxSharp * 0.01f;
+                gradyRow[u] = gySharp * 0.01f;
+                imgradRow[u] = std::sqrt(gxSharp*gxSharp + gySharp*gySharp) * 0.01f;
+                
+                //We are looking for saddle points, that is negative hessian determinant
+                const int iuu = int(src2[u - 1]) + int(src2[u + 1]) - 2 * int(src2[u]);
+                const int ivv = int(src2Up[u]) + int(src2Down[u]) - 2 * int(src2[u]);
+                const double iuv = (int(src2Up[u - 1]) + int(src2Down[u + 1]) 
+                                - int(src2Down[u - 1]) - int(src2Up[u + 1])) * 0.25;
+                //the integer division truncates the gradient like the scalar version did
+                const int gx = du2 / 2;
+                const int gy = dv2 / 2;
+                const double gsq = gx * gx + gy * gy;
+                respBufRow[u] = -double(iuu * ivv) + iuv * iuv - 0.001 * (gsq * gsq);
+            }
             
-            //We are looking for saddle points, that is negative hessian determinant
-            double iuu = _src2(v, u - SIZE) + _src2(v, u + SIZE) - 2* _src2(v, u);
-            iuu /= SIZE*SIZE;
-            double ivv = _src2(v - SIZE, u) + _src2(v + SIZE, u) - 2* _src2(v, u);
-            ivv /= SIZE*SIZE;
-            double iuv = _src2(v - HSIZE, u - HSIZE) + _src2(v + HSIZE, u + HSIZE) 
-                            - _src2(v  + HSIZE, u - HSIZE) - _src2(v - HSIZE, u + HSIZE);
-            iuv /= 4*HSIZE*HSIZE;
-            
-            double gx = (_src2(v, u + HSIZE) - _src2(v, u - HSIZE) ) / (2 * HSIZE);
-            double gy = (_src2(v + HSIZE, u) - _src2(v - HSIZE, u) ) / (2 * HSIZE);
-            double gsq = gx * gx + gy * gy;
-            double _respVal = -iuu * ivv + iuv * iuv - 0.001*pow(gsq, 2);
-            if (_respVal > 0.01) 
+            float * respRow = _resp[v];
+            respRow[0] = respRow[cols - 1] = 0;
+            imgradRow[0] = imgradRow[cols - 1] = 0;
+            double acc = 0;
+            int count = 0;
+            for (int u = 1; u < cols - 1; u++)
             {
-                _resp(v, u) = _respVal;
-                acc += _respVal;
-                count++;
+                if (respBufRow[u] > 0.01)
+                {
+                    respRow[u] = respBufRow[u];
+                    acc += respBufRow[u];
+                    count++;
+                }
+                else respRow[u] = 0;
             }
+            accVec[v] = acc;
+            countVec[v] = count;
         }
+    });
+    
+    double acc = 0;
+    int count = 0;
+    for (int v = 1; v < rows - 1; v++)
+    {
+        acc += accVec[v];
+        count += countVec[v];
     }
     _avgVal = acc / count;
     if (DEBUG)
@@ -20,6 +20,7 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 #include "eigen.h"
 
 #include "geometry/geometry.h"
+#include "utils/parallel.h"
   
 /////////////////////////
 /// TrajectoryQuality ///
@@ -38,18 +39,23 @@ bool TrajectoryQuality::Evaluate(const double * params,
         double * residual, double * jacobian) const
 {
     residual[0] = EvaluateCost(params);
-    vector<double> paramsDiff(params, params + _traj->paramSize());
-    for (int i = 0; i < paramsDiff.size(); i++)
+    if (jacobian == NULL) return true;
+    const int paramSize = _traj->paramSize();
+    parallelFor(0, paramSize, [&](int begin, int end)
     {
-        //numeric differentiation
-        double delta = max(abs(paramsDiff[i]) * DIFF_EPS, DIFF_EPS * DIFF_EPS);
-        paramsDiff[i] += delta;
-        double vPlus = EvaluateCost(paramsDiff.data());
-        paramsDiff[i] -= 2*delta;
-        double vMinus = EvaluateCost(paramsDiff.data());
-        paramsDiff[i] += delta;
-        jacobian[i] = (vPlus - vMinus) / (2 * delta);  
-    }
+        vector<double> paramsDiff(params, params + paramSize);
+        for (int i = begin; i < end; i++)
+        {
+            //numeric differentiation
+            double delta = max(abs(paramsDiff[i]) * DIFF_EPS, DIFF_EPS * DIFF_EPS);
+            paramsDiff[i] += delta;
+            double vPlus = EvaluateCost(paramsDiff.data());
+            paramsDiff[i] -= 2*delta;
+            double vMinus = EvaluateCost(paramsDiff.data());
+            paramsDiff[i] = params[i];
+            jacobian[i] = (vPlus - vMinus) / (2 * delta);  
+        }
+    });
     return true;
 }
 
@@ -60,9 +66,9 @@ double TrajectoryQuality::EvaluateCost(const double * params) const
     vector<Matrix6d> covOdomVec;
     _traj->compute(params, xiOdomVec, covOdomVec);
     Matrix6d H = _hessPrior;
+    const Matrix6d LcamOdom = _xiCam.screwTransfInv();
     for (int i = 0; i < xiOdomVec.size(); i++)
     {
-        Matrix6d LcamOdom = _xiCam.screwTransfInv();
         Matrix6d C = _covVis + LcamOdom * covOdomVec[i] * LcamOdom.transpose();
         Transf xiVis = _xiCam.inverseCompose(xiOdomVec[i]).compose(_xiCam);
         Matrix6d J = xiVis.screwTransfInv() - Matrix6d::Identity();
@@ -119,6 +125,7 @@ TrajectoryVisualQuality::TrajectoryVisualQuality(const vector<ITrajectory*> & tr
     _ptStiffness = lltOfCovCornerInv.matrixU();
     for (auto & t : _trajVec)
     {
+        _paramOffsetVec.push_back(_paramSize);
         _paramSize += t->paramSize();
     }
 }
@@ -126,58 +133,116 @@ TrajectoryVisualQuality::TrajectoryVisualQuality(const vector<ITrajectory*> & tr
 bool TrajectoryVisualQuality::Evaluate(const double * params,
         double * residual, double * jacobian) const
 {
-    residual[0] = EvaluateCost(params);
-    vector<double> paramsDiff(params, params + _paramSize);
-    for (int i = 0; i < paramsDiff.size(); i++)
+    const int trajCount = _trajVec.size();
+    vector<TrajectoryTerm> termVec(trajCount);
+    parallelFor(0, trajCount, [&](int begin, int end)
+    {
+        for (int trajIdx = begin; trajIdx < end; trajIdx++)
+        {
+            termVec[trajIdx] = EvaluateTrajectory(trajIdx, params + _paramOffsetVec[trajIdx]);
+        }
+    });
+    
+    //the contribution of all the trajectories but one
+    vector<TrajectoryTerm> restVec(trajCount);
+    for (int k = 0; k < trajCount; k++)
+    {
+        restVec[k].H = _hessPrior;
+        restVec[k].cost = 0;
+        for (int trajIdx = 0; trajIdx < trajCount; trajIdx++)
+        {
+            if (trajIdx == k) continue;
+            restVec[k].H += termVec[trajIdx].H;
+            restVec[k].cost += termVec[trajIdx].cost;
+        }
+    }
+    
+    Matrix6d H = _hessPrior;
+    double cost = 0;
+    for (auto & term : termVec)
     {
-        //numeric differentiation
-        double delta = max(abs(paramsDiff[i]) * DIFF_EPS, DIFF_EPS * DIFF_EPS);
-        double origValue = paramsDiff[i];
-        paramsDiff[i] = origValue + delta;
-        double vPlus = EvaluateCost(paramsDiff.data());
-        paramsDiff[i] = origValue - delta;
-        double vMinus = EvaluateCost(paramsDiff.data());
-        paramsDiff[i] = origValue;
-        jacobian[i] = (vPlus - vMinus) / (2 * delta);  
+        H += term.H;
+        cost += term.cost;
     }
+    residual[0] = totalCost(H, cost);
+    if (jacobian == NULL) return true;
+    
+    parallelFor(0, _paramSize, [&](int begin, int end)
+    {
+        vector<double> paramsDiff(params, params + _paramSize);
+        for (int i = begin; i < end; i++)
+        {
+            int trajIdx = trajCount - 1;
+            while (_paramOffsetVec[trajIdx] > i) trajIdx--;
+            const double * trajParams = paramsDiff.data() + _paramOffsetVec[trajIdx];
+            const TrajectoryTerm & rest = restVec[trajIdx];
+            
+            //numeric differentiation
+            double delta = max(abs(paramsDiff[i]) * DIFF_EPS, DIFF_EPS * DIFF_EPS);
+            double origValue = paramsDiff[i];
+            paramsDiff[i] = origValue + delta;
+            TrajectoryTerm termPlus = EvaluateTrajectory(trajIdx, trajParams);
+            double vPlus = totalCost(rest.H + termPlus.H, rest.cost + termPlus.cost);
+            paramsDiff[i] = origValue - delta;
+            TrajectoryTerm termMinus = EvaluateTrajectory(trajIdx, trajParams);
+            double vMinus = totalCost(rest.H + termMinus.H, rest.cost + termMinus.cost);
+            paramsDiff[i] = origValue;
+            jacobian[i] = (vPlus - vMinus) / (2 * delta);  
+        }
+    });
     return true;
 }
 
-double TrajectoryVisualQuality::EvaluateCost(const double * params) const
+TrajectoryVisualQuality::TrajectoryTerm TrajectoryVisualQuality::EvaluateTrajectory(int trajIdx,
+        const double * trajParams) const
 {
     vector<Transf> xiOdomVec;
     vector<Matrix6d> covOdomVec;
-    Matrix6d H = _hessPrior;
-    double res = 0;
-    for (int trajIdx = 0; trajIdx < _trajVec.size(); trajIdx++)
+    _trajVec[trajIdx]->compute(trajParams, xiOdomVec, covOdomVec);
+    
+    TrajectoryTerm term;
+    term.H = Matrix6d::Zero();
+    term.cost = 0;
+    const Matrix6d LcamOdom = _xiCam.screwTransfInv();
+    for (int i = 1; i < xiOdomVec.size(); i++)
     {
-        auto traj = _trajVec[trajIdx];
-        //FIXME a potential bug if traj->paramSize() is different for different traj
-        traj->compute(params + trajIdx * traj->paramSize(), xiOdomVec, covOdomVec);
-        
-        for (int i = 1; i < xiOdomVec.size(); i++)
-        {
-            Matrix6d LcamOdom = _xiCam.screwTransfInv();
-            Transf xiOrigCam = xiOdomVec[i].compose(_xiCam);
-            Matrix6d C = visualCov(xiOrigCam) + LcamOdom * covOdomVec[i] * LcamOdom.transpose();
-            Transf xiVis = _xiCam.inverseCompose(xiOdomVec[0].inverseCompose(xiOrigCam));
-            Matrix6d J = xiVis.screwTransfInv() - Matrix6d::Identity();
-            // hessian is computed up to an orthonormal transformation
-            // it does not change the rank but simplifies the calculus
-            H += (J.transpose() * C.inverse() * J); 
-            res += imageLimitsCost(xiOrigCam);
-            res += curvatureCost(xiOdomVec[i - 1], xiOdomVec[i]);
-            //TODO add the distance to board as a constraint
-            res += distanceCost(xiOrigCam);
-            res += normalCost(xiOrigCam);
-        }
+        Transf xiOrigCam = xiOdomVec[i].compose(_xiCam);
+        Matrix6d C = visualCov(xiOrigCam) + LcamOdom * covOdomVec[i] * LcamOdom.transpose();
+        Transf xiVis = _xiCam.inverseCompose(xiOdomVec[0].inverseCompose(xiOrigCam));
+        Matrix6d J = xiVis.screwTransfInv() - Matrix6d::Identity();
+        // hessian is computed up to an orthonormal transformation
+        // it does not change the rank but simplifies the calculus
+        term.H += (J.transpose() * C.inverse() * J); 
+        term.cost += imageLimitsCost(xiOrigCam);
+        term.cost += curvatureCost(xiOdomVec[i - 1], xiOdomVec[i]);
+        //TODO add the distance to board as a constraint
+        term.cost += distanceCost(xiOrigCam);
+        term.cost += normalCost(xiOrigCam);
     }
+    return term;
+}
+
+double TrajectoryVisualQuality::totalCost(const Matrix6d & H, double cost) const
+{
     JacobiSVD<Matrix6d> svd(H);
     for (int i = 0; i < 6; i++)
     {
-        res -= log(svd.singularValues()(i));
+        cost -= log(svd.singularValues()(i));
     }
-    return res;
+    return cost;
+}
+
+double TrajectoryVisualQuality::EvaluateCost(const double * params) const
+{
+    Matrix6d H = _hessPrior;
+    double res = 0;
+    for (int trajIdx = 0; trajIdx < _trajVec.size(); trajIdx++)
+    {
+        TrajectoryTerm term = EvaluateTrajectory(trajIdx, params + _paramOffsetVec[trajIdx]);
+        H += term.H;
+        res += term.cost;
+    }
+    return totalCost(H, res);
 }
 
 
@@ -25,12 +25,15 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 #include "json.h"
 #include "except.h"
 #include "timer.h"
+#include "utils/profiler.h"
 
+#include <cctype>
 #include <glog/logging.h>
 
 #include "calibration/calib_cost_functions.h"
 #include "calibration/odometry_cost_function.h"
 #include "calibration/corner_detector.h"
+#include "calibration/corner_cache.h"
 #include "projection/generic_camera.h"
 #include "projection/eucm.h"
 #include "projection/ucm.h"
@@ -38,19 +41,17 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 
 bool GenericCameraCalibration::compute()
 {
+    PROFILE_SCOPE("calibration.compute");
     //run the solver
     Solver::Options options;
 //    options.check_gradients = true;
 //    options.gradient_check_relative_precision = 0.01;
 //    options.line_search_direction_type = ceres::NONLINEAR_CONJUGATE_GRADIENT;
-    options.max_num_iterations = 1000;
-    options.function_tolerance = 1e-15;
-    options.gradient_tolerance = 1e-15;
-    options.parameter_tolerance = 1e-15;
-//    options.logging_type = ceres::SILENT;
-    options.minimizer_progress_to_stdout = true;
+    setSolverOptions(options);
     Solver::Summary summary;
     Solve(options, &globalProblem, &summary);
+    PROFILE_COUNT("calibration.solver_iterations", summary.iterations.size());
+    //the report includes the time of every solver stage
     cout << summary.FullReport() << endl;
     
     cout << "Intrinsic parameters :" << endl;
@@ -86,6 +87,84 @@ bool GenericCameraCalibration::compute()
     {
         writeImageResidual(dataVec[i], "image_error_" + to_string(i) + ".txt");
     }
+    return summary.IsSolutionUsable();
+}
+
+void GenericCameraCalibration::parseSolver(const ptree & node)
+{
+    solverParams.linearSolver = node.get<string>("linear_solver", solverParams.linearSolver);
+    solverParams.ordering = node.get<string>("ordering", solverParams.ordering);
+    solverParams.numThreads = node.get<int>("num_threads", solverParams.numThreads);
+    solverParams.maxIterations = node.get<int>("max_iterations", solverParams.maxIterations);
+    solverParams.functionTolerance = node.get<double>("function_tolerance", solverParams.functionTolerance);
+    solverParams.gradientTolerance = node.get<double>("gradient_tolerance", solverParams.gradientTolerance);
+    solverParams.parameterTolerance = node.get<double>("parameter_tolerance", solverParams.parameterTolerance);
+    solverParams.progressToStdout = node.get<bool>("progress", solverParams.progressToStdout);
+    
+    if (solverParams.ordering != "auto" and solverParams.ordering != "poses_first")
+    {
+        throw runtime_error("invalid ordering " + solverParams.ordering + ", must be auto or poses_first");
+    }
+    if (solverParams.numThreads < 1)
+    {
+        throw runtime_error("num_threads must be positive");
+    }
+}
+
+void GenericCameraCalibration::setSolverOptions(Solver::Options & options)
+{
+    options.max_num_iterations = solverParams.maxIterations;
+    options.function_tolerance = solverParams.functionTolerance;
+    options.gradient_tolerance = solverParams.gradientTolerance;
+    options.parameter_tolerance = solverParams.parameterTolerance;
+    options.minimizer_progress_to_stdout = solverParams.progressToStdout;
+    
+    //both the jacobian evaluation and the linear solver
+    options.num_threads = solverParams.numThreads;
+#if CERES_VERSION_MAJOR < 2
+    options.num_linear_solver_threads = solverParams.numThreads;
+#endif
+    
+    if (not solverParams.linearSolver.empty())
+    {
+        string solverName = solverParams.linearSolver;
+        std::transform(solverName.begin(), solverName.end(), solverName.begin(), ::toupper);
+        if (not ceres::StringToLinearSolverType(solverName, &options.linear_solver_type))
+        {
+            throw runtime_error("unknown linear solver " + solverParams.linearSolver);
+        }
+    }
+    
+    if (solverParams.ordering == "poses_first")
+    {
+        //per-image transformations which are not linked to each other
+        //form the first elimination group, everything else is in the second one
+        set<double*> poseSet;
+        for (auto & sequence : sequenceTransformMap)
+        {
+            if (linkedSequenceSet.count(sequence.first)) continue;
+            for (auto & xi : sequence.second)
+            {
+                poseSet.insert(xi.data());
+            }
+        }
+        
+        vector<double*> paramBlockVec;
+        globalProblem.GetParameterBlocks(&paramBlockVec);
+        ceres::ParameterBlockOrdering * ordering = new ceres::ParameterBlockOrdering;
+        int poseCount = 0;
+        for (auto & paramBlock : paramBlockVec)
+        {
+            if (poseSet.count(paramBlock))
+            {
+                ordering->AddElementToGroup(paramBlock, 0);
+                poseCount++;
+            }
+            else ordering->AddElementToGroup(paramBlock, 1);
+        }
+        options.linear_solver_ordering.reset(ordering);
+        PROFILE_COUNT("calibration.eliminated_blocks", poseCount);
+    }
 }
 
 void GenericCameraCalibration::parseTransforms()
@@ -192,6 +271,7 @@ void GenericCameraCalibration::initTransformChainInfo(ImageData & data, const pt
         else if (flagName == "do_not_solve") data.doNotSolve = true;
         else if (flagName == "do_not_solve_global") data.doNotSolveGlobal = true;
         else if (flagName == "save_outlire_images") data.saveOutlierImages = true;
+        else if (flagName == "no_corner_cache") data.useCornerCache = false;
         else if (flagName == "draw_improved") 
         {
             data.drawImproved = true;
@@ -297,6 +377,8 @@ void GenericCameraCalibration::initGrid(ImageData & data, const ptree & node)
     
     //fill up detectedCornersVec which stores all the extracted grids
     data.useImages = true;
+    if (data.useCornerCache) data.cornerCacheDir = node.get<string>("corner_cache", ".corner_cache");
+    data.maxDetectionSize = node.get<int>("max_detection_size", 0);
     const string prefix = node.get<string>("images.prefix");
     data.detectedCornersVec.clear();
     for (auto & x : node.get_child("images.names"))
@@ -349,10 +431,14 @@ Transf GenericCameraCalibration::getInitTransform(Transf xi,
 
 bool GenericCameraCalibration::addResiduals(const string & infoFileName)
 {
+    Timer timer;
     read_json(infoFileName, root);
+    if (root.count("solver")) parseSolver(root.get_child("solver"));
     parseTransforms();
     parseCameras();
     parseData();
+    cout << infoFileName << " : problem construction ELAPSED " << timer.elapsed() << endl;
+    return true;
 }
 
 void GenericCameraCalibration::initGlobalTransform(const ImageData & data, const string & name)
@@ -670,6 +756,8 @@ void GenericCameraCalibration::parseData()
                 throw runtime_error(transformName + " is global. Odometry must be a sequence");
             }
             
+            linkedSequenceSet.insert(transformName);
+            
             const double errV = dataInfo.second.get<double>("err_v"); //relative error in speed
             const double errW = dataInfo.second.get<double>("err_w"); //relative error in rotation
             const double lambda = dataInfo.second.get<double>("lambda"); //relative error in rotation
@@ -752,6 +840,8 @@ void GenericCameraCalibration::parseData()
                 throw runtime_error(transformName + " is global. Odometry must be a sequence");
             }
             
+            linkedSequenceSet.insert(transformName);
+            
             const double errV = dataInfo.second.get<double>("err_v"); //relative error in speed
             const double errW = dataInfo.second.get<double>("err_w"); //relative error in rotation
             const double lambda = dataInfo.second.get<double>("lambda"); //relative error in rotation
@@ -991,8 +1081,13 @@ void GenericCameraCalibration::extractGridProjections(ImageData & data)
 
 void GenericCameraCalibration::extractGridProjections(ImageData & data)
 {
+    PROFILE_SCOPE("calibration.corner_extraction");
     Timer timer;
-    CornerDetector detector(data.Nx, data.Ny, 3, data.improveDetection);
+    const int INIT_RADIUS = 3;
+    CornerDetector detector(data.Nx, data.Ny, INIT_RADIUS, data.improveDetection, false,
+            data.maxDetectionSize);
+    CornerCache cache(data.cornerCacheDir, data.Nx, data.Ny, INIT_RADIUS, data.improveDetection,
+            data.maxDetectionSize);
     
     string sequenceName;
     for (auto & name : data.transNameVec)
@@ -1006,6 +1101,9 @@ void GenericCameraCalibration::extractGridProjections(ImageData & data)
     bool initialized = transformInfoMap[sequenceName].initialized;
     const vector<bool> & initVec = sequenceInitMap[sequenceName];
     int countSuccess = 0;
+    int countCached = 0;
+    int countDetected = 0;
+    vector<uint8_t> fileData;
     for (int i = 0; i < data.imageNameVec.size(); i++)
     {
         cout <<data.imageNameVec[i] << endl;
@@ -1022,15 +1120,36 @@ void GenericCameraCalibration::extractGridProjections(ImageData & data)
             continue;
         }
         
-        Mat8u frame = imread(fileName, 0);
-        if (frame.empty())
+        if (not readFileData(fileName, fileData))
         {
             cout << fileName << " : ERROR, file not found" << endl;
             continue;
         }
-        detector.setImage(frame);
+        
+        //the image is decoded only if the detection has to be run or checked
+        Mat8u frame;
         Vector2dVec patternVec;
-        bool patternIsFound = detector.detectPattern(patternVec);
+        bool patternIsFound;
+        const uint64_t cacheKey = cache.computeKey(fileName, fileData);
+        if (cache.load(cacheKey, patternIsFound, patternVec))
+        {
+            countCached++;
+        }
+        else
+        {
+            PROFILE_SCOPE("calibration.detect_pattern");
+            frame = cv::imdecode(fileData, 0);
+            if (frame.empty())
+            {
+                cout << fileName << " : ERROR, cannot decode the image" << endl;
+                continue;
+            }
+            detector.setImage(frame);
+            patternIsFound = detector.detectPattern(patternVec);
+            countDetected++;
+            cache.store(cacheKey, patternIsFound, patternVec);
+        }
+        
         if (not patternIsFound)
         {
             cout << fileName << " : ERROR, pattern not found" << endl;
@@ -1039,6 +1158,7 @@ void GenericCameraCalibration::extractGridProjections(ImageData & data)
         
         if (data.checkExtraction)
         {
+            if (frame.empty()) frame = cv::imdecode(fileData, 0);
             Mat8u cornerImg;
             frame.copyTo(cornerImg);
             
@@ -1056,9 +1176,17 @@ void GenericCameraCalibration::extractGridProjections(ImageData & data)
         data.detectedCornersVec.back() = patternVec;
     }
     double telapsed = timer.elapsed();
+    PROFILE_COUNT("calibration.images_detected", countSuccess);
+    PROFILE_COUNT("calibration.images_cached", countCached);
     cout << endl;
     cout << "DETECTION RATE : " << countSuccess << " of " 
             << data.imageNameVec.size() << " detected" << endl;
+    if (cache.enabled())
+    {
+        cout << "CORNER CACHE : " << countCached << " of " 
+                << data.imageNameVec.size() << " loaded from " << data.cornerCacheDir
+                << ", " << countDetected << " run through the detector" << endl;
+    }
     cout << "ELAPSED : " << telapsed << "      or per image : " << telapsed / data.imageNameVec.size() << endl;
 }
 
@@ -0,0 +1,98 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Spatial index of the keyframe positions
+*/
+
+#include "localization/keyframe_index.h"
+
+int64_t KeyframeIndex::cellIndex(const double x) const
+{
+    return int64_t(floor(x / _cellSize));
+}
+
+// the three 21-bit cell indices packed together, the cells far apart may collide
+// but it only adds candidates which are then rejected by the distance check
+uint64_t KeyframeIndex::cellKey(const int64_t cx, const int64_t cy, const int64_t cz) const
+{
+    const uint64_t MASK = (1 << 21) - 1;
+    return (uint64_t(cx) & MASK) | ((uint64_t(cy) & MASK) << 21) | ((uint64_t(cz) & MASK) << 42);
+}
+
+void KeyframeIndex::insert(const int idx, const Vector3d & position)
+{
+    if (idx >= _positionVec.size()) _positionVec.resize(idx + 1);
+    _positionVec[idx] = position;
+    _cellMap[cellKey(cellIndex(position[0]), cellIndex(position[1]), cellIndex(position[2]))].push_back(idx);
+}
+
+void KeyframeIndex::move(const int idx, const Vector3d & position)
+{
+    const Vector3d & oldPosition = _positionVec[idx];
+    vector<int> & oldCell = _cellMap[cellKey(cellIndex(oldPosition[0]), 
+            cellIndex(oldPosition[1]), cellIndex(oldPosition[2]))];
+    oldCell.erase(std::remove(oldCell.begin(), oldCell.end(), idx), oldCell.end());
+    insert(idx, position);
+}
+
+void KeyframeIndex::radiusSearch(const Vector3d & position, const double radius, 
+        vector<int> & idxVec) const
+{
+    idxVec.clear();
+    const double radiusSq = radius * radius;
+    const int64_t xBegin = cellIndex(position[0] - radius), xEnd = cellIndex(position[0] + radius);
+    const int64_t yBegin = cellIndex(position[1] - radius), yEnd = cellIndex(position[1] + radius);
+    const int64_t zBegin = cellIndex(position[2] - radius), zEnd = cellIndex(position[2] + radius);
+    
+    // a large radius wrt the cell size, a linear search is cheaper
+    const double numCells = double(xEnd - xBegin + 1) * (yEnd - yBegin + 1) * (zEnd - zBegin + 1);
+    if (numCells > _positionVec.size())
+    {
+        for (int idx = 0; idx < _positionVec.size(); idx++)
+        {
+            if ((_positionVec[idx] - position).squaredNorm() < radiusSq) idxVec.push_back(idx);
+        }
+        return;
+    }
+    
+    for (int64_t cz = zBegin; cz <= zEnd; cz++)
+    {
+        for (int64_t cy = yBegin; cy <= yEnd; cy++)
+        {
+            for (int64_t cx = xBegin; cx <= xEnd; cx++)
+            {
+                auto cellIter = _cellMap.find(cellKey(cx, cy, cz));
+                if (cellIter == _cellMap.end()) continue;
+                for (auto & idx : cellIter->second)
+                {
+                    if ((_positionVec[idx] - position).squaredNorm() < radiusSq) idxVec.push_back(idx);
+                }
+            }
+        }
+    }
+    // colliding cells might be visited twice
+    sort(idxVec.begin(), idxVec.end());
+    idxVec.erase(std::unique(idxVec.begin(), idxVec.end()), idxVec.end());
+}
+
+void KeyframeIndex::clear()
+{
+    _cellMap.clear();
+    _positionVec.clear();
+}
+
@@ -0,0 +1,136 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Keyframe image storage with a memory budget
+*/
+
+#include "localization/keyframe_store.h"
+
+#include "utils/profiler.h"
+
+std::ostream & operator << (std::ostream & os, const KeyframeStoreStats & stats)
+{
+    os << "frames " << stats.frameCount << " raw " << stats.rawCount 
+        << " (" << stats.rawBytes / 1024 << " kB) compressed " << stats.frameCount - stats.rawCount
+        << " (" << stats.compressedBytes / 1024 << " kB) hits " << stats.hitCount 
+        << " misses " << stats.missCount << " compressions " << stats.compressionCount;
+    return os;
+}
+
+int KeyframeStore::push(const Mat8u & img)
+{
+    _entryVec.emplace_back();
+    img.copyTo(_entryVec.back().img);
+    const int idx = _entryVec.size() - 1;
+    _stats.frameCount++;
+    _stats.rawCount++;
+    _stats.rawBytes += img.total();
+    touch(idx);
+    enforceBudget(idx);
+    reportMemory();
+    return idx;
+}
+
+int KeyframeStore::pushExternal(const Mat8u & img)
+{
+    _entryVec.emplace_back();
+    _entryVec.back().img = img;
+    _entryVec.back().external = true;
+    const int idx = _entryVec.size() - 1;
+    _stats.frameCount++;
+    _stats.rawCount++;
+    return idx;
+}
+
+Mat8u KeyframeStore::image(const int idx)
+{
+    if (idx < 0 or idx >= _entryVec.size())
+    {
+        throw std::runtime_error("KeyframeStore::image : index out of range");
+    }
+    Entry & entry = _entryVec[idx];
+    if (entry.img.empty())
+    {
+        entry.img = cv::imdecode(entry.compressed, 0);
+        if (entry.img.empty())
+        {
+            throw std::runtime_error("KeyframeStore::image : decompression failed");
+        }
+        _stats.missCount++;
+        _stats.rawCount++;
+        _stats.rawBytes += entry.img.total();
+        PROFILE_COUNT("keyframe_store.misses", 1);
+        touch(idx);
+        enforceBudget(idx);
+        reportMemory();
+    }
+    else
+    {
+        _stats.hitCount++;
+        PROFILE_COUNT("keyframe_store.hits", 1);
+        if (not entry.external) touch(idx);
+    }
+    return entry.img;
+}
+
+void KeyframeStore::touch(const int idx)
+{
+    Entry & entry = _entryVec[idx];
+    if (entry.inLru)
+    {
+        _lruList.splice(_lruList.begin(), _lruList, entry.lruIter);
+    }
+    else
+    {
+        _lruList.push_front(idx);
+        entry.lruIter = _lruList.begin();
+        entry.inLru = true;
+    }
+}
+
+void KeyframeStore::enforceBudget(const int keepIdx)
+{
+    // keepIdx has just been touched, it is at the front of the list
+    while (memoryUsage() > _memoryBudget and not _lruList.empty() and _lruList.back() != keepIdx)
+    {
+        const int lruIdx = _lruList.back();
+        _lruList.pop_back();
+        Entry & entry = _entryVec[lruIdx];
+        entry.inLru = false;
+        // the compressed image does not change, it is done once per frame
+        if (entry.compressed.empty())
+        {
+            const vector<int> paramVec = {cv::IMWRITE_PNG_COMPRESSION, 1};
+            if (not cv::imencode(".png", entry.img, entry.compressed, paramVec))
+            {
+                throw std::runtime_error("KeyframeStore : compression failed");
+            }
+            _stats.compressedBytes += entry.compressed.size();
+            _stats.compressionCount++;
+        }
+        _stats.rawCount--;
+        _stats.rawBytes -= entry.img.total();
+        entry.img.release();
+    }
+}
+
+void KeyframeStore::reportMemory() const
+{
+    PROFILE_COUNT("keyframe_store.raw_bytes", _stats.rawBytes);
+    PROFILE_COUNT("keyframe_store.compressed_bytes", _stats.compressedBytes);
+}
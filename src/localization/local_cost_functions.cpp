@@ -286,17 +286,16 @@ bool SparseReprojectCost::Evaluate(double const * const * params,
     Transf xi12 = _xiBaseCam.inverseCompose(xiOdom.compose(_xiBaseCam));
     
     //compute the points in the camera frame
+    // the scalar solver, ceres may evaluate the residuals from its own threads
     vector<double> lambdaVec(_xVec1.size());
     vector<double> jacVec;
     Triangulator triangulator(xi12);
-    if (jacobian != NULL and jacobian[0] != NULL) 
+    const bool withJacobian = jacobian != NULL and jacobian[0] != NULL;
+    if (withJacobian) jacVec.resize(_xVec1.size() * 6);
+    for (int i = 0; i < _xVec1.size(); i++)
     {
-        jacVec.resize(_xVec1.size() * 6);
-        triangulator.computeRegular(_xVec1, _xVec2, lambdaVec.data(), NULL, jacVec.data(), NULL);
-    }
-    else
-    {
-        triangulator.computeRegular(_xVec1, _xVec2, lambdaVec.data());
+        triangulator.computeRegular(_xVec1[i], _xVec2[i], lambdaVec.data() + i, NULL,
+                withJacobian ? jacVec.data() + 6 * i : NULL);
     }
     
     Vector3dVec xVec2 =_xVec1;
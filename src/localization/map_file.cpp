@@ -0,0 +1,313 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Binary map file
+*/
+
+#include "localization/map_file.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    const char MAP_MAGIC[4] = {'V', 'G', 'M', 'P'};
+    const uint64_t BLOCK_ALIGNMENT = 8;
+
+    uint64_t depthSize(const MapFrameRecord & rec)
+    {
+        return uint64_t(rec.xMax) * rec.yMax * rec.hMax;
+    }
+}
+
+DepthMap DepthMapView::toDepthMap(const ICamera * camera) const
+{
+    DepthMap depth(camera, *this, hMax);
+    const int size = xMax * yMax * hMax;
+    copy(valPtr, valPtr + size, &depth.at(0));
+    copy(sigmaPtr, sigmaPtr + size, &depth.sigma(0));
+    copy(costPtr, costPtr + size, &depth.cost(0));
+    return depth;
+}
+
+MapWriter::MapWriter(const string & fileName) :
+    _fileName(fileName),
+    _tmpName(fileName + ".tmp"),
+    _file(_tmpName, std::ios::binary | std::ios::trunc),
+    _offset(0),
+    _xiLocal(0, 0, 0, 0, 0, 0)
+{
+    if (not _file) throw std::runtime_error("MapWriter : cannot create " + _tmpName);
+    //the header is written by close()
+    MapFileHeader header;
+    memset(&header, 0, sizeof(header));
+    writeBlock(&header, sizeof(header));
+}
+
+MapWriter::~MapWriter()
+{
+    if (not _closed)
+    {
+        _file.close();
+        std::remove(_tmpName.c_str());
+    }
+}
+
+void MapWriter::check()
+{
+    if (_closed) throw std::runtime_error("MapWriter : " + _fileName + " is already closed");
+    if (not _file) throw std::runtime_error("MapWriter : cannot write " + _tmpName);
+}
+
+uint64_t MapWriter::writeBlock(const void * data, const size_t size)
+{
+    const uint64_t offset = _offset;
+    _file.write((const char*)data, size);
+    _offset += size;
+    const char padding[BLOCK_ALIGNMENT] = {0};
+    const size_t paddingSize = (BLOCK_ALIGNMENT - _offset % BLOCK_ALIGNMENT) % BLOCK_ALIGNMENT;
+    _file.write(padding, paddingSize);
+    _offset += paddingSize;
+    return offset;
+}
+
+uint64_t MapWriter::writeImage(const Mat8u & img)
+{
+    if (img.isContinuous()) return writeBlock(img.data, img.total());
+    //the rows are padded only at the end of the block
+    const uint64_t offset = _offset;
+    for (int v = 0; v < img.rows; v++)
+    {
+        _file.write((const char*)img.ptr(v), img.cols);
+        _offset += img.cols;
+    }
+    writeBlock(NULL, 0);
+    return offset;
+}
+
+MapFrameRecord MapWriter::makeRecord(const Transf & xi, const Mat8u & img)
+{
+    MapFrameRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    xi.toArray(rec.xi);
+    rec.rows = img.rows;
+    rec.cols = img.cols;
+    rec.imageOffset = writeImage(img);
+    return rec;
+}
+
+void MapWriter::addKeyframe(const Transf & xi, const Mat8u & img)
+{
+    check();
+    _keyframeVec.push_back(makeRecord(xi, img));
+}
+
+void MapWriter::setActiveFrame(const Transf & xi, const Mat8u & img, const DepthMap & depth,
+        const Transf & xiLocal)
+{
+    check();
+    MapFrameRecord rec = makeRecord(xi, img);
+    rec.scale = depth.scale;
+    rec.u0 = depth.u0;
+    rec.v0 = depth.v0;
+    rec.uMax = depth.uMax;
+    rec.vMax = depth.vMax;
+    rec.xMax = depth.xMax;
+    rec.yMax = depth.yMax;
+    rec.hMax = depth.getHypMax();
+    const size_t size = depthSize(rec) * sizeof(double);
+    rec.depthOffset = writeBlock(&depth.at(0), size);
+    writeBlock(&depth.sigma(0), size);
+    writeBlock(&depth.cost(0), size);
+    _activeVec.assign(1, rec);
+    _xiLocal = xiLocal;
+}
+
+void MapWriter::close()
+{
+    check();
+    MapFileHeader header;
+    memset(&header, 0, sizeof(header));
+    copy(MAP_MAGIC, MAP_MAGIC + 4, header.magic);
+    header.version = MAP_FILE_VERSION;
+    header.keyframeCount = _keyframeVec.size();
+    header.activeCount = _activeVec.size();
+    header.tableOffset = _offset;
+    for (auto & rec : _keyframeVec) writeBlock(&rec, sizeof(rec));
+    for (auto & rec : _activeVec) writeBlock(&rec, sizeof(rec));
+    header.fileSize = _offset;
+    _xiLocal.toArray(header.xiLocal);
+    _file.seekp(0);
+    _file.write((const char*)&header, sizeof(header));
+    _file.close();
+    if (not _file) throw std::runtime_error("MapWriter : cannot write " + _tmpName);
+    if (std::rename(_tmpName.c_str(), _fileName.c_str()) != 0)
+    {
+        throw std::runtime_error("MapWriter : cannot rename " + _tmpName + " -- " + strerror(errno));
+    }
+    _closed = true;
+}
+
+MapFile::MapFile(const string & fileName) :
+    _dataPtr(NULL),
+    _size(0)
+{
+    const int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("MapFile : cannot open " + fileName + " -- " + strerror(errno));
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 or size_t(fileStat.st_size) < sizeof(MapFileHeader))
+    {
+        ::close(fd);
+        throw std::runtime_error("MapFile : " + fileName + " is not a map file");
+    }
+    _size = fileStat.st_size;
+    void * ptr = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (ptr == MAP_FAILED)
+    {
+        throw std::runtime_error("MapFile : cannot map " + fileName + " -- " + strerror(errno));
+    }
+    _dataPtr = (const uint8_t *)ptr;
+    _headerPtr = (const MapFileHeader *)_dataPtr;
+    _recordPtr = (const MapFrameRecord *)(_dataPtr + _headerPtr->tableOffset);
+    try
+    {
+        validate(fileName);
+    }
+    catch (...)
+    {
+        munmap((void *)_dataPtr, _size);
+        throw;
+    }
+}
+
+MapFile::~MapFile()
+{
+    munmap((void *)_dataPtr, _size);
+}
+
+void MapFile::validate(const string & fileName) const
+{
+    const MapFileHeader & header = *_headerPtr;
+    if (not std::equal(header.magic, header.magic + 4, MAP_MAGIC))
+    {
+        throw std::runtime_error("MapFile : " + fileName + " is not a map file");
+    }
+    if (header.version != MAP_FILE_VERSION)
+    {
+        throw std::runtime_error("MapFile : " + fileName + " has the format version "
+                + to_string(header.version) + ", expected " + to_string(MAP_FILE_VERSION));
+    }
+    const uint64_t recordCount = uint64_t(header.keyframeCount) + header.activeCount;
+    if (header.fileSize != _size or header.tableOffset % BLOCK_ALIGNMENT != 0 or
+            header.tableOffset > _size or
+            recordCount > (_size - header.tableOffset) / sizeof(MapFrameRecord))
+    {
+        throw std::runtime_error("MapFile : " + fileName + " is truncated or corrupted");
+    }
+    for (uint64_t i = 0; i < recordCount; i++)
+    {
+        const MapFrameRecord & rec = _recordPtr[i];
+        const uint64_t imageSize = uint64_t(max(rec.rows, 0)) * max(rec.cols, 0);
+        const uint64_t depthBytes = 3 * depthSize(rec) * sizeof(double);
+        bool ok = rec.rows >= 0 and rec.cols >= 0 and
+                rec.imageOffset <= _size and imageSize <= _size - rec.imageOffset;
+        if (rec.hMax != 0)
+        {
+            ok = ok and rec.hMax > 0 and rec.xMax > 0 and rec.yMax > 0 and
+                    rec.depthOffset % BLOCK_ALIGNMENT == 0 and
+                    rec.depthOffset <= _size and depthBytes <= _size - rec.depthOffset;
+        }
+        if (not ok)
+        {
+            throw std::runtime_error("MapFile : " + fileName + " has an invalid frame record");
+        }
+    }
+}
+
+const MapFrameRecord & MapFile::record(const int idx) const
+{
+    if (idx < 0 or idx >= _headerPtr->keyframeCount + _headerPtr->activeCount)
+    {
+        throw std::runtime_error("MapFile : frame index out of range");
+    }
+    return _recordPtr[idx];
+}
+
+Mat8u MapFile::imageView(const MapFrameRecord & rec) const
+{
+    if (rec.rows == 0 or rec.cols == 0) return Mat8u();
+    return Mat8u(rec.rows, rec.cols, (uint8_t *)(_dataPtr + rec.imageOffset));
+}
+
+Transf MapFile::keyframePose(const int idx) const
+{
+    if (idx >= keyframeCount()) throw std::runtime_error("MapFile : keyframe index out of range");
+    return Transf(record(idx).xi);
+}
+
+Mat8u MapFile::keyframeImage(const int idx) const
+{
+    if (idx >= keyframeCount()) throw std::runtime_error("MapFile : keyframe index out of range");
+    return imageView(record(idx));
+}
+
+Transf MapFile::activePose() const
+{
+    if (not hasActiveFrame()) throw std::runtime_error("MapFile : no active frame");
+    return Transf(record(keyframeCount()).xi);
+}
+
+Mat8u MapFile::activeImage() const
+{
+    if (not hasActiveFrame()) throw std::runtime_error("MapFile : no active frame");
+    return imageView(record(keyframeCount()));
+}
+
+DepthMapView MapFile::activeDepth() const
+{
+    if (not hasActiveFrame()) throw std::runtime_error("MapFile : no active frame");
+    const MapFrameRecord & rec = record(keyframeCount());
+    DepthMapView view;
+    if (rec.hMax == 0) return view;
+    view.scale = rec.scale;
+    view.u0 = rec.u0;
+    view.v0 = rec.v0;
+    view.uMax = rec.uMax;
+    view.vMax = rec.vMax;
+    view.xMax = rec.xMax;
+    view.yMax = rec.yMax;
+    view.hMax = rec.hMax;
+    const double * depthPtr = (const double *)(_dataPtr + rec.depthOffset);
+    const uint64_t size = depthSize(rec);
+    view.valPtr = depthPtr;
+    view.sigmaPtr = depthPtr + size;
+    view.costPtr = depthPtr + 2 * size;
+    return view;
+}
+
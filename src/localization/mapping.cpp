@@ -21,6 +21,8 @@ SLAM system
 
 #include "localization/mapping.h"
 
+#include "utils/profiler.h"
+
 
 //Speed estimation and extrapolation are to be added
 //Assumed that the data arrives in the chronological order
@@ -36,10 +38,30 @@ PhotometricMapping::PhotometricMapping(const ptree & params):
     _xiLocal(0, 0, 0, 0, 0, 0),
     _zetaOdom(0, 0, 0, 0, 0, 0),
     _state(MAP_BEGIN),
-    _warningState(WARNING_NONE)
+    _warningState(WARNING_NONE),
+    _frameStore(_params.keyframeMemoryBudget),
+    _frameIndex(sqrt(5 * _params.distThreshSq))
 {
     _localizer.setVerbosity(0);
     _localizer.setXiBaseCam(_xiBaseCam);
+    _sparseOdom.setGuidedMatching(_params.guidedMatching);
+    if (_params.asyncMapping)
+    {
+        _mappingThread = std::thread(&PhotometricMapping::mappingLoop, this);
+    }
+}
+
+PhotometricMapping::~PhotometricMapping()
+{
+    if (_mappingThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(_jobMutex);
+            _stopMapping = true;
+        }
+        _jobCondition.notify_all();
+        _mappingThread.join();
+    }
 }
     
 bool PhotometricMapping::constructMap(const Transf & xiOdom, const Mat8u & img)
@@ -48,9 +70,7 @@ bool PhotometricMapping::constructMap(const Transf & xiOdom, const Mat8u & img)
     if (selectMapFrame(xiOdom, 1) == -1)
     {
     // insert a map keyframe
-        _frameVec.emplace_back();
-        img.copyTo(_frameVec.back().img);
-        _frameVec.back().xi = xiOdom;
+        addKeyframe(img, xiOdom);
         
         cout << "KEYFRAME : " << endl;
         cout << "    " << xiOdom << endl;
@@ -73,12 +93,29 @@ void PhotometricMapping::feedOdometry(const Transf & xi)
     _odomInit = true;
 }
 
+int PhotometricMapping::feedSynchronized(SensorSync & sync)
+{
+    int count = 0;
+    TimedImage image;
+    Transf xi;
+    while (sync.pop(image, xi))
+    {
+        feedOdometry(xi);
+        feedImage(image.img);
+        count++;
+    }
+    return count;
+}
+
 const bool ODOM_MODE = false;
 
 void PhotometricMapping::feedImage(const Mat8u & img)
 {
+    Profiler::instance().frameMark();
+    PROFILE_SCOPE("mapping");
     bool interDistanceOk, mapDistanceOk;
     Transf xiMapFr;
+    if (_params.asyncMapping) adoptMappingResults();
     switch (_state)
     {
     case MAP_BEGIN:
@@ -121,7 +158,7 @@ void PhotometricMapping::feedImage(const Mat8u & img)
         interDistanceOk = checkDistance(_xiLocal); //bool
         
         //distane to the map frame
-        xiMapFr = _frameVec[_mapIdx].xi.inverseCompose(_interFrame.xi);
+        xiMapFr = _frameXiVec[_mapIdx].inverseCompose(_interFrame.xi);
         mapDistanceOk = checkDistance(xiMapFr.compose(_xiLocal)); //bool
         
         //TODO MI localization before recomputing the depth
@@ -180,20 +217,39 @@ void PhotometricMapping::feedImage(const Mat8u & img)
 
 void PhotometricMapping::improveStereo(const Mat8u & img)
 {
+    PROFILE_SCOPE("mapping.improve_stereo");
     Transf base = getCameraMotion(_xiLocal);
     if (base.trans().norm() < _params.minStereoBase) return;
     
+    if (_params.asyncMapping)
+    {
+        //the refinement is skipped if the mapping thread is busy
+        MappingJob job;
+        job.type = MappingJob::JOB_STEREO;
+        job.frameId = _interFrameId;
+        job.img = img.clone();
+        job.xiLocal = _xiLocal;
+        pushMappingJob(job, true);
+        return;
+    }
+    
     _depth = _motionStereo.compute(base, img, _depth);
     _depth.filterNoise();
 }
 
 void PhotometricMapping::pushInterFrame(const Mat8u & img)
 {
+    PROFILE_SCOPE("mapping.push_inter_frame");
+    //the initial depth map is needed right away for the tracking
+    if (_params.asyncMapping and _state != MAP_INIT)
+    {
+        pushInterFrameAsync(img);
+        return;
+    }
+    
     if (_state == MAP_SLAM)
     {
-        _frameVec.emplace_back();
-        _interFrame.img.copyTo(_frameVec.back().img);
-        _frameVec.back().xi = _interFrame.xi;
+        addKeyframe(_interFrame.img, _interFrame.xi);
     }
     
     Transf base = getCameraMotion(_xiLocal);
@@ -203,20 +259,28 @@ void PhotometricMapping::pushInterFrame(const Mat8u & img)
         //use the SGM to compute the depth estimate
         DepthMap newDepth;
         EnhancedSgm sgm(base.inverse(), _camera, _camera, _sgmParams);
-        sgm.computeStereo(img, _interFrame.img, newDepth);
 //        imshow("img1", img);
 //        imshow("img2", _interFrame.img);
         cout << base.inverse() << endl;
-        newDepth.filterNoise();
         if (_state == MAP_INIT)
         {
+            sgm.computeStereo(img, _interFrame.img, newDepth);
+            newDepth.filterNoise();
             _depth = newDepth;
         }
         else
         {
-            //project forward the prior depth
+            //project forward the prior depth, it restricts the stereo search,
+            //then denoise and merge the new one in one pass
             _depth = _depth.wrapDepth(base);
-            _depth.merge(newDepth);
+            sgm.computeStereo(img, _interFrame.img, _depth, newDepth);
+            DepthFusionStats stats = _depth.fuse(newDepth);
+            PROFILE_COUNT("mapping.fusion.new", stats.newValid);
+            PROFILE_COUNT("mapping.fusion.noise_rejected", stats.noiseRejected);
+            PROFILE_COUNT("mapping.fusion.inserted", stats.inserted);
+            PROFILE_COUNT("mapping.fusion.fused", stats.fused);
+            PROFILE_COUNT("mapping.fusion.replaced", stats.replaced);
+            PROFILE_COUNT("mapping.fusion.discarded", stats.discarded);
         }
         
         /*
@@ -249,9 +313,18 @@ void PhotometricMapping::pushInterFrame(const Mat8u & img)
     _zetaOdom = _xiLocal;
     _xiLocalOld = _xiLocal = Transf(0, 0, 0, 0, 0, 0);
     
+    _interFrameId++;
+    
     _localizer.setBaseImage(img);
     _motionStereo.setBaseImage(img);
     
+    if (_params.asyncMapping)
+    {
+        //the mapping thread is idle during the initialization
+        _mapperFrameId = _interFrameId;
+        _mapperImg = img.clone();
+        _mapperDepth = _depth;
+    }
 }
 
 Transf PhotometricMapping::getCameraMotion(const Transf & xi) const
@@ -261,25 +334,114 @@ Transf PhotometricMapping::getCameraMotion(const Transf & xi) const
 
 void PhotometricMapping::reInit(const Transf & xi)
 {
+    if (_params.asyncMapping) waitMapping();
     if (_state == MAP_SLAM)
     {
-        _frameVec.emplace_back();
-        _interFrame.img.copyTo(_frameVec.back().img);
-        _frameVec.back().xi = _interFrame.xi;
+        addKeyframe(_interFrame.img, _interFrame.xi);
     }
     _state = MAP_BEGIN;
     _xiLocalOld = _xiLocal = xi;
     _odomInit = false;
 }
 
+void PhotometricMapping::addKeyframe(const Mat8u & img, const Transf & xi)
+{
+    _frameXiVec.push_back(xi);
+    _frameIdVec.push_back(_interFrameId);
+    KeyframeStoreStats storeStats;
+    {
+        std::lock_guard<std::mutex> lock(_storeMutex);
+        _frameStore.push(img);
+        storeStats = _frameStore.stats();
+    }
+    if (_sgmParams.verbosity > 0) cout << "KEYFRAME STORE : " << storeStats << endl;
+    _frameIndex.insert(_frameXiVec.size() - 1, xi.trans());
+}
+
+void PhotometricMapping::saveMap(const string & fileName)
+{
+    if (_params.asyncMapping) waitMapping();
+    MapWriter writer(fileName);
+    {
+        std::lock_guard<std::mutex> lock(_storeMutex);
+        for (int i = 0; i < _frameXiVec.size(); i++)
+        {
+            writer.addKeyframe(_frameXiVec[i], _frameStore.image(i));
+        }
+    }
+    if ((_state == MAP_LOCALIZE or _state == MAP_SLAM) and not _depth.empty())
+    {
+        writer.setActiveFrame(_interFrame.xi, _interFrame.img, _depth, _xiLocal);
+    }
+    writer.close();
+    PROFILE_COUNT("mapping.saved_keyframes", _frameXiVec.size());
+}
+
+void PhotometricMapping::loadMap(const string & fileName, const bool resume)
+{
+    if (_params.asyncMapping) waitMapping();
+    std::shared_ptr<MapFile> mapFilePtr = std::make_shared<MapFile>(fileName);
+    const MapFile & mapFile = *mapFilePtr;
+    
+    DepthMapView depthView;
+    if (resume and mapFile.hasActiveFrame()) depthView = mapFile.activeDepth();
+    if (not depthView.empty() and not (ScaleParameters(depthView) == ScaleParameters(_sgmParams)))
+    {
+        throw std::runtime_error("PhotometricMapping::loadMap : the depth map of " + fileName
+                + " does not match the stereo parameters");
+    }
+    
+    _mapFileVec.push_back(mapFilePtr);
+    for (int i = 0; i < mapFile.keyframeCount(); i++)
+    {
+        _frameXiVec.push_back(mapFile.keyframePose(i));
+        _frameIdVec.push_back(-1);
+        {
+            std::lock_guard<std::mutex> lock(_storeMutex);
+            _frameStore.pushExternal(mapFile.keyframeImage(i));
+        }
+        _frameIndex.insert(_frameXiVec.size() - 1, _frameXiVec.back().trans());
+    }
+    PROFILE_COUNT("mapping.loaded_keyframes", mapFile.keyframeCount());
+    if (depthView.empty()) return;
+    
+    //the inter frame image is overwritten in place later, it cannot refer to the mapping
+    _interFrame.img = mapFile.activeImage().clone();
+    _interFrame.xi = mapFile.activePose();
+    _depth = depthView.toDepthMap(_camera);
+    _zetaOdom = Transf(0, 0, 0, 0, 0, 0);
+    _xiLocalOld = _xiLocal = mapFile.activeLocalPose();
+    _odomInit = false;
+    _interFrameId++;
+    
+    _localizer.setBaseImage(_interFrame.img);
+    _motionStereo.setBaseImage(_interFrame.img);
+    
+    if (_params.asyncMapping)
+    {
+        _mapperFrameId = _interFrameId;
+        _mapperImg = _interFrame.img.clone();
+        _mapperDepth = _depth;
+    }
+    
+    _mapIdx = selectMapFrame(_interFrame.xi);
+    _state = (_mapIdx == -1) ? MAP_SLAM : MAP_LOCALIZE;
+}
+
 int PhotometricMapping::selectMapFrame(const Transf & xi, const double K)
 {
+    PROFILE_SCOPE("mapping.select_map_frame");
     int res = -1;
     double bestDist = DOUBLE_MAX;
     cout << "frame selection" << endl;
-    for (int i = 0; i < _frameVec.size(); i++)
+    
+    //checkDistance weighs the longitudinal displacement by 1/5, 
+    //so the frames farther than sqrt(5 * distThreshSq * K) are never accepted
+    vector<int> candidateVec;
+    _frameIndex.radiusSearch(xi.trans(), sqrt(5 * _params.distThreshSq * K), candidateVec);
+    for (auto & i : candidateVec)
     {
-        Transf delta = xi.inverseCompose(_frameVec[i].xi);
+        Transf delta = xi.inverseCompose(_frameXiVec[i]);
 //        delta.trans()[1] = 0;
         double r = delta.rot().squaredNorm();
         double d = delta.trans().squaredNorm();
@@ -288,7 +450,7 @@ int PhotometricMapping::selectMapFrame(const Transf & xi, const double K)
 //        cout << r << "   " << d << endl;
 //        cout << "SELECT FRAME " << i << endl;
 //        cout << "    d : " << d << "    r : " << r << endl;
-        if (not checkDistance(xi, _frameVec[i].xi, K)) continue;
+        if (not checkDistance(xi, _frameXiVec[i], K)) continue;
             
         if (r + d < bestDist)
         {
@@ -333,25 +495,225 @@ bool PhotometricMapping::checkDistance(const Transf & xi, const double K) const
 
 Transf PhotometricMapping::localizeMI()
 {
+    PROFILE_SCOPE("mapping.localize_mi");
+    if (_params.asyncMapping)
+    {
+        //the correction is applied by adoptMappingResults
+        MappingJob job;
+        job.type = MappingJob::JOB_RELOCALIZE;
+        job.frameId = _interFrameId;
+        job.mapIdx = _mapIdx;
+        job.xiFrame = _interFrame.xi;
+        job.xiMap = _frameXiVec[_mapIdx];
+        job.zetaOdom = _zetaOdom;
+        job.appliedCorrection = _appliedCorrection;
+        pushMappingJob(job, false);
+        return _interFrame.xi;
+    }
+    
     ScalePhotometric localizer(5, _camera); //TODO figure out why not _localizer
     localizer.setVerbosity(0);
     localizer.setXiBaseCam(_xiBaseCam);
-    localizer.setTargetImage(_frameVec[_mapIdx].img);
+    std::unique_lock<std::mutex> storeLock(_storeMutex);
+    const Mat8u imgMap = _frameStore.image(_mapIdx);
+    localizer.setTargetImage(imgMap);
     localizer.setBaseImage(_interFrame.img);
     localizer.setDepth(_depth);
-    imshow("keyframe", _frameVec[_mapIdx].img);
+    imshow("keyframe", imgMap);
+    storeLock.unlock();
     cout << "KF TRANSFORM" << endl;
-    cout << _frameVec[_mapIdx].xi << endl;
+    cout << _frameXiVec[_mapIdx] << endl;
 //    waitKey(0);
     Transf & xiFr = _interFrame.xi;
-    const Transf & xiMap = _frameVec[_mapIdx].xi;
+    const Transf & xiMap = _frameXiVec[_mapIdx];
 //    Transf xiFrMap = localizer.computePoseMI(xiFr.inverseCompose(xiMap));
     Transf xiFrMap = localizer.computePoseMI(xiFr.inverseCompose(xiMap), _zetaOdom);
     xiFr = xiMap.composeInverse(xiFrMap);
+    return xiFr;
+}
+
+//The tracking goes on against the prior depth projected forward,
+//the mapping thread computes the SGM and merges it for the same inter frame
+void PhotometricMapping::pushInterFrameAsync(const Mat8u & img)
+{
+    if (_state == MAP_SLAM)
+    {
+        addKeyframe(_interFrame.img, _interFrame.xi);
+    }
+    
+    MappingJob job;
+    job.type = MappingJob::JOB_KEYFRAME;
+    job.img = img.clone();
+    job.xiLocal = _xiLocal;
+    
+    _depth = _depth.wrapDepth(getCameraMotion(_xiLocal));
+    img.copyTo(_interFrame.img);
+    _interFrame.xi = _interFrame.xi.compose(_xiLocal);
+    _zetaOdom = _xiLocal;
+    _xiLocalOld = _xiLocal = Transf(0, 0, 0, 0, 0, 0);
+    _interFrameId++;
+    _localizer.setBaseImage(img);
+    
+    job.frameId = _interFrameId;
+    pushMappingJob(job, false);
+}
+
+void PhotometricMapping::pushMappingJob(MappingJob & job, const bool droppable)
+{
+    {
+        std::lock_guard<std::mutex> lock(_jobMutex);
+        if (droppable and (_mappingBusy or not _jobQueue.empty()))
+        {
+            _droppedJobCount++;
+            PROFILE_COUNT("mapping.dropped_jobs", 1);
+            return;
+        }
+        _jobQueue.push_back(std::move(job));
+    }
+    _jobCondition.notify_one();
+}
+
+void PhotometricMapping::waitMapping()
+{
+    if (not _params.asyncMapping) return;
+    {
+        std::unique_lock<std::mutex> lock(_jobMutex);
+        _idleCondition.wait(lock, [this]{ return _jobQueue.empty() and not _mappingBusy; });
+    }
+    adoptMappingResults();
+}
+
+int PhotometricMapping::droppedJobCount()
+{
+    std::lock_guard<std::mutex> lock(_jobMutex);
+    return _droppedJobCount;
+}
+
+void PhotometricMapping::mappingLoop()
+{
+    while (true)
+    {
+        MappingJob job;
+        {
+            std::unique_lock<std::mutex> lock(_jobMutex);
+            _jobCondition.wait(lock, [this]{ return _stopMapping or not _jobQueue.empty(); });
+            if (_stopMapping) return;
+            job = std::move(_jobQueue.front());
+            _jobQueue.pop_front();
+            _mappingBusy = true;
+        }
+        
+        processMappingJob(job);
+        
+        {
+            std::lock_guard<std::mutex> lock(_jobMutex);
+            _mappingBusy = false;
+        }
+        _idleCondition.notify_all();
+    }
+}
+
+//runs in the mapping thread, the same computations as in the synchronous mode
+void PhotometricMapping::processMappingJob(const MappingJob & job)
+{
+    PROFILE_SCOPE("mapping.job");
+    if (job.type == MappingJob::JOB_KEYFRAME)
+    {
+        Transf base = getCameraMotion(job.xiLocal);
+        if (base.trans().norm() > _params.minStereoBase)
+        {
+            DepthMap newDepth;
+            EnhancedSgm sgm(base.inverse(), _camera, _camera, _sgmParams);
+            _mapperDepth = _mapperDepth.wrapDepth(base);
+            sgm.computeStereo(job.img, _mapperImg, _mapperDepth, newDepth);
+            _mapperDepth.fuse(newDepth);
+        }
+        else
+        {
+            _mapperDepth = _mapperDepth.wrapDepth(base);
+        }
+        _mapperFrameId = job.frameId;
+        _mapperImg = job.img;
+        _motionStereo.setBaseImage(job.img);
+        publishDepth();
+    }
+    else if (job.frameId != _mapperFrameId)
+    {
+        //must not happen, the jobs are processed in order
+        return;
+    }
+    else if (job.type == MappingJob::JOB_STEREO)
+    {
+        Transf base = getCameraMotion(job.xiLocal);
+        _mapperDepth = _motionStereo.compute(base, job.img, _mapperDepth);
+        _mapperDepth.filterNoise();
+        publishDepth();
+    }
+    else if (job.type == MappingJob::JOB_RELOCALIZE)
+    {
+        ScalePhotometric localizer(5, _camera);
+        localizer.setVerbosity(0);
+        localizer.setXiBaseCam(_xiBaseCam);
+        {
+            std::lock_guard<std::mutex> lock(_storeMutex);
+            localizer.setTargetImage(_frameStore.image(job.mapIdx));
+        }
+        localizer.setBaseImage(_mapperImg);
+        localizer.setDepth(_mapperDepth);
+        Transf xiFrMap = localizer.computePoseMI(job.xiFrame.inverseCompose(job.xiMap), job.zetaOdom);
+        
+        std::lock_guard<std::mutex> lock(_correctionMutex);
+        _correctionVec.push_back(PoseCorrection{job.frameId, job.xiFrame, 
+                job.xiMap.composeInverse(xiFrMap), job.appliedCorrection});
+    }
+}
+
+void PhotometricMapping::publishDepth()
+{
+    std::shared_ptr<DepthSnapshot> snapshotPtr = std::make_shared<DepthSnapshot>();
+    snapshotPtr->frameId = _mapperFrameId;
+    snapshotPtr->depth = _mapperDepth;
+    std::atomic_store(&_depthSnapshotPtr, std::shared_ptr<const DepthSnapshot>(snapshotPtr));
+}
+
+void PhotometricMapping::adoptMappingResults()
+{
+    std::shared_ptr<const DepthSnapshot> snapshotPtr = std::atomic_load(&_depthSnapshotPtr);
+    if (snapshotPtr and snapshotPtr != _adoptedSnapshotPtr)
+    {
+        _adoptedSnapshotPtr = snapshotPtr;
+        //a snapshot of an older inter frame is useless, the newer one is being computed
+        if (snapshotPtr->frameId == _interFrameId) _depth = snapshotPtr->depth;
+    }
+    
+    vector<PoseCorrection> correctionVec;
+    {
+        std::lock_guard<std::mutex> lock(_correctionMutex);
+        swap(correctionVec, _correctionVec);
+    }
+    for (auto & correction : correctionVec)
+    {
+        //xiOld does not include the corrections applied since the request
+        Transf xiOld = _appliedCorrection.compose(correction.appliedCorrection.inverse()).compose(correction.xiOld);
+        Transf delta = correction.xiNew.composeInverse(xiOld);
+        
+        //the poses of the inter frame correction.frameId and of the later ones
+        //are chained from xiOld, the older keyframes are left untouched
+        _interFrame.xi = delta.compose(_interFrame.xi);
+        for (int i = _frameIdVec.size() - 1; i >= 0; i--)
+        {
+            if (_frameIdVec[i] == -1) continue;
+            if (_frameIdVec[i] < correction.frameId) break;
+            _frameXiVec[i] = delta.compose(_frameXiVec[i]);
+            _frameIndex.move(i, _frameXiVec[i].trans());
+        }
+        _appliedCorrection = delta.compose(_appliedCorrection);
+    }
 }
 
 Transf PhotometricMapping::localizePhoto(const Mat8u & img)
 {
+    PROFILE_SCOPE("mapping.localize_photo");
     _localizer.setDepth(_depth);
     _localizer.setTargetImage(img);
     
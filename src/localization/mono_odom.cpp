@@ -31,6 +31,7 @@ Relative camera pose estimation based on photometric error and depth map
 #include "reconstruction/eucm_motion_stereo.h"
 
 #include "localization/sparse_odom.h"
+#include "utils/profiler.h"
    
 MonoOdometry::MonoOdometry(const ptree & params):
     _xiBaseCam( readTransform(params.get_child("xi_base_camera")) ),
@@ -39,6 +40,7 @@ MonoOdometry::MonoOdometry(const ptree & params):
     sparseOdom(_camera, _xiBaseCam),
     motionStereo(_camera, _camera, params.get_child("stereo_parameters")),
     localizer(5, _camera),
+    imageStore(params.get<double>("keyframe_memory_budget", KEYFRAME_MEMORY_BUDGET) * (1 << 20)),
     state(STATE_BEGIN)
 {
     cout << "verbosity " << _sgmParams.verbosity << endl; 
@@ -54,10 +56,11 @@ MonoOdometry::~MonoOdometry()
 void MonoOdometry::feedWheelOdometry(const Transf xiOdomNew)
 {
     //integrate
-    _xiLocal = _xiLocal.composeInverse(_xiOdom).compose(xiOdomNew);
+    if (_odomInit) _xiLocal = _xiLocal.composeInverse(_xiOdom).compose(xiOdomNew);
     
     //refresh
     _xiOdom = xiOdomNew;
+    _odomInit = true;
 }
 
 void MonoOdometry::setDepth(const Mat32f & imageDepth)
@@ -78,15 +81,31 @@ void MonoOdometry::setDepth(const Mat32f & imageDepth)
     }
 }
 
+int MonoOdometry::feedSynchronized(SensorSync & sync)
+{
+    int count = 0;
+    TimedImage image;
+    Transf xi;
+    while (sync.pop(image, xi))
+    {
+        feedWheelOdometry(xi);
+        feedImage(image.img);
+        count++;
+    }
+    return count;
+}
+
 void MonoOdometry::feedImage(const Mat8u & imageNew)
 {
+    Profiler::instance().frameMark();
+    PROFILE_SCOPE("mono_odometry");
     switch (state)
     {
     case STATE_BEGIN:
         //the starting point, position 0
         //TODO refactor
         _xiGlobal = _xiLocal = Transf(0, 0, 0, 0, 0, 0);
-        imageVec.emplace_back(imageNew.clone());
+        imageStore.push(imageNew);
         transfVec.push_back(_xiLocal);
         motionStereo.setBaseImage(imageNew);
         sparseOdom.feedData(imageNew, _xiLocal);
@@ -174,12 +193,13 @@ void MonoOdometry::feedImage(const Mat8u & imageNew)
 
 void MonoOdometry::pushKeyFrame(const Mat8u & imageNew)
 {
+    PROFILE_SCOPE("mono_odometry.push_keyframe");
 
     //set Sgm stereo base
     EnhancedSgm sgm(getCameraMotion().inverse(), _camera, _camera, _sgmParams);
     //compute Sgm stereo 1-0
     DepthMap depthNew;
-    sgm.computeStereo(imageNew, imageVec.back(), depthNew);
+    sgm.computeStereo(imageNew, imageStore.back(), depthNew);
     
     
 //    //set Sgm stereo base
@@ -208,13 +228,63 @@ void MonoOdometry::pushKeyFrame(const Mat8u & imageNew)
     
     //reset the local position
     _xiLocal = Transf(0, 0, 0, 0, 0, 0);
-    imageVec.emplace_back(imageNew.clone());
+    imageStore.push(imageNew);
+    if (_sgmParams.verbosity > 0) cout << "KEYFRAME STORE : " << imageStore.stats() << endl;
     localizer.setBaseImage(imageNew);
     motionStereo.setBaseImage(imageNew);
     //Project the depth forward
     
 }
 
+void MonoOdometry::saveMap(const string & fileName)
+{
+    MapWriter writer(fileName);
+    for (int i = 0; i < imageStore.size(); i++)
+    {
+        writer.addKeyframe(transfVec[i], imageStore.image(i));
+    }
+    if (state == STATE_READY)
+    {
+        writer.setActiveFrame(_xiGlobal, imageStore.back(), depth, _xiLocal);
+    }
+    writer.close();
+}
+
+void MonoOdometry::loadMap(const string & fileName)
+{
+    if (state != STATE_BEGIN or not imageStore.empty())
+    {
+        throw std::runtime_error("MonoOdometry::loadMap : the odometry is already running");
+    }
+    std::shared_ptr<MapFile> filePtr = std::make_shared<MapFile>(fileName);
+    if (not filePtr->hasActiveFrame() or filePtr->activeDepth().empty())
+    {
+        throw std::runtime_error("MonoOdometry::loadMap : " + fileName + " has no depth map");
+    }
+    DepthMapView depthView = filePtr->activeDepth();
+    if (not (ScaleParameters(depthView) == ScaleParameters(_sgmParams)))
+    {
+        throw std::runtime_error("MonoOdometry::loadMap : the depth map of " + fileName
+                + " does not match the stereo parameters");
+    }
+    
+    mapFilePtr = filePtr;
+    for (int i = 0; i < mapFilePtr->keyframeCount(); i++)
+    {
+        transfVec.push_back(mapFilePtr->keyframePose(i));
+        imageStore.pushExternal(mapFilePtr->keyframeImage(i));
+    }
+    depth = depthView.toDepthMap(_camera);
+    _xiGlobal = mapFilePtr->activePose();
+    _xiLocalOld = _xiLocal = mapFilePtr->activeLocalPose();
+    _odomInit = false;
+    
+    const Mat8u imgBase = imageStore.back();
+    localizer.setBaseImage(imgBase);
+    motionStereo.setBaseImage(imgBase);
+    state = STATE_READY;
+}
+
 bool MonoOdometry::isNewKeyframeNeeded()
 {
     return (_xiLocal.trans().norm() > MAX_DIST or _xiLocal.rot().norm() > MAX_ANGLE);
@@ -25,6 +25,7 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "projection/eucm.h"
 #include "reconstruction/mh_pack.h"
+#include "utils/profiler.h"
 
 void ScalePhotometric::setBaseImage(const Mat8u & img1)
 {
@@ -94,6 +95,7 @@ PhotometricPack ScalePhotometric::initPhotometricData(int scaleIdx)
 
 Transf ScalePhotometric::computePose(const Transf & T12)
 {
+    PROFILE_SCOPE("photometric");
     if (verbosity > 0) 
     {
         cout << "ScalePhotometric::computePose" << endl;
@@ -110,6 +112,7 @@ Transf ScalePhotometric::computePose(const Transf & T12)
 
 void ScalePhotometric::computePose(int scaleIdx, Transf & T12)
 {
+    PROFILE_SCOPE("photometric.scale");
     if (verbosity > 1) 
     {
         cout << "ScalePhotometric::computePose with scaleIdx = " << scaleIdx << endl;
@@ -153,11 +156,14 @@ void ScalePhotometric::computePose(int scaleIdx, Transf & T12)
     Solve(options, &problem, &summary);
     if (verbosity > 2) cout << summary.FullReport() << endl;
     else if (verbosity > 1) cout << summary.BriefReport() << endl;
+    PROFILE_COUNT("photometric.points", dataPack.valVec.size());
+    PROFILE_COUNT("photometric.solver_iterations", summary.iterations.size());
     T12 = Transf(pose.data());
 }
 
 Transf ScalePhotometric::computePoseMI(const Transf & T12)
 {
+    PROFILE_SCOPE("photometric_mi");
     if (verbosity > 0) 
     {
         cout << "ScalePhotometric::computePoseMI" << endl;
@@ -173,6 +179,7 @@ Transf ScalePhotometric::computePoseMI(const Transf & T12)
 
 Transf ScalePhotometric::computePoseMI(const Transf & T12, const Transf & Todom)
 {
+    PROFILE_SCOPE("photometric_mi");
     if (verbosity > 0) 
     {
         cout << "ScalePhotometric::computePoseMI" << endl;
@@ -259,6 +266,7 @@ array<double, 6> ScalePhotometric::covarianceEigenValues(const int scaleIdx,
 
 void ScalePhotometric::computePoseMI(int scaleIdx, Transf & T12)
 {
+    PROFILE_SCOPE("photometric_mi.scale");
     if (verbosity > 1) 
     {
         cout << "ScalePhotometric::computePoseMI with scaleIdx = " << scaleIdx << endl;
@@ -315,6 +323,8 @@ void ScalePhotometric::computePoseMI(int scaleIdx, Transf & T12)
     Solve(options, problem, pose.data(), &summary);
     if (verbosity > 2) cout << summary.FullReport() << endl;
     else if (verbosity > 1) cout << summary.BriefReport() << endl;
+    PROFILE_COUNT("photometric_mi.points", dataPack.valVec.size());
+    PROFILE_COUNT("photometric_mi.solver_iterations", summary.iterations.size());
     T12 = Transf(pose.data());
 //    cout << T12 << endl;
 //    saveSurface("surf01.txt", costFunction, 2, 3, 0.0005, 50, pose.data());
@@ -322,6 +332,7 @@ void ScalePhotometric::computePoseMI(int scaleIdx, Transf & T12)
 
 void ScalePhotometric::computePoseMI(int scaleIdx, Transf & T12, const Transf & Todom)
 {
+    PROFILE_SCOPE("photometric_mi.scale");
     if (verbosity > 1) 
     {
         cout << "ScalePhotometric::computePoseMI with scaleIdx = " << scaleIdx << endl;
@@ -379,6 +390,8 @@ void ScalePhotometric::computePoseMI(int scaleIdx, Transf & T12, const Transf &
     Solve(options, problem, pose.data(), &summary);
     if (verbosity > 2) cout << summary.FullReport() << endl;
     else if (verbosity > 1) cout << summary.BriefReport() << endl;
+    PROFILE_COUNT("photometric_mi.points", dataPack.valVec.size());
+    PROFILE_COUNT("photometric_mi.solver_iterations", summary.iterations.size());
     T12 = Transf(pose.data());
 //    cout << T12 << endl;
 //    saveSurface("surf01.txt", costFunction, 2, 3, 0.0005, 50, pose.data());
@@ -0,0 +1,95 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Ingestion of timestamped images and wheel odometry
+*/
+
+#include "localization/sensor_sync.h"
+
+Transf interpolatePose(const TimedPose & pose0, const TimedPose & pose1, const double t)
+{
+    if (pose1.time <= pose0.time) return pose1.xi;
+    Transf zeta = pose0.xi.inverseCompose(pose1.xi);
+    zeta.scale((t - pose0.time) / (pose1.time - pose0.time));
+    return pose0.xi.compose(zeta);
+}
+
+SensorSync::SensorSync(const SensorSyncParameters & params) :
+    _params(params),
+    _imageQueue(params.imageQueueSize),
+    _odometryQueue(params.odometryQueueSize),
+    _hasPendingImage(false),
+    _unmatchedCount(0) {}
+
+void SensorSync::pushImage(const double t, const Mat8u & img)
+{
+    //the queue must own the data since the producer may reuse its buffer
+    _imageQueue.push(TimedImage{t, img.clone()});
+}
+
+void SensorSync::pushOdometry(const double t, const Transf & xi)
+{
+    _odometryQueue.push(TimedPose{t, xi});
+}
+
+bool SensorSync::pop(TimedImage & image, Transf & xi)
+{
+    TimedPose pose;
+    while (_odometryQueue.pop(pose))
+    {
+        _odometryBuffer.push_back(pose);
+    }
+    
+    while (true)
+    {
+        if (not _hasPendingImage)
+        {
+            if (not _imageQueue.pop(_pendingImage)) return false;
+            _hasPendingImage = true;
+        }
+        const double t = _pendingImage.time;
+        
+        //wait for a measurement after the image
+        if (_odometryBuffer.empty() or _odometryBuffer.back().time < t) return false;
+        
+        //the measurements before the bracketing pair are not needed anymore
+        while (_odometryBuffer.size() > 1 and _odometryBuffer[1].time <= t)
+        {
+            _odometryBuffer.pop_front();
+        }
+        
+        const TimedPose & pose0 = _odometryBuffer.front();
+        const TimedPose & pose1 = (_odometryBuffer.size() > 1) ? _odometryBuffer[1] : pose0;
+        const bool before = pose0.time > t; //the image precedes all the odometry
+        const bool exact = pose0.time == t;
+        //both measurements of the interpolation must be close enough
+        double gap = 0;
+        if (before) gap = pose0.time - t;
+        else if (not exact) gap = max(t - pose0.time, pose1.time - t);
+        _hasPendingImage = false;
+        if (gap > _params.maxOdometryGap)
+        {
+            _unmatchedCount++;
+            continue;
+        }
+        xi = (before or exact) ? pose0.xi : interpolatePose(pose0, pose1, t);
+        image = std::move(_pendingImage);
+        return true;
+    }
+}
+
@@ -23,6 +23,8 @@ Relative camera pose estimation based on photometric error and depth map
 
 #include "std.h"
 #include <tuple>
+#include <cstring>
+#include <functional>
 #include "eigen.h"
 #include "ocv.h"
 #include "ceres.h" 
@@ -31,6 +33,8 @@ Relative camera pose estimation based on photometric error and depth map
 #include "projection/generic_camera.h"
 #include "reconstruction/triangulator.h"
 #include "localization/local_cost_functions.h"
+#include "utils/parallel.h"
+#include "utils/profiler.h"
 
 using std::get;
 using std::tie;
@@ -157,48 +161,84 @@ void harrisTest()
     harrisBlobs(respMat, respHeap, maxVec);
 }
 
-//FIXME TMP HARRIS FEATURES
-Vector2dVec harrisCorners(const Mat8u & img)
+// Harris corners bucketed in a GRID_U x GRID_V grid for a uniform spatial coverage:
+// every cell keeps its strongest 3x3 local maxima, at most ceil(NUM_FEATURES / number of cells);
+// the weakest corners are dropped if the total exceeds NUM_FEATURES
+Vector2dVec harrisCorners(const Mat8u & img, const int NUM_FEATURES = 500,
+        const int GRID_U = 8, const int GRID_V = 6)
 {
-//    harrisTest();
+    const int MARGIN = 7; //keeps the descriptor patches inside the image
     Mat32f resp;
     resp.create(img.size());
     cornerHarris(img, resp, 7, 3, 0.05);
-//    harrisResp(img, resp);
-    vector<pair<double, int>> respHeap;
-    Vector2dVec maxVec;
     
-    for (int v = 7; v < img.rows - 7; v++)
+    const int uMin = MARGIN, uMax = img.cols - MARGIN;
+    const int vMin = MARGIN, vMax = img.rows - MARGIN;
+    if (uMax <= uMin or vMax <= vMin) return Vector2dVec();
+    const int numCells = GRID_U * GRID_V;
+    const int cellBudget = (NUM_FEATURES + numCells - 1) / numCells;
+    
+    // (response, u, v) of the selected corners of every cell
+    vector<vector<tuple<float, int, int>>> cellCornerVec(numCells);
+    parallelFor(0, numCells, [&](int begin, int end)
     {
-        for (int u = 7; u < img.cols - 7; u++)
+        vector<uint8_t> isMaxVec;
+        vector<tuple<float, int, int>> candidateVec;
+        for (int cellIdx = begin; cellIdx < end; cellIdx++)
         {
-            double respVal = resp(v, u);
-            bool isMax = true;
-            for (int dv = -1; dv <= 1 and isMax; dv++)
+            const int cellU = cellIdx % GRID_U, cellV = cellIdx / GRID_U;
+            const int u0 = uMin + (uMax - uMin) * cellU / GRID_U;
+            const int u1 = uMin + (uMax - uMin) * (cellU + 1) / GRID_U;
+            const int v0 = vMin + (vMax - vMin) * cellV / GRID_V;
+            const int v1 = vMin + (vMax - vMin) * (cellV + 1) / GRID_V;
+            isMaxVec.resize(u1 - u0);
+            candidateVec.clear();
+            for (int v = v0; v < v1; v++)
             {
-                for (int du = -1; du <= 1 and isMax; du++)
+                // branch-free strict non-maximum suppression over the row
+                const float * __restrict rowUp = resp[v - 1] + u0;
+                const float * __restrict row = resp[v] + u0;
+                const float * __restrict rowDown = resp[v + 1] + u0;
+                uint8_t * __restrict isMaxPtr = isMaxVec.data();
+                const int width = u1 - u0;
+                for (int i = 0; i < width; i++)
                 {
-                    if (du == 0 and dv == 0) continue;
-                    if (respVal <= resp(v + dv, u + du)) isMax = false;
+                    float neighborMax = max(max(rowUp[i - 1], rowUp[i]), max(rowUp[i + 1], row[i - 1]));
+                    neighborMax = max(neighborMax, max(max(row[i + 1], rowDown[i - 1]),
+                                        max(rowDown[i], rowDown[i + 1])));
+                    isMaxPtr[i] = (row[i] > neighborMax) & (row[i] > 0);
+                }
+                for (int i = 0; i < width; i++)
+                {
+                    if (isMaxPtr[i]) candidateVec.emplace_back(row[i], u0 + i, v);
                 }
             }
-            if (isMax)
-            {
-                maxVec.emplace_back(u, v);
-                respHeap.emplace_back(respVal, maxVec.size() - 1);
-            }
+            auto & cornerVec = cellCornerVec[cellIdx];
+            const int numSelected = min(cellBudget, int(candidateVec.size()));
+            std::partial_sort(candidateVec.begin(), candidateVec.begin() + numSelected,
+                    candidateVec.end(), std::greater<tuple<float, int, int>>());
+            cornerVec.assign(candidateVec.begin(), candidateVec.begin() + numSelected);
         }
+    });
+    
+    vector<tuple<float, int, int>> cornerVec;
+    for (auto & cellCorners : cellCornerVec)
+    {
+        cornerVec.insert(cornerVec.end(), cellCorners.begin(), cellCorners.end());
     }
-    make_heap(respHeap.begin(), respHeap.end());
+    if (cornerVec.size() > NUM_FEATURES)
+    {
+        std::nth_element(cornerVec.begin(), cornerVec.begin() + NUM_FEATURES,
+                cornerVec.end(), std::greater<tuple<float, int, int>>());
+        cornerVec.resize(NUM_FEATURES);
+    }
+    
     Vector2dVec resVec;
-    const int NUM_FEATURES = 500;
-    while (resVec.size() < NUM_FEATURES and not respHeap.empty())
+    resVec.reserve(cornerVec.size());
+    for (auto & corner : cornerVec)
     {
-        pop_heap(respHeap.begin(), respHeap.end());
-        int idx = respHeap.back().second;
-        respHeap.pop_back();
-        resVec.push_back(maxVec[idx]);
-    } 
+        resVec.emplace_back(get<1>(corner), get<2>(corner));
+    }
     return resVec;
 }
 
@@ -237,8 +277,87 @@ void descriptors(const Mat8u & img, Mat32f & out, const Vector2dVec & pointVec,
     }
 }
 
+// BRIEF-like binary descriptor over the same patch:
+// BINARY_NUM_BITS intensity comparisons between point pairs drawn from a Gaussian distribution.
+const int BINARY_NUM_BITS = 256;
+const int BINARY_DESC_SIZE = 4;
+
+// The pattern is generated with a fixed seed, so it is the same for every frame.
+// Degenerate pairs comparing a pixel with itself are redrawn
+vector<array<int, 4>> binaryPattern()
+{
+    mt19937 gen(1);
+    std::normal_distribution<double> offsetDist(0, BINARY_DESC_SIZE / 2.);
+    auto drawOffset = [&]() -> int
+    {
+        return min(max(int(round(offsetDist(gen))), -BINARY_DESC_SIZE), BINARY_DESC_SIZE);
+    };
+    vector<array<int, 4>> pairVec(BINARY_NUM_BITS);
+    for (auto & offsetArr : pairVec)
+    {
+        do
+        {
+            for (auto & offset : offsetArr) offset = drawOffset();
+        }
+        while (offsetArr[0] == offsetArr[2] and offsetArr[1] == offsetArr[3]);
+    }
+    return pairVec;
+}
+
+void binaryDescriptors(const Mat8u & img, Mat8u & out, const Vector2dVec & pointVec)
+{
+    static const vector<array<int, 4>> pairVec = binaryPattern();
+    out.create( Size(BINARY_NUM_BITS / 8, pointVec.size()) );
+    out.setTo(0);
+    
+    //the comparisons are done on a smoothed image to reduce the noise sensitivity
+    Mat8u imgSmooth;
+    GaussianBlur(img, imgSmooth, Size(5, 5), 1, 1);
+    
+    for (int idx = 0; idx < pointVec.size(); idx++)
+    {
+        const int u = round(pointVec[idx][0]);
+        const int v = round(pointVec[idx][1]);
+        uint8_t * outPtr = out[idx];
+        for (int bit = 0; bit < BINARY_NUM_BITS; bit++)
+        {
+            const auto & offsetArr = pairVec[bit];
+            if (imgSmooth(v + offsetArr[1], u + offsetArr[0]) < imgSmooth(v + offsetArr[3], u + offsetArr[2]))
+            {
+                outPtr[bit / 8] |= 1 << (bit % 8);
+            }
+        }
+    }
+}
+
+// L1 distance between two patch descriptors
+inline float patchDistance(const float * desc1, const float * desc2, const int length)
+{
+    float dist = 0;
+    for (int i = 0; i < length; i++)
+    {
+        dist += abs(desc1[i] - desc2[i]);
+    }
+    return dist;
+}
+
+// Hamming distance between two binary descriptors, length is in bytes and must be a multiple of 8
+inline int hammingDistance(const uint8_t * desc1, const uint8_t * desc2, const int length)
+{
+    int dist = 0;
+    for (int i = 0; i < length; i += 8)
+    {
+        uint64_t word1, word2;
+        memcpy(&word1, desc1 + i, 8);
+        memcpy(&word2, desc2 + i, 8);
+        dist += __builtin_popcountll(word1 ^ word2);
+    }
+    return dist;
+}
+
 void SparseOdometry::feedData(const Mat8u & imageNew, const Transf xiOdomNew)
 {
+    PROFILE_SCOPE("sparse_odometry");
     Transf dxi = xiBaseCam.inverseCompose(xiOdom.inverseCompose(xiOdomNew)).compose(xiBaseCam);
     //FIXME for debug
     if (dxi.trans().norm() < MIN_STEREO_BASE and not keypointVec1.empty()) return;
@@ -247,7 +366,14 @@ void SparseOdometry::feedData(const Mat8u & imageNew, const Transf xiOdomNew)
 //    keypointVec2 = harrisCorners(imageNew.rowRange(0, 300));
     keypointVec2 = harrisCorners(imageNew);
     cout << "EXTRACT" << endl;
-    descriptors(imageNew, desc2, keypointVec2);
+    if (descriptorType == DESCRIPTOR_BINARY)
+    {
+        binaryDescriptors(imageNew, binDesc2, keypointVec2);
+    }
+    else
+    {
+        descriptors(imageNew, desc2, keypointVec2);
+    }
     
 //    detector.detect(imageNew.rowRange(0, 300), keypointVec2);
     
@@ -263,9 +389,23 @@ void SparseOdometry::feedData(const Mat8u & imageNew, const Transf xiOdomNew)
     {
         cout << "MATCH" << endl;
         //correspondence
-        BFMatcher matcher(cv::NORM_L1, true);
         vector<DMatch> matchVec;
-        matcher.match(desc1, desc2, matchVec);
+        if (guidedMatching)
+        {
+            guidedMatch(dxi, matchVec);
+        }
+        else if (descriptorType == DESCRIPTOR_BINARY)
+        {
+            BFMatcher matcher(cv::NORM_HAMMING, true);
+            matcher.match(binDesc1, binDesc2, matchVec);
+        }
+        else
+        {
+            BFMatcher matcher(cv::NORM_L1, true);
+            matcher.match(desc1, desc2, matchVec);
+        }
+        PROFILE_COUNT("sparse_odometry.matches", matchVec.size());
+        const double matchThresh = (descriptorType == DESCRIPTOR_BINARY) ? binaryDistThresh : distThresh;
         
         
         
@@ -280,7 +420,7 @@ void SparseOdometry::feedData(const Mat8u & imageNew, const Transf xiOdomNew)
         vector<double> sizeVec;
         for (auto & match : matchVec)
         {
-            if (match.distance > distThresh) continue;
+            if (match.distance > matchThresh) continue;
 //            if (abs(keypointVec1[match.queryIdx].size - keypointVec2[match.trainIdx].size) /
 //                (keypointVec1[match.queryIdx].size + keypointVec2[match.trainIdx].size) > 0.07) continue;
             goodMatchVec.push_back(match);
@@ -432,11 +572,119 @@ void SparseOdometry::feedData(const Mat8u & imageNew, const Transf xiOdomNew)
     //refresh state
     keypointVec1.swap(keypointVec2);
     swap(desc1, desc2);
+    swap(binDesc1, binDesc2);
     imageNew.copyTo(imageOld);
     xiOdom = xiOdomNew;
 }
     
       
+float SparseOdometry::descriptorDistance(int idx1, int idx2) const
+{
+    if (descriptorType == DESCRIPTOR_BINARY)
+    {
+        return hammingDistance(binDesc1[idx1], binDesc2[idx2], binDesc1.cols);
+    }
+    return patchDistance(desc1[idx1], desc2[idx2], desc1.cols);
+}
+
+void SparseOdometry::guidedMatch(const Transf dxi, vector<DMatch> & matchVec) const
+{
+    // the epipolar curve of a keypoint is approximated by the projections
+    // of its bearing vector at these depths, in meters
+    const array<double, 8> depthArr = {0.3, 0.6, 1.2, 2.5, 5, 10, 20, 1e4};
+    const double radiusSq = searchRadius * searchRadius;
+    
+    // grid index of the new keypoints
+    const double cellSize = 2 * searchRadius;
+    const int gridCols = ceil(camera->width / cellSize);
+    const int gridRows = ceil(camera->height / cellSize);
+    // clamped before the conversion, projections can be far outside the image
+    auto cellIndex = [cellSize](double x, int numCells) -> int
+    {
+        return min(max(x / cellSize, 0.), numCells - 1.);
+    };
+    vector<vector<int>> gridVec(gridCols * gridRows);
+    for (int j = 0; j < keypointVec2.size(); j++)
+    {
+        const int cellU = cellIndex(keypointVec2[j][0], gridCols);
+        const int cellV = cellIndex(keypointVec2[j][1], gridRows);
+        gridVec[cellU + cellV * gridCols].push_back(j);
+    }
+    
+    // candidates and their descriptor distances for every old keypoint
+    vector<vector<pair<float, int>>> candidateVec(keypointVec1.size());
+    parallelFor(0, keypointVec1.size(), [&](int begin, int end)
+    {
+        vector<int> visitStamp(keypointVec2.size(), -1);
+        Vector2dVec curveVec;
+        for (int i = begin; i < end; i++)
+        {
+            Vector3d x1;
+            if (not camera->reconstructPoint(keypointVec1[i], x1)) continue;
+            x1.normalize();
+            curveVec.clear();
+            for (const double depth : depthArr)
+            {
+                Vector3d X;
+                dxi.inverseTransform(x1 * depth, X);
+                Vector2d p;
+                if (camera->projectPoint(X, p)) curveVec.push_back(p);
+            }
+            if (curveVec.empty()) continue;
+            
+            for (int k = 0; k < curveVec.size(); k++)
+            {
+                // the segment from the previous sample to the current one
+                const Vector2d & a = curveVec[max(k - 1, 0)];
+                const Vector2d & b = curveVec[k];
+                const Vector2d ab = b - a;
+                const double abSq = ab.squaredNorm();
+                const int cellUMin = cellIndex(min(a[0], b[0]) - searchRadius, gridCols);
+                const int cellUMax = cellIndex(max(a[0], b[0]) + searchRadius, gridCols);
+                const int cellVMin = cellIndex(min(a[1], b[1]) - searchRadius, gridRows);
+                const int cellVMax = cellIndex(max(a[1], b[1]) + searchRadius, gridRows);
+                for (int cellV = cellVMin; cellV <= cellVMax; cellV++)
+                {
+                    for (int cellU = cellUMin; cellU <= cellUMax; cellU++)
+                    {
+                        for (const int j : gridVec[cellU + cellV * gridCols])
+                        {
+                            if (visitStamp[j] == i) continue;
+                            const Vector2d ap = keypointVec2[j] - a;
+                            const double t = abSq > 0 ? min(max(ap.dot(ab) / abSq, 0.), 1.) : 0.;
+                            if ((ap - t * ab).squaredNorm() > radiusSq) continue;
+                            visitStamp[j] = i;
+                            
+                            candidateVec[i].emplace_back(descriptorDistance(i, j), j);
+                        }
+                    }
+                }
+            }
+        }
+    });
+    
+    // cross-check, the same way as BFMatcher does
+    const pair<float, int> noMatch(std::numeric_limits<float>::max(), -1);
+    vector<pair<float, int>> bestQueryVec(keypointVec2.size(), noMatch);
+    vector<pair<float, int>> bestTrainVec(keypointVec1.size(), noMatch);
+    for (int i = 0; i < candidateVec.size(); i++)
+    {
+        for (auto & candidate : candidateVec[i])
+        {
+            const int j = candidate.second;
+            if (candidate.first < bestTrainVec[i].first) bestTrainVec[i] = candidate;
+            if (candidate.first < bestQueryVec[j].first) bestQueryVec[j] = make_pair(candidate.first, i);
+        }
+    }
+    matchVec.clear();
+    for (int i = 0; i < bestTrainVec.size(); i++)
+    {
+        const int j = bestTrainVec[i].second;
+        if (j == -1 or bestQueryVec[j].second != i) continue;
+        matchVec.emplace_back(i, j, bestTrainVec[i].first);
+    }
+}
+    
 double SparseOdometry::computeTransfSparse(const Vector3dVec & xVec1, const Vector3dVec & xVec2, 
         const Vector2dVec & pVec2, const vector<double> & sizeVec, const Transf xiOdom, Transf & xiOut, bool report)
 {
@@ -508,101 +756,230 @@ Vector2dVec SparseOdometry::reprojectPoints(const Vector3dVec & cloud1,
 }
 
    
+double SparseOdometry::reprojectionError(const Triangulator & triangulator, const Transf & dxi,
+        const Vector3d & x1, const Vector3d & x2, const Vector2d & p2) const
+{
+    double lambda;
+    triangulator.computeRegular(x1, x2, &lambda);
+    Vector3d X;
+    dxi.inverseTransform(x1 * lambda, X);
+    Vector2d p;
+    if (not camera->projectPoint(X, p)) return DOUBLE_BIG;
+    return (p2 - p).norm();
+}
+
 void SparseOdometry::ransacNPoints(const Vector3dVec & cloud1,
     const Vector3dVec & cloud2, const Vector2dVec & ptVec2, const vector<double> & sizeVec,
     const Transf xiOdom, vector<bool> & inlierMask)
 {
+    PROFILE_SCOPE("sparse_odometry.ransac");
     assert(cloud1.size() == cloud2.size());
     //define constants
     const int maxIteration = 200;
     const double thresh = 1.;
-    int inlierCount = numRansacPoints;
+    const double confidence = 0.99;
+    const int batchSize = 32;   // hypotheses generated and scored together
+    const int blockSize = 16;   // points per preemptive scoring stage
+    const int maxStepCount = 5; // Gauss-Newton steps per hypothesis
+    const double minStep = 1e-6;
     
-    vector<int> indexVec;
-    for (int idx = 0; idx < cloud1.size(); idx++)
-    {
-        indexVec.push_back(idx);
-    }
+    const int N = cloud1.size();
+    inlierMask.assign(N, false);
     
-    //triangulate all the vectors
-    Transf dxi = xiBaseCam.inverseCompose(xiOdom).compose(xiBaseCam);
+    // The hypotheses are not minimal solutions: numRansacPoints matches do not
+    // constrain the 6 DoF motion, so every hypothesis is the Gauss-Newton solution
+    // for its sample regularized by the odometry prior.
+    // The first step of every hypothesis starts from the linearization of all the matches
+    // at the odometry, the next ones are relinearized at the hypothesis itself,
+    // so that the samples can move the estimate away from a wrong odometry
+    array<double, 6> xiArr = xiOdom.toArray();
+    const double * params = xiArr.data();
+    
+    vector<double> residualVec(2 * N);
+    vector<double> jacVec(12 * N);
+    double * jacPtr = jacVec.data();
+    SparseReprojectCost projectionCost(camera, cloud1, cloud2, ptVec2, sizeVec, xiBaseCam);
+    projectionCost.Evaluate(&params, residualVec.data(), &jacPtr);
     
+    Vector6d priorResidual;
+    Matrix6drm priorJac;
+    double * priorJacPtr = priorJac.data();
+    OdometryPrior odometryCost(0.03, 0.5, 0.03, 0.05, xiOdom);
+    odometryCost.Evaluate(&params, priorResidual.data(), &priorJacPtr);
+    const Matrix6d H0 = priorJac.transpose() * priorJac;
+    const Vector6d g0 = priorJac.transpose() * priorResidual;
     
-    for (int ransacIteration = 0; ransacIteration < maxIteration; ransacIteration++)
+    // only the matches which can be reprojected with the odometry are sampled
+    vector<int> sampleIdxVec;
+    for (int idx = 0; idx < N; idx++)
     {
-        //TODO optimiza the step
-        shuffle(indexVec.begin(), indexVec.end(), _g);
-        Vector3dVec xSampleVec1, xSampleVec2;
-        Vector2dVec pSampleVec2;
-        vector<double> sizeVec2;
-        for (auto iter = indexVec.begin(); iter != indexVec.begin() + numRansacPoints; ++iter)
+        if (residualVec[2 * idx] != DOUBLE_BIG) sampleIdxVec.push_back(idx);
+    }
+    if (sampleIdxVec.size() < numRansacPoints) return;
+    
+    auto solveHypothesis = [&](const int * sample) -> Transf
+    {
+        Matrix6d H = H0;
+        Vector6d g = g0;
+        Vector3dVec x1Vec, x2Vec;
+        Vector2dVec p2Vec;
+        vector<double> sampleSizeVec;
+        for (int k = 0; k < numRansacPoints; k++)
         {
-            xSampleVec1.push_back(cloud1[*iter]);
-            xSampleVec2.push_back(cloud2[*iter]);
-            pSampleVec2.push_back(ptVec2[*iter]);
-            sizeVec2.push_back(sizeVec[*iter]);
-//            sizeVec2.push_back(1);
+            Map<const Matrix<double, 2, 6, RowMajor>> J(jacPtr + 12 * sample[k]);
+            Map<const Vector2d> r(residualVec.data() + 2 * sample[k]);
+            H += J.transpose() * J;
+            g += J.transpose() * r;
+            x1Vec.push_back(cloud1[sample[k]]);
+            x2Vec.push_back(cloud2[sample[k]]);
+            p2Vec.push_back(ptVec2[sample[k]]);
+            sampleSizeVec.push_back(sizeVec[sample[k]]);
         }
+        Vector6d delta = -H.ldlt().solve(g);
+        array<double, 6> hypArr;
+        for (int i = 0; i < 6; i++) hypArr[i] = xiArr[i] + delta[i];
         
-        // fit the model
-        Transf xiOut;
-        //TODO // chi2 test, 16 variables, 2% confidence
-        computeTransfSparse(xSampleVec1, xSampleVec2, pSampleVec2, sizeVec2, xiOdom, xiOut);
-        
-        vector<double> lambdaVec(cloud1.size());
-        xiOut = xiBaseCam.inverseCompose(xiOut).compose(xiBaseCam);
-        Triangulator(xiOut).computeRegular(cloud1, cloud2, lambdaVec.data());
-        Vector3dVec cloudScaled;
-        cloudScaled.reserve(cloud1.size());
-        for (int i = 0; i < cloud1.size(); i++)
+        SparseReprojectCost sampleCost(camera, x1Vec, x2Vec, p2Vec, sampleSizeVec, xiBaseCam);
+        vector<double> sampleResidualVec(2 * numRansacPoints);
+        vector<double> sampleJacVec(12 * numRansacPoints);
+        double * sampleJacPtr = sampleJacVec.data();
+        Vector6d hypPriorResidual;
+        Matrix6drm hypPriorJac;
+        double * hypPriorJacPtr = hypPriorJac.data();
+        // every step is accepted only if the whole sample can be reprojected with it,
+        // the odometry is valid since the samples are drawn among such matches
+        array<double, 6> validArr = xiArr;
+        for (int step = 1; ; step++)
         {
-            cloudScaled.emplace_back(cloud1[i] * lambdaVec[i]);
+            const double * hypParams = hypArr.data();
+            sampleCost.Evaluate(&hypParams, sampleResidualVec.data(), &sampleJacPtr);
+            if (std::count(sampleResidualVec.begin(), sampleResidualVec.end(), DOUBLE_BIG) > 0)
+            {
+                hypArr = validArr;
+                break;
+            }
+            validArr = hypArr;
+            if (step >= maxStepCount or delta.norm() <= minStep) break;
+            odometryCost.Evaluate(&hypParams, hypPriorResidual.data(), &hypPriorJacPtr);
+            H = hypPriorJac.transpose() * hypPriorJac;
+            g = hypPriorJac.transpose() * hypPriorResidual;
+            for (int k = 0; k < numRansacPoints; k++)
+            {
+                Map<const Matrix<double, 2, 6, RowMajor>> J(sampleJacPtr + 12 * k);
+                Map<const Vector2d> r(sampleResidualVec.data() + 2 * k);
+                H += J.transpose() * J;
+                g += J.transpose() * r;
+            }
+            delta = -H.ldlt().solve(g);
+            for (int i = 0; i < 6; i++) hypArr[i] += delta[i];
         }
-        xiOut.inverseTransform(cloudScaled, cloudScaled);
-        Vector2dVec ptCheckVec;
-        camera->projectPointCloud(cloudScaled, ptCheckVec);
-        // count inliers
-        vector<bool> inlierMaskEstim;
-        int inlierCountEstim = 0;
-        
-        for (int idx = 0; idx < ptCheckVec.size(); idx++)
+        return xiBaseCam.inverseCompose(Transf(hypArr.data())).compose(xiBaseCam);
+    };
+    
+    vector<int> evalOrder(N);
+    for (int idx = 0; idx < N; idx++) evalOrder[idx] = idx;
+    
+    vector<int> sampleVec(batchSize * numRansacPoints);
+    vector<Transf> hypVec(batchSize);
+    // the triangulators are set up once per hypothesis, not per scored match
+    vector<Triangulator> triangulatorVec(batchSize, Triangulator(xiOdom));
+    vector<int> scoreVec(batchSize);
+    vector<int> aliveVec;
+    std::uniform_int_distribution<int> sampleDist(0, sampleIdxVec.size() - 1);
+    
+    int bestCount = numRansacPoints;
+    int hypCount = 0;
+    int requiredCount = maxIteration;
+    while (hypCount < requiredCount)
+    {
+        // the last batch is cut so that no more than requiredCount hypotheses are drawn
+        const int hypBatch = min(batchSize, requiredCount - hypCount);
+        
+        // draw the samples serially, the generator is not thread-safe
+        for (int h = 0; h < hypBatch; h++)
         {
-            double res = (ptVec2[idx] - ptCheckVec[idx]).norm();
-            if (res < thresh)
+            int * sample = sampleVec.data() + h * numRansacPoints;
+            for (int k = 0; k < numRansacPoints; k++)
             {
-                inlierCountEstim++;
-                inlierMaskEstim.push_back(true);
+                do
+                {
+                    sample[k] = sampleIdxVec[sampleDist(_g)];
+                }
+                while (std::find(sample, sample + k, sample[k]) != sample + k);
             }
-            else
+        }
+        shuffle(evalOrder.begin(), evalOrder.end(), _g);
+        
+        parallelFor(0, hypBatch, [&](int begin, int end)
+        {
+            for (int h = begin; h < end; h++)
             {
-                inlierMaskEstim.push_back(false);
+                hypVec[h] = solveHypothesis(sampleVec.data() + h * numRansacPoints);
+                triangulatorVec[h].setTransformation(hypVec[h]);
+                scoreVec[h] = 0;
             }
+        });
+        
+        // preemptive scoring: all the hypotheses are scored on the same block of points,
+        // the better half goes to the next block
+        aliveVec.resize(hypBatch);
+        for (int h = 0; h < hypBatch; h++) aliveVec[h] = h;
+        int blockStart = 0;
+        while (aliveVec.size() > 1 and blockStart < N)
+        {
+            const int blockEnd = min(blockStart + blockSize, N);
+            parallelFor(0, aliveVec.size(), [&](int begin, int end)
+            {
+                for (int a = begin; a < end; a++)
+                {
+                    const int h = aliveVec[a];
+                    for (int i = blockStart; i < blockEnd; i++)
+                    {
+                        const int idx = evalOrder[i];
+                        if (reprojectionError(triangulatorVec[h], hypVec[h],
+                                cloud1[idx], cloud2[idx], ptVec2[idx]) < thresh)
+                        {
+                            scoreVec[h]++;
+                        }
+                    }
+                }
+            });
+            blockStart = blockEnd;
+            std::stable_sort(aliveVec.begin(), aliveVec.end(),
+                    [&](int a, int b) { return scoreVec[a] > scoreVec[b]; });
+            aliveVec.resize((aliveVec.size() + 1) / 2);
         }
+        hypCount += hypBatch;
+        
+        // full scoring of the surviving hypothesis
+        const Transf & dxi = hypVec[aliveVec.front()];
+        const Triangulator & triangulator = triangulatorVec[aliveVec.front()];
+        // vector<bool> is bit-packed and cannot be written concurrently
+        vector<uint8_t> inlierFlagVec(N);
+        parallelFor(0, N, [&](int begin, int end)
+        {
+            for (int idx = begin; idx < end; idx++)
+            {
+                inlierFlagVec[idx] = reprojectionError(triangulator, dxi,
+                        cloud1[idx], cloud2[idx], ptVec2[idx]) < thresh;
+            }
+        });
+        const int inlierCountEstim = std::count(inlierFlagVec.begin(), inlierFlagVec.end(), 1);
         
         // refresh the best hypothesis
-        if (inlierCountEstim > inlierCount)
+        if (inlierCountEstim > bestCount)
         {
+            bestCount = inlierCountEstim;
+            inlierMask.assign(inlierFlagVec.begin(), inlierFlagVec.end());
             
-            
-            //FIXME DEBUG
-            cout << "RANSAC IMPROVE  " << ransacIteration << setw(10) << inlierCountEstim << endl;
-//            
-//            for (int i = 0; i < ptCheckVec.size(); i++)
-//            {
-//                if (inlierMaskEstim[i])
-//                {
-//                    cout << setw(5) << i << setw(15) << ptVec2[i].transpose() 
-//                            << setw(15) << ptCheckVec[i].transpose() << endl; 
-//                }
-//            }
-            
-            inlierCount = inlierCountEstim;
-            inlierMask.swap(inlierMaskEstim);
-//            if (inlierCount > 30) break;
+            // adaptive termination
+            const double inlierRatio = double(bestCount) / N;
+            const double sampleFailure = 1. - pow(inlierRatio, numRansacPoints);
+            if (sampleFailure < 1e-9) break;
+            requiredCount = min(maxIteration, int(ceil(log(1. - confidence) / log(sampleFailure))));
         }
     }
-//    cout << "inlierCount : " << inlierCount << endl;
+    PROFILE_COUNT("sparse_odometry.ransac_iterations", hypCount);
+    PROFILE_COUNT("sparse_odometry.inliers", bestCount);
 }
 
-
-            
@@ -24,9 +24,13 @@ NOTE:
 
 #include "reconstruction/depth_map.h"
 
+#include <atomic>
+#include <cstring>
+
 #include "io.h"
 #include "std.h"
 #include "eigen.h"
+#include "utils/parallel.h"
 
 
 void filter(double & v1, double & s1, const double v2, const double s2)
@@ -408,6 +412,36 @@ Vector2dVec DepthMap::getPointVec() const
     return result;
 }
 
+std::shared_ptr<const Vector3dVec> DepthMap::getBearingVec() const
+{
+    std::shared_ptr<const BearingCache> cachePtr = std::atomic_load(&bearingPtr);
+    if (not cachePtr or not (cachePtr->params == *this))
+    {
+        // concurrent first calls may compute it twice, the results are identical;
+        // each caller owns the cache it returns, so replacing it cannot free a vector in use
+        std::shared_ptr<BearingCache> newCachePtr = std::make_shared<BearingCache>();
+        newCachePtr->params = *this;
+        Vector3dVec & bearingVec = newCachePtr->bearingVec;
+        bearingVec.resize(hStep);
+        parallelFor(0, yMax, [&](int yBegin, int yEnd)
+        {
+            for (int y = yBegin; y < yEnd; y++)
+            {
+                for (int x = 0; x < xMax; x++)
+                {
+                    Vector3d & X = bearingVec[x + y * xMax];
+                    if (cameraPtr->reconstructPoint(Vector2d(uConv(x), vConv(y)), X)) X.normalize();
+                    else X.setZero();
+                }
+            }
+        });
+        cachePtr = newCachePtr;
+        std::atomic_store(&bearingPtr, cachePtr);
+    }
+    // shares the ownership of the cache
+    return std::shared_ptr<const Vector3dVec>(cachePtr, &cachePtr->bearingVec);
+}
+
 //TODO - Depecrated
 void DepthMap::reconstructUncertainty(vector<int> & idxVec, 
             Vector3dVec & minDistVec, Vector3dVec & maxDistVec) const
@@ -533,105 +567,153 @@ void DepthMap::reconstruct(MHPack & result, const uint32_t reconstFlags) const
 {
     assert(not (reconstFlags & IMAGE_VALUES)); //FIXME imageValues are not implemented
     const int numHyps = (reconstFlags & ALL_HYPOTHESES) ? hMax : 1;
+    const bool queryPoints = (reconstFlags & QUERY_POINTS) and not (reconstFlags & QUERY_INDICES);
+    const int numCloudPoints = (reconstFlags & MINMAX) ? 2 : 1;
 
     // Convert query points to query indices
-    vector<int> queryIdxVec;
-    Vector2dVec queryPointVec;
+    // The query is swapped into the scratch buffers to keep the capacity of all vectors
+    vector<int> & queryIdxVec = result.queryIdxBuffer;
+    Vector2dVec & queryPointVec = result.queryPointBuffer;
     if (reconstFlags & QUERY_INDICES)
     {
         swap(queryIdxVec, result.idxVec);
-        queryPointVec = getPointVec(queryIdxVec);
     }
-    else if (reconstFlags & QUERY_POINTS)
+    else if (queryPoints)
     {
-        queryIdxVec = getIdxVec(result.imagePointVec);
         swap(queryPointVec, result.imagePointVec);
+        queryIdxVec.resize(queryPointVec.size());
+        parallelFor(0, queryPointVec.size(), [&](int iBegin, int iEnd)
+        {
+            for (int i = iBegin; i < iEnd; i++)
+            {
+                const int xd = xConv(queryPointVec[i][0]);
+                const int yd = yConv(queryPointVec[i][1]);
+                queryIdxVec[i] = isValid(xd, yd) ? xd + yd*xMax : -1;
+            }
+        });
     }
     else
     {
-        queryIdxVec = getIdxVec();
-        queryPointVec = getPointVec(queryIdxVec);
+        queryIdxVec.clear();
+        for (int i = 0; i < hStep; i++)
+        {
+            if (valVec[i] >= MIN_DEPTH) queryIdxVec.push_back(i);
+        }
     }
-
-    result.idxVec.clear();
-    result.idxMapVec.clear();
-    result.hypIdxVec.clear();
-    result.costVec.clear();
-    result.sigmaVec.clear();
-    result.cloud.clear();
-    result.valVec.clear();
-//result.datatype = (minmax_flag) ? MHPack::MINMAX_DISTANCE_VEC_WITH_SIGN : MHPack::RECONSTRUCTION_WITH_SIGMA;
-
-    vector<double> depthVec;
-    for (int i = 0; i < queryIdxVec.size(); i++)
+    
+    // the grid points are not unprojected again
+    std::shared_ptr<const Vector3dVec> bearingVecPtr;
+    if (not queryPoints) bearingVecPtr = getBearingVec();
+    
+    auto getHypothesis = [&](const int queryIdx, const int h, double & depth, double & sigma) -> bool
     {
-        if (queryIdxVec[i] < 0 or queryIdxVec[i] > hStep) continue;
-        for (int h = 0; h < numHyps; h++)
+        depth = valVec[queryIdx + h*hStep];
+        sigma = sigmaVec[queryIdx + h*hStep]; //TODO discard points with sigma > sigmaMax
+        if (depth < MIN_DEPTH or depth == OUT_OF_RANGE)
         {
-            const int queryIdx = queryIdxVec[i];
-            double depth = valVec[queryIdx + h*hStep];
-            double sigma = sigmaVec[queryIdx + h*hStep]; //TODO discard points with sigma > sigmaMax
-            if (depth < MIN_DEPTH or depth == OUT_OF_RANGE)
-            {
-                if (reconstFlags & DEFAULT_VALUES and h == 0)
-                {
-                    depth = DEFAULT_DEPTH;
-                    sigma = DEFAULT_SIGMA_DEPTH;
-                }
-                else continue;
-            }
-            
-            if (reconstFlags & MINMAX) 
-            {
-                depthVec.push_back(max(depth - 3*sigma, MIN_DEPTH));
-                depthVec.push_back(depth + 3*sigma);
-            }
-            else
+            if (reconstFlags & DEFAULT_VALUES and h == 0)
             {
-                depthVec.push_back(depth);
+                depth = DEFAULT_DEPTH;
+                sigma = DEFAULT_SIGMA_DEPTH;
             }
-            
-            if (reconstFlags & SIGMA_VALUE) result.sigmaVec.push_back(sigma);
-            result.idxVec.push_back(queryIdx);
-            result.hypIdxVec.push_back(h);
-            result.imagePointVec.push_back(queryPointVec[i]);
-            if (reconstFlags & INDEX_MAPPING) result.idxMapVec.push_back(i);
+            else return false;
         }
-    }
-
-    vector<bool> maskVec;
-    Vector3dVec cloud;
-    cameraPtr->reconstructPointCloud( result.imagePointVec, cloud, maskVec );
-    result.cloud.reserve((reconstFlags & MINMAX) ? 2 * cloud.size() : cloud.size());
-    for (int i = 0; i < cloud.size(); i++)
+        return true;
+    };
+
+    // First pass counts the output entries of each chunk of queries, 
+    // the second one writes them at their final position
+    const int CHUNK_SIZE = 1024;
+    const int numQueries = queryIdxVec.size();
+    const int numChunks = (numQueries + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    vector<int> & chunkOffsetVec = result.chunkOffsetBuffer;
+    chunkOffsetVec.assign(numChunks + 1, 0);
+    parallelFor(0, numChunks, [&](int chunkBegin, int chunkEnd)
     {
-        if (maskVec[i])
+        double depth, sigma;
+        for (int chunk = chunkBegin; chunk < chunkEnd; chunk++)
         {
-            if (reconstFlags & MINMAX)
+            const int iEnd = min(numQueries, (chunk + 1) * CHUNK_SIZE);
+            int count = 0;
+            for (int i = chunk * CHUNK_SIZE; i < iEnd; i++)
             {
-                result.cloud.push_back(cloud[i].normalized() * depthVec[2*i]);
-                result.cloud.push_back(cloud[i].normalized() * depthVec[2*i + 1]);
-            }
-            else
-            {
-                result.cloud.push_back(cloud[i].normalized() * depthVec[i]);
+                const int queryIdx = queryIdxVec[i];
+                if (queryIdx < 0 or queryIdx >= hStep) continue;
+                for (int h = 0; h < numHyps; h++)
+                {
+                    count += getHypothesis(queryIdx, h, depth, sigma);
+                }
             }
+            chunkOffsetVec[chunk + 1] = count;
         }
-        else
+    });
+    for (int chunk = 0; chunk < numChunks; chunk++)
+    {
+        chunkOffsetVec[chunk + 1] += chunkOffsetVec[chunk];
+    }
+    
+    const int numEntries = chunkOffsetVec[numChunks];
+    result.idxVec.resize(numEntries);
+    result.hypIdxVec.resize(numEntries);
+    result.imagePointVec.resize(numEntries);
+    result.sigmaVec.resize((reconstFlags & SIGMA_VALUE) ? numEntries : 0);
+    result.idxMapVec.resize((reconstFlags & INDEX_MAPPING) ? numEntries : 0);
+    result.cloud.resize(numCloudPoints * numEntries);
+    result.valVec.clear();
+//result.datatype = (minmax_flag) ? MHPack::MINMAX_DISTANCE_VEC_WITH_SIGN : MHPack::RECONSTRUCTION_WITH_SIGMA;
+
+    parallelFor(0, numChunks, [&](int chunkBegin, int chunkEnd)
+    {
+        double depth, sigma;
+        for (int chunk = chunkBegin; chunk < chunkEnd; chunk++)
         {
-            //FIXME make all data in MHPack valid
-            //that is discard all non-reconstructed points and other data associated to them
-            if (reconstFlags & MINMAX)
-            {
-                result.cloud.emplace_back(0, 0, 0);
-                result.cloud.emplace_back(0, 0, 0);
-            }
-            else
+            const int iEnd = min(numQueries, (chunk + 1) * CHUNK_SIZE);
+            int k = chunkOffsetVec[chunk];
+            for (int i = chunk * CHUNK_SIZE; i < iEnd; i++)
             {
-                result.cloud.emplace_back(0, 0, 0);
+                const int queryIdx = queryIdxVec[i];
+                if (queryIdx < 0 or queryIdx >= hStep) continue;
+                Vector2d queryPoint;
+                Vector3d bearing;
+                bool bearingReady = false;
+                for (int h = 0; h < numHyps; h++)
+                {
+                    if (not getHypothesis(queryIdx, h, depth, sigma)) continue;
+                    if (not bearingReady)
+                    {
+                        if (queryPoints)
+                        {
+                            queryPoint = queryPointVec[i];
+                            if (cameraPtr->reconstructPoint(queryPoint, bearing)) bearing.normalize();
+                            else bearing.setZero(); //FIXME make all data in MHPack valid
+                        }
+                        else
+                        {
+                            queryPoint = Vector2d(uConv(queryIdx % xMax), vConv(queryIdx / xMax));
+                            bearing = (*bearingVecPtr)[queryIdx];
+                        }
+                        bearingReady = true;
+                    }
+                    
+                    if (reconstFlags & MINMAX) 
+                    {
+                        result.cloud[2*k] = bearing * max(depth - 3*sigma, MIN_DEPTH);
+                        result.cloud[2*k + 1] = bearing * (depth + 3*sigma);
+                    }
+                    else
+                    {
+                        result.cloud[k] = bearing * depth;
+                    }
+                    if (reconstFlags & SIGMA_VALUE) result.sigmaVec[k] = sigma;
+                    if (reconstFlags & INDEX_MAPPING) result.idxMapVec[k] = i;
+                    result.idxVec[k] = queryIdx;
+                    result.hypIdxVec[k] = h;
+                    result.imagePointVec[k] = queryPoint;
+                    k++;
+                }
             }
         }
-    }
+    });
 }
 
 
@@ -719,42 +801,80 @@ void DepthMap::wrapDepth(const DepthMap& dMap1, const DepthMap& dMap2,
 	}
 }
 
+namespace
+{
+inline void atomicMin(std::atomic<uint64_t> & target, const uint64_t val)
+{
+    uint64_t current = target.load(std::memory_order_relaxed);
+    while (val < current and not target.compare_exchange_weak(current, val, std::memory_order_relaxed));
+}
+}
+
 //TODO - Add support to insert multiple hypotheses into output depthmap
-DepthMap DepthMap::wrapDepth(const Transformation<double> T12) const
+DepthMap DepthMap::wrapDepth(const Transformation<double> T12, const int splatRadius) const
 {
+    std::shared_ptr<const Vector3dVec> bearingVecPtr = getBearingVec();
+    const Vector3dVec & bearingVec = *bearingVecPtr;
     DepthMap dMap2(cameraPtr, *this);
-
-    // Get point-cloud of current frame
-    MHPack cloud11MH;
-    reconstruct(cloud11MH, 0);
-
-    // Transform cloud into keyframe
-    Vector3dVec cloud12;
-    T12.inverseTransform(cloud11MH.cloud, cloud12);
-
-    // Project point cloud on keyframe
-    Vector2dVec point12Vec;
-    cameraPtr->projectPointCloud(cloud12, point12Vec);
-
-    // Fill in data for depthmap
-    vector<int> idx12Vec = getIdxVec(point12Vec);
-    for (int i = 0; i < idx12Vec.size(); i++)
+    std::atomic_store(&dMap2.bearingPtr, std::atomic_load(&bearingPtr)); // same camera and scale
+    
+    const Matrix3d R21 = T12.rotMatInv();
+    const Vector3d t12 = T12.trans();
+    
+    // the point idx1 in the second frame
+    auto warpPoint = [&](const int idx1) -> Vector3d
     {
-        const int idx2 = idx12Vec[i];
-        const int idx1 = cloud11MH.idxVec[i];
-        if(idx2 != -1) //TODO figure out why not equivalent to isValid(...)
+        const Vector3d X1 = bearingVec[idx1] * valVec[idx1];
+        return R21 * (X1 - t12);
+    };
+    
+    // The z-buffer key holds the float distance in the high bits and the source index in the low bits.
+    // Positive floats are ordered as their bit patterns, so the atomic minimum picks the nearest point,
+    // the lower index wins the ties as in the sequential version
+    const uint64_t EMPTY_KEY = std::numeric_limits<uint64_t>::max();
+    vector<std::atomic<uint64_t>> zBuffer(hStep);
+    for (auto & key : zBuffer) key.store(EMPTY_KEY, std::memory_order_relaxed);
+    
+    parallelFor(0, yMax, [&](int yBegin, int yEnd)
+    {
+        for (int idx1 = yBegin * xMax; idx1 < yEnd * xMax; idx1++)
         {
-            const double depthNew = cloud12[i].norm();
-            double & depthOld = dMap2.at(idx2);
-            if (depthOld == OUT_OF_RANGE or depthNew < depthOld)
+            if (valVec[idx1] < MIN_DEPTH or bearingVec[idx1].squaredNorm() == 0) continue;
+            const Vector3d X2 = warpPoint(idx1);
+            Vector2d pt;
+            if (not cameraPtr->projectPoint(X2, pt)) continue;
+            const int x2 = xConv(pt[0]);
+            const int y2 = yConv(pt[1]);
+            if (not isValid(x2, y2)) continue;
+            
+            const float dist = X2.norm();
+            uint32_t distBits;
+            memcpy(&distBits, &dist, sizeof(distBits));
+            const uint64_t key = (uint64_t(distBits) << 32) | uint32_t(idx1);
+            for (int y = max(y2 - splatRadius, 0); y <= min(y2 + splatRadius, yMax - 1); y++)
             {
-                const double dist = cloud12[i].norm();
-                dMap2.at(idx2) = dist;
-                dMap2.sigma(idx2) = sigma(idx1) + 0.005*dist;
-                dMap2.cost(idx2) = cost(idx1);
+                for (int x = max(x2 - splatRadius, 0); x <= min(x2 + splatRadius, xMax - 1); x++)
+                {
+                    atomicMin(zBuffer[x + y * xMax], key);
+                }
             }
         }
-    }
+    });
+    
+    // Fill in data for depthmap
+    parallelFor(0, yMax, [&](int yBegin, int yEnd)
+    {
+        for (int idx2 = yBegin * xMax; idx2 < yEnd * xMax; idx2++)
+        {
+            const uint64_t key = zBuffer[idx2].load(std::memory_order_relaxed);
+            if (key == EMPTY_KEY) continue;
+            const int idx1 = key & 0xffffffff;
+            const double dist = warpPoint(idx1).norm();
+            dMap2.at(idx2) = dist;
+            dMap2.sigma(idx2) = sigma(idx1) + 0.005*dist;
+            dMap2.cost(idx2) = cost(idx1);
+        }
+    });
 
     return dMap2;
 }
@@ -863,54 +983,141 @@ void DepthMap::pixelAverageFilter(const Vector3iVec & matches, DepthMap & dst)
     dst.sigma(base[0], base[1], base[2]) = sum_s / matches.size();
 }
 
+namespace
+{
+// consistency test of one neighbor in filterNoise
+inline void accumulateNeighbor(const double depthVal, const double sigmaVal,
+        const double neighDepthVal, const double neighSigmaVal,
+        double & countFilled, double & countMatches, double & acc)
+{
+    const double err = abs(depthVal - neighDepthVal);
+    const bool filled = neighDepthVal != OUT_OF_RANGE;
+    const bool matched = filled & not (err > sigmaVal) & not (err > 3*neighSigmaVal);
+    countFilled += filled ? 1. : 0.;
+    countMatches += matched ? 1. : 0.;
+    acc += matched ? neighDepthVal : 0.;
+}
+
+// One row of filterNoise
+// up, mid and down hold the original values of the rows y - 1, y and y + 1
+// the neighbors are visited in the same order as before to keep the accumulation bit-identical
+void filterNoiseRow(const double * __restrict upDepth, const double * __restrict upSigma,
+        const double * __restrict midDepth, const double * __restrict midSigma,
+        const double * __restrict downDepth, const double * __restrict downSigma,
+        double * __restrict outDepth, double * __restrict outSigma, const int width)
+{
+    const double minMatches = 2;
+    const double CENTRAL_WEIGHT = 5;
+    for (int x = 1; x < width - 1; x++)
+    {
+        const double depthVal = midDepth[x];
+        const double sigmaVal = midSigma[x];
+        double countFilled = 0, countMatches = 0; // small integers, exact in double
+        double acc = depthVal * CENTRAL_WEIGHT;
+        accumulateNeighbor(depthVal, sigmaVal, downDepth[x - 1], downSigma[x - 1], countFilled, countMatches, acc);
+        accumulateNeighbor(depthVal, sigmaVal, downDepth[x], downSigma[x], countFilled, countMatches, acc);
+        accumulateNeighbor(depthVal, sigmaVal, downDepth[x + 1], downSigma[x + 1], countFilled, countMatches, acc);
+        accumulateNeighbor(depthVal, sigmaVal, midDepth[x + 1], midSigma[x + 1], countFilled, countMatches, acc);
+        accumulateNeighbor(depthVal, sigmaVal, upDepth[x + 1], upSigma[x + 1], countFilled, countMatches, acc);
+        accumulateNeighbor(depthVal, sigmaVal, upDepth[x], upSigma[x], countFilled, countMatches, acc);
+        accumulateNeighbor(depthVal, sigmaVal, upDepth[x - 1], upSigma[x - 1], countFilled, countMatches, acc);
+        accumulateNeighbor(depthVal, sigmaVal, midDepth[x - 1], midSigma[x - 1], countFilled, countMatches, acc);
+        // bitwise logic and an unconditional division avoid data-dependent branches
+        const bool valid = depthVal != OUT_OF_RANGE;
+        const bool reject = ((countMatches < minMatches) & (countMatches < countFilled)) | (countFilled < 2);
+        const double average = acc / (countMatches + CENTRAL_WEIGHT);
+        outDepth[x] = valid ? (reject ? OUT_OF_RANGE : average) : depthVal;
+        outSigma[x] = (valid & reject) ? OUT_OF_RANGE : sigmaVal;
+    }
+}
+
+// One row of merge, the inverse-variance update is the same as in filter()
+void mergeRow(const double * __restrict newDepth, const double * __restrict newSigma,
+        double * __restrict depth, double * __restrict sigma, const int width,
+        DepthFusionStats & stats)
+{
+    for (int x = 0; x < width; x++)
+    {
+        const double d2 = newDepth[x];
+        const double s2 = newSigma[x];
+        const double d = depth[x];
+        const double s = sigma[x];
+        const double K = 1. / (s + s2);
+        const double dFused = (d * s2 + d2 * s) * K;
+        const double sFused = max(s * s2 * K, 0.05 * dFused);
+        
+        const bool valid = not (d2 < MIN_DEPTH) & (d2 != OUT_OF_RANGE);
+        const bool empty = d == OUT_OF_RANGE;
+        const bool consistent = abs(d - d2) < 2*(s + s2);
+        const bool closer = d2 < d;
+        const bool insert = valid & (empty | (not consistent & closer));
+        const bool fuse = valid & not empty & consistent;
+        depth[x] = insert ? d2 : (fuse ? dFused : d);
+        sigma[x] = insert ? s2 : (fuse ? sFused : s);
+        
+        stats.inserted += valid & empty;
+        stats.fused += fuse;
+        stats.replaced += valid & not empty & not consistent & closer;
+        stats.discarded += valid & not empty & not consistent & not closer;
+    }
+}
+}
+
 //works only for the first hypothesis so far
 //TODO implement for multi-hyp case
 void DepthMap::filterNoise()
 {
-    const int minMatches = 2;
-
-    // Create copy of current depthmap, to avoid flow
-    DepthMap myCopy = *this;
-
-    const array<int, 8> dxArr =  {-1,  0,  1,  1,  1,  0, -1, -1};
-    const array<int, 8> dyArr  = { 1,  1,  1,  0, -1, -1, -1,  0};
+    if (xMax < 3 or yMax < 3) return;
     
-    const int CENTRAL_WEIGHT = 5;
-    // Three loops to loop through every hypothesis
-    for (int y = 1; y < yMax - 1; ++y)
+    // The rows are processed in parallel bands.
+    // Inside a band a two-row buffer keeps the original values of the previous and the current rows,
+    // the rows right above and below the band are saved beforehand since the other bands overwrite them
+    const int BAND_HEIGHT = 32;
+    const int numBands = (yMax - 2 + BAND_HEIGHT - 1) / BAND_HEIGHT;
+    auto bandBegin = [&](int band) { return 1 + band * BAND_HEIGHT; };
+    auto bandEnd = [&](int band) { return min(1 + (band + 1) * BAND_HEIGHT, yMax - 1); };
+    
+    // depth above, sigma above, depth below, sigma below
+    vector<double> borderVec(4 * xMax * numBands);
+    for (int band = 0; band < numBands; band++)
     {
-        for (int x = 1; x < xMax - 1; ++x)
+        double * border = borderVec.data() + 4 * xMax * band;
+        const int yAbove = bandBegin(band) - 1;
+        const int yBelow = bandEnd(band);
+        copy(valVec.begin() + yAbove * xMax, valVec.begin() + (yAbove + 1) * xMax, border);
+        copy(sigmaVec.begin() + yAbove * xMax, sigmaVec.begin() + (yAbove + 1) * xMax, border + xMax);
+        copy(valVec.begin() + yBelow * xMax, valVec.begin() + (yBelow + 1) * xMax, border + 2 * xMax);
+        copy(sigmaVec.begin() + yBelow * xMax, sigmaVec.begin() + (yBelow + 1) * xMax, border + 3 * xMax);
+    }
+    
+    parallelFor(0, numBands, [&](int begin, int end)
+    {
+        vector<double> rowBuffer(4 * xMax);
+        for (int band = begin; band < end; band++)
         {
-            double depthVal = myCopy.at(x, y);
-            if (depthVal == OUT_OF_RANGE) continue;
-            double sigmaVal = myCopy.sigma(x, y);
-            int countFilled = 0, countMatches = 0;
-            double acc = depthVal * CENTRAL_WEIGHT;
-            for (int i = 0; i < 8; i++)
-            {
-                int x2 = x + dxArr[i];
-                int y2 = y + dyArr[i];
-                double neighDepthVal = myCopy.at(x2, y2);
-//                double neighSigmaVal = myCopy.sigma(x + dxArr[i], y + dyArr[i]);
-                if (neighDepthVal == OUT_OF_RANGE) continue;
-                countFilled++;
-                double err = abs(depthVal - neighDepthVal);
-                if (err > sigmaVal or err > 3*myCopy.sigma(x2, y2)) continue;
-                countMatches++;
-                acc += neighDepthVal;
-            }
-            if (countMatches < minMatches and countMatches < countFilled or countFilled < 2)
-            {
-                at(x, y) = OUT_OF_RANGE;
-                sigma(x, y) = OUT_OF_RANGE;
-            }
-            else
+            const double * border = borderVec.data() + 4 * xMax * band;
+            double * prevDepth = rowBuffer.data();
+            double * prevSigma = prevDepth + xMax;
+            double * curDepth = prevSigma + xMax;
+            double * curSigma = curDepth + xMax;
+            copy(border, border + 2 * xMax, prevDepth);
+            const int y1 = bandEnd(band);
+            for (int y = bandBegin(band); y < y1; y++)
             {
-                at(x, y) = acc / (countMatches + CENTRAL_WEIGHT);
+                double * depthRow = valVec.data() + y * xMax;
+                double * sigmaRow = sigmaVec.data() + y * xMax;
+                copy(depthRow, depthRow + xMax, curDepth);
+                copy(sigmaRow, sigmaRow + xMax, curSigma);
+                const bool lastRow = (y + 1 == y1);
+                const double * nextDepth = lastRow ? border + 2 * xMax : depthRow + xMax;
+                const double * nextSigma = lastRow ? border + 3 * xMax : sigmaRow + xMax;
+                filterNoiseRow(prevDepth, prevSigma, curDepth, curSigma, nextDepth, nextSigma,
+                        depthRow, sigmaRow, xMax);
+                std::swap(prevDepth, curDepth);
+                std::swap(prevSigma, curSigma);
             }
         }
-    }
-
+    });
 }
 
 //TODO remove multihyp thing
@@ -919,42 +1126,66 @@ void DepthMap::merge(const DepthMap & depth2)
     assert((ScaleParameters)(*this) == (ScaleParameters)depth2);
 
     // Filter merge all new hypotheses
-    for (int y = 0; y < yMax; y++)
+    parallelFor(0, yMax, [&](int yBegin, int yEnd)
     {
-        for (int x = 0; x < xMax; x++)
+        DepthFusionStats stats;
+        for (int y = yBegin; y < yEnd; y++)
         {
-            const double d2 = depth2.at(x, y);
-            if (d2 < MIN_DEPTH or d2 == OUT_OF_RANGE) continue;
-            const double s2 = depth2.sigma(x, y);
-            
-            double & d = at(x, y);
-            double & s = sigma(x, y);
-            if (d == OUT_OF_RANGE)
+            mergeRow(depth2.valVec.data() + y * xMax, depth2.sigmaVec.data() + y * xMax,
+                    valVec.data() + y * xMax, sigmaVec.data() + y * xMax, xMax, stats);
+        }
+    });
+
+    // Remove bad hypotheses
+//    costRejection();
+}
+
+DepthFusionStats DepthMap::fuse(const DepthMap & depth2)
+{
+    assert((ScaleParameters)(*this) == (ScaleParameters)depth2);
+    
+    vector<DepthFusionStats> rowStatsVec(yMax);
+    parallelFor(0, yMax, [&](int yBegin, int yEnd)
+    {
+        // the noise-filtered row of depth2
+        vector<double> rowBuffer(2 * xMax);
+        double * filteredDepth = rowBuffer.data();
+        double * filteredSigma = filteredDepth + xMax;
+        for (int y = yBegin; y < yEnd; y++)
+        {
+            const double * depthRow2 = depth2.valVec.data() + y * xMax;
+            const double * sigmaRow2 = depth2.sigmaVec.data() + y * xMax;
+            copy(depthRow2, depthRow2 + xMax, filteredDepth);
+            copy(sigmaRow2, sigmaRow2 + xMax, filteredSigma);
+            // filterNoise leaves the border untouched
+            if (y > 0 and y < yMax - 1 and xMax > 2)
             {
-                d = d2;
-                s = s2;
+                filterNoiseRow(depthRow2 - xMax, sigmaRow2 - xMax, depthRow2, sigmaRow2,
+                        depthRow2 + xMax, sigmaRow2 + xMax, filteredDepth, filteredSigma, xMax);
             }
-            else
+            
+            DepthFusionStats & stats = rowStatsVec[y];
+            for (int x = 0; x < xMax; x++)
             {
-                const double delta = abs(d - d2);
-                if (delta < 2*(s + s2))
-                {
-                    filter(d, s, d2, s2);
-                }
-                else if (d2 < d)
-                {
-                    d = d2;
-                    s = s2;
-                }
+                stats.newValid += depthRow2[x] != OUT_OF_RANGE;
+                stats.noiseRejected += (depthRow2[x] != OUT_OF_RANGE) & (filteredDepth[x] == OUT_OF_RANGE);
             }
-            
-            //TODO check the function
-//            filterPushHypothesis(x, y, d2, sigma2);
+            mergeRow(filteredDepth, filteredSigma, valVec.data() + y * xMax, 
+                    sigmaVec.data() + y * xMax, xMax, stats);
         }
+    });
+    
+    DepthFusionStats stats;
+    for (auto & rowStats : rowStatsVec)
+    {
+        stats.newValid += rowStats.newValid;
+        stats.noiseRejected += rowStats.noiseRejected;
+        stats.inserted += rowStats.inserted;
+        stats.fused += rowStats.fused;
+        stats.replaced += rowStats.replaced;
+        stats.discarded += rowStats.discarded;
     }
-
-    // Remove bad hypotheses
-//    costRejection();
+    return stats;
 }
 
 void DepthMap::regularize()
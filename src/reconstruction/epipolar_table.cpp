@@ -0,0 +1,229 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Precomputed rasterization of the epipolar curves
+*/
+
+#include "reconstruction/epipolar_table.h"
+
+#include "std.h"
+#include "eigen.h"
+
+namespace
+{
+    // a longer jump between two consecutive samples is a discontinuity of the projection
+    const int MAX_GAP = 16;
+    
+    // the visibility is first checked on every COARSE_STEP-th sample,
+    // with a margin in pixels to catch the curves that only cut an image corner
+    const int COARSE_STEP = 16;
+    const int COARSE_MARGIN = 32;
+}
+
+EpipolarTable::EpipolarTable(const EnhancedCamera * camera2, const int uMax, const int vMax) :
+    _camera(camera2),
+    _curves(NULL),
+    _uMax(uMax),
+    _vMax(vMax)
+{
+    const double * params = camera2->getParams();
+    const double fMax = max(abs(params[2]), abs(params[3]));
+    _sampleCount = ceil(4 * M_PI * fMax / COARSE_STEP) * COARSE_STEP;
+    _angleVec.resize(_sampleCount);
+    _cosVec.resize(_sampleCount);
+    _sinVec.resize(_sampleCount);
+    for (int i = 0; i < _sampleCount; i++)
+    {
+        _angleVec[i] = -M_PI + i * 2 * M_PI / _sampleCount;
+        _cosVec[i] = cos(_angleVec[i]);
+        _sinVec[i] = sin(_angleVec[i]);
+    }
+}
+
+void EpipolarTable::setTransformation(const EnhancedEpipolar & curves, const Transf & T12)
+{
+    _curves = &curves;
+    _R21 = T12.rotMatInv();
+    _epipoleDir = _R21 * curves.baseDirection();
+    _sequenceVec.assign(curves.planeCount(), EpipolarSequence());
+}
+
+double EpipolarTable::angle(const int planeIdx, const Vector3d & X2) const
+{
+    const Vector3d planeDir = (_R21 * _curves->planeDirection(planeIdx)).normalized();
+    return atan2(X2.dot(planeDir), X2.dot(_epipoleDir));
+}
+
+const EpipolarSequence & EpipolarTable::sequence(const int planeIdx) const
+{
+    EpipolarSequence & seq = _sequenceVec[planeIdx];
+    if (not seq.ready) rasterize(planeIdx, seq);
+    return seq;
+}
+
+void EpipolarTable::rasterize(const int planeIdx, EpipolarSequence & seq) const
+{
+    const Vector3d planeDir = (_R21 * _curves->planeDirection(planeIdx)).normalized();
+    seq.uVec.clear();
+    seq.vVec.clear();
+    seq.angleVec.clear();
+    auto push = [&seq](int u, int v, double a)
+    {
+        // like CurveRasterizer, every step moves along the dominant direction,
+        // a pixel adjacent to both its neighbors is dropped
+        const int size = seq.uVec.size();
+        if (u >= 0 and size > 1 and seq.uVec[size - 1] >= 0 and seq.uVec[size - 2] >= 0 and
+                abs(u - seq.uVec[size - 2]) <= 1 and abs(v - seq.vVec[size - 2]) <= 1)
+        {
+            seq.uVec.pop_back();
+            seq.vVec.pop_back();
+            seq.angleVec.pop_back();
+        }
+        seq.uVec.push_back(u);
+        seq.vVec.push_back(v);
+        seq.angleVec.push_back(a);
+    };
+    
+    // connects the last pixel to (u, v) by a straight segment, (u, v) included
+    auto connect = [&seq, &push](int u, int v, double a)
+    {
+        const int uLast = seq.uVec.back();
+        const int vLast = seq.vVec.back();
+        const double aLast = seq.angleVec.back();
+        const int n = max(abs(u - uLast), abs(v - vLast));
+        for (int k = 1; k <= n; k++)
+        {
+            push(uLast + round(double(u - uLast) * k / n), vLast + round(double(v - vLast) * k / n),
+                    aLast + (a - aLast) * k / n);
+        }
+    };
+    
+    const int coarseCount = _sampleCount / COARSE_STEP;
+    vector<bool> coarseVisibleVec(coarseCount + 1);
+    for (int j = 0; j < coarseCount; j++)
+    {
+        const int i = j * COARSE_STEP;
+        Vector2d pt;
+        coarseVisibleVec[j] = _camera->projectPoint(_cosVec[i] * _epipoleDir + _sinVec[i] * planeDir, pt) and
+                pt[0] >= -COARSE_MARGIN and pt[0] < _uMax + COARSE_MARGIN and
+                pt[1] >= -COARSE_MARGIN and pt[1] < _vMax + COARSE_MARGIN;
+    }
+    coarseVisibleVec[coarseCount] = coarseVisibleVec[0];
+    
+    // the last entry is a pixel, not a gap
+    bool lastVisible = false;
+    // the last visible pixel before a gap
+    int uExit = -1, vExit = -1;
+    for (int i = 0; i < _sampleCount; i++)
+    {
+        const double a = _angleVec[i];
+        const int j = i / COARSE_STEP;
+        Vector2d pt;
+        int u = -1, v = -1;
+        bool visible = coarseVisibleVec[j] or coarseVisibleVec[j + 1];
+        if (visible)
+        {
+            visible = _camera->projectPoint(_cosVec[i] * _epipoleDir + _sinVec[i] * planeDir, pt);
+        }
+        if (visible)
+        {
+            u = round(pt[0]);
+            v = round(pt[1]);
+            visible = u >= 0 and u < _uMax and v >= 0 and v < _vMax;
+        }
+        if (not visible)
+        {
+            if (lastVisible)
+            {
+                uExit = seq.uVec.back();
+                vExit = seq.vVec.back();
+            }
+            if (lastVisible or seq.uVec.empty()) push(-1, -1, a);
+            lastVisible = false;
+        }
+        else if (not lastVisible)
+        {
+            // a curve which leaves the image for a few pixels only keeps its length,
+            // so that the steps along it still match the disparities
+            if (uExit >= 0)
+            {
+                const int n = max(abs(u - uExit), abs(v - vExit));
+                for (int k = 2; k < n and n <= MAX_GAP; k++) push(-1, -1, seq.angleVec.back());
+            }
+            push(u, v, a);
+            lastVisible = true;
+        }
+        else if (max(abs(u - seq.uVec.back()), abs(v - seq.vVec.back())) > MAX_GAP)
+        {
+            push(-1, -1, a);
+            push(u, v, a);
+        }
+        else
+        {
+            connect(u, v, a);
+        }
+    }
+    
+    // close the loop through the angle pi if the curve is visible there
+    seq.closed = false;
+    if (seq.uVec.size() > 2 and seq.uVec.front() >= 0 and lastVisible)
+    {
+        const int n = max(abs(seq.uVec.front() - seq.uVec.back()),
+                abs(seq.vVec.front() - seq.vVec.back()));
+        if (n <= MAX_GAP)
+        {
+            connect(seq.uVec.front(), seq.vVec.front(), seq.angleVec.front() + 2 * M_PI);
+            // the front pixel must not repeat at the end
+            seq.uVec.pop_back();
+            seq.vVec.pop_back();
+            seq.angleVec.pop_back();
+            seq.closed = true;
+        }
+    }
+    seq.ready = true;
+}
+
+EpipolarRaster EpipolarTable::raster(const Vector3d & X1, const Vector3d & X2) const
+{
+    // the last plane index is the first plane
+    int planeIdx = _curves->planeIndex(X1);
+    if (planeIdx >= _curves->planeCount()) planeIdx = 0;
+    const EpipolarSequence & seq = sequence(planeIdx);
+    if (seq.angleVec.empty()) return EpipolarRaster();
+    
+    // the closest sample
+    const double a = angle(planeIdx, X2);
+    const int size = seq.angleVec.size();
+    int idx = lower_bound(seq.angleVec.begin(), seq.angleVec.end(), a) - seq.angleVec.begin();
+    if (idx == size) idx--;
+    else if (idx > 0 and a - seq.angleVec[idx - 1] < seq.angleVec[idx] - a) idx--;
+    if (seq.uVec[idx] < 0) return EpipolarRaster();
+    
+    // the epipole is at the angle 0
+    const int eps = a > 0 ? -1 : 1;
+    Vector2d pt;
+    if (not _camera->projectPoint(X2, pt)) return EpipolarRaster();
+    const int dist = round(max(abs(pt[0] - seq.uVec[idx]), abs(pt[1] - seq.vVec[idx])));
+    if (dist <= 1) return EpipolarRaster(&seq, idx, eps);
+    
+    // the starting point is out of the image, the closest sample is where the curve enters it
+    // the raster starts as many steps away to keep the distance along the curve
+    const int dir = abs(seq.angleVec[idx]) < abs(a) ? eps : -eps;
+    return EpipolarRaster(&seq, idx - dir * dist, eps, idx, -dir);
+}
+
@@ -61,18 +61,7 @@ void EnhancedEpipolar::initialize()
     Vector3dVec directionVec;
     for (int idx = 0; idx < nSteps; idx++)
     {
-        if (idx < nSteps/2)
-        {
-            //tangent part
-            double s = step * idx - 1;
-            directionVec.emplace_back(xBase + s*yBase);
-        }
-        else
-        {
-            //cotangent part
-            double c = step * (-idx + nSteps/2) + 1;
-            directionVec.emplace_back(c * xBase + yBase);
-        }
+        directionVec.emplace_back(planeDirection(idx));
     }
     
     // ## camera 1 ##
@@ -109,6 +98,22 @@ void EnhancedEpipolar::initialize()
 }
 
 
+Vector3d EnhancedEpipolar::planeDirection(int idx) const
+{
+    if (idx < nSteps/2)
+    {
+        //tangent part
+        double s = step * idx - 1;
+        return xBase + s*yBase;
+    }
+    else
+    {
+        //cotangent part
+        double c = step * (-idx + nSteps/2) + 1;
+        return c * xBase + yBase;
+    }
+}
+
 int EnhancedEpipolar::index(Vector3d X) const
 {
     double c = X.dot(xBase);
@@ -32,6 +32,8 @@ Depth-from-motion class for semidense depth estimation
 #include "reconstruction/stereo_misc.h"
 #include "reconstruction/eucm_epipolar.h"
 #include "utils/curve_rasterizer.h"
+#include "utils/curve_sampler.h"
+#include "utils/profiler.h"
 #include "reconstruction/depth_map.h"
 #include "reconstruction/epipolar_descriptor.h"
 
@@ -125,21 +127,11 @@ bool MotionStereo::computeUncertainty(double d, double s)
     return true;
 }
 
-bool MotionStereo::sampleImage(const Mat8u & img2)
+template<class Raster>
+bool MotionStereo::sampleCurve(Raster & raster, const Mat8u & img2)
 {
-    uint32_t neededFlag = GLB_START_POINT | GLB_DISP_MAX | GLB_STEP | GLB_X;
-    assert(flags & neededFlag == neededFlag);
-    
     int distance = gdispMax / gstep + MARGIN;
     
-    CurveRasterizer<int, Polynomial2> raster(gptStartRound, gptFinRound,
-                                _epipolarCurves.get(CAMERA_2, gX));
-    if (flags & GLB_INVERTED_SAMPLING)
-    {
-        raster.setStep(-1);
-    }
-    //Important : Epipolar curves are accessed by the reconstructed point in the FIRST frame
-                                
     raster.setStep(gstep);
     raster.steps(-HALF_LENGTH);
     
@@ -166,116 +158,143 @@ bool MotionStereo::sampleImage(const Mat8u & img2)
     return true;
 }
 
-void MotionStereo::reconstruct(double & dist, double & sigma, double & cost)
+bool MotionStereo::sampleCurveSubpixel(const Mat8u & img2)
 {
-    uint32_t neededFlag = GLB_SAMPLE_VEC | GLB_UV | GLB_UV_VEC | GLB_DESCRIPTOR;
+    const int K = _params.subpixelSamples;
+    const int distance = (gdispMax / gstep + MARGIN) * K;
+    
+    //starts at the exact projection, not at the rounded one
+    CurveSampler<Polynomial2> sampler(gptStart, gptFinRound.cast<double>(),
+                                _epipolarCurves.get(CAMERA_2, gX), 1. / K);
+    if (flags & GLB_INVERTED_SAMPLING)
+    {
+        sampler.setStep(-1);
+    }
+    sampler.setStep(gstep);
+    sampler.steps(-HALF_LENGTH * K);
+    
+    BilinearSampler interpolator(img2);
+    guVec.resize(distance);
+    gvVec.resize(distance);
+    gsampleVec.resize(distance);
+    for (int d = 0; d < distance; d++, sampler.step())
+    {
+        if (not interpolator.inside(sampler.u, sampler.v)) return false;
+        gsampleVec[d] = interpolator(sampler.u, sampler.v);
+        guVec[d] = sampler.u;
+        gvVec[d] = sampler.v;
+    }
+    flags |= GLB_SAMPLE_VEC | GLB_UV_VEC;
+    return true;
+}
+
+bool MotionStereo::sampleImage(const Mat8u & img2)
+{
+    uint32_t neededFlag = GLB_START_POINT | GLB_DISP_MAX | GLB_STEP | GLB_X;
     assert(flags & neededFlag == neededFlag);
     
-    vector<int> costVec = compareDescriptor(gdescriptor, gsampleVec, _params.flawCost);
-    auto bestCostIter = min_element(costVec.begin() + HALF_LENGTH, costVec.end() - HALF_LENGTH);
+    if (_params.subpixelSamples > 1)
+    {
+        return sampleCurveSubpixel(img2);
+    }
     
+    CurveRasterizer<int, Polynomial2> raster(gptStartRound, gptFinRound,
+                                _epipolarCurves.get(CAMERA_2, gX));
+    if (flags & GLB_INVERTED_SAMPLING)
+    {
+        raster.setStep(-1);
+    }
+    //Important : Epipolar curves are accessed by the reconstructed point in the FIRST frame
+    return sampleCurve(raster, img2);
+}
+
+void MotionStereo::match(const int depthIdx, const double cost)
+{
+    uint32_t neededFlag = GLB_SAMPLE_VEC | GLB_UV | GLB_UV_VEC | GLB_DESCRIPTOR;
+    assert(flags & neededFlag == neededFlag);
     
+    //the descriptor step is K samples, every sub-pixel phase is matched separately
+    const int K = _params.subpixelSamples;
+    vector<int> costVec;
+    if (K == 1)
+    {
+        costVec = compareDescriptor(gdescriptor, gsampleVec, _params.flawCost);
+    }
+    else
+    {
+        costVec.resize(gsampleVec.size());
+        vector<uint8_t> phaseVec(gsampleVec.size() / K);
+        for (int r = 0; r < K; r++)
+        {
+            for (int j = 0; j < phaseVec.size(); j++) phaseVec[j] = gsampleVec[j * K + r];
+            vector<int> phaseCostVec = compareDescriptor(gdescriptor, phaseVec, _params.flawCost);
+            for (int j = 0; j < phaseVec.size(); j++) costVec[j * K + r] = phaseCostVec[j];
+        }
+    }
+    auto bestCostIter = min_element(costVec.begin() + HALF_LENGTH * K,
+                                    costVec.end() - HALF_LENGTH * K);
     
     if ( *bestCostIter < _params.maxError and *bestCostIter < 2*cost)
     {
         int dBest = bestCostIter - costVec.begin();
-//        cout << setw(8) << dBest;
-        double distNew, sigmaNew;
-        triangulate(Vector2d(gu, gv),
-                    Vector2d(gu2, gv2),
-                    Vector2d(guVec[dBest], gvVec[dBest]), 
-                    Vector2d(guVec[dBest + 1], gvVec[dBest + 1]),
-                    distNew, sigmaNew); 
-        
+        //the second point is one descriptor step further, like (gu2, gv2)
+        _pt11Vec.emplace_back(gu, gv);
+        _pt12Vec.emplace_back(gu2, gv2);
+        _pt21Vec.emplace_back(guVec[dBest], gvVec[dBest]);
+        _pt22Vec.emplace_back(guVec[dBest + K], gvVec[dBest + K]);
+        _matchIdxVec.push_back(depthIdx);
+        _matchCostVec.push_back(*bestCostIter);
+    }
+}
+
+void MotionStereo::reconstructMatches(DepthMap & depth)
+{
+    vector<double> distNewVec, sigmaNewVec;
+    triangulate(_pt11Vec, _pt12Vec, _pt21Vec, _pt22Vec, distNewVec, sigmaNewVec);
+    for (int i = 0; i < _matchIdxVec.size(); i++)
+    {
+        //the points could not be reconstructed
+        if (distNewVec[i] == OUT_OF_RANGE) continue;
+        const double distNew = distNewVec[i];
+        const double sigmaNew = sigmaNewVec[i];
+        double & dist = depth.at(_matchIdxVec[i]);
+        double & sigma = depth.sigma(_matchIdxVec[i]);
+        double & cost = depth.cost(_matchIdxVec[i]);
         if (dist != OUT_OF_RANGE)
         {
             if (abs(distNew - dist) > 2.6*sigma) 
             {
                 count_out++;
-    //            dist = OUT_OF_RANGE;
-    //            cout << gu << " " << gv << " ; " << guVec[dBest] << " " << gvVec[dBest] << " " ;
-    //            cout << dist << "+-" << sigma << " ; " << distNew << "+-" << sigmaNew << endl;
             }
-    //        else
-    //        { count_in++;
             //temporal filtering
-            
             filter(dist, sigma, distNew, sigmaNew);
-            cost = cost * 0.7 +  (*bestCostIter) * 0.3; //FIXME experimental
+            cost = cost * 0.7 +  _matchCostVec[i] * 0.3; //FIXME experimental
         }
         else
         {
-//            dist =  dBest;            
             dist = distNew;
             sigma = sigmaNew;
-            cost = *bestCostIter;
-        }    
-////        const double K = 1 / (sigma + sigmaNew);
-//        dist = (sigma * distNew + sigmaNew * dist) * K;
-//        sigma = min(sigma, sigmaNew);  //FIXME an overestimation?
-        
-        /*
-        if (sigma > 1 and gu < 600 and gu > 400 and gv > 300 and gv < 550 )
-        {
-            cout << sigma << " " << dist << endl;
-            cout    << gu << " " << gv << " " 
-                    <<  guVec[dBest] << " "  << gvVec[dBest] << " " 
-                     << guVec[dBest + 1] << " "  << gvVec[dBest + 1] << endl;
+            cost = _matchCostVec[i];
         }
-        */
-//        }
-        
     }
-    
-//    if (gu > 220 and gu < 235  and gv > 103 and gv < 113 )
-    /*if (gu > 110 and gu < 126  and gv > 255 and gv < 265 )
-    {
-        cout << gu << "   " << gv << endl;
-        cout << "depth: " << dist
-            << " +-" << sigma
-            << endl;
-        cout << "samples:" << endl;
-        for (auto & x : gsampleVec)
-        {
-            cout << setw(6) << int(x);
-        }
-        cout << endl;
-        cout << "coordinates:" << endl;
-        for (auto & x : guVec)
-        {
-            cout << setw(6) << int(x);
-        }
-        cout << endl;
-        for (auto & x : gvVec)
-        {
-            cout << setw(6) << int(x);
-        }
-        cout << endl;
-        cout << "descriptor:" << endl;
-        for (auto & x : gdescriptor)
-        {
-            cout << setw(6) << int(x);
-        }
-        cout << endl;
-        cout << "cost:" << endl;
-        for (auto & x : costVec)
-        {
-            cout << setw(6) << int(x);
-        }
-        cout << endl<< endl;
-        
-        
-    }*/
+    _pt11Vec.clear();
+    _pt12Vec.clear();
+    _pt21Vec.clear();
+    _pt22Vec.clear();
+    _matchIdxVec.clear();
+    _matchCostVec.clear();
 }
 
 DepthMap MotionStereo::compute(Transf T12, const Mat8u & img2)
 {
+    PROFILE_SCOPE("motion_stereo");
     //init necessary data structures
     setTransformation(T12);
     DepthMap depthOut(_camera1, _params);
     depthOut.setTo(OUT_OF_RANGE, OUT_OF_RANGE, _params.maxError);
 
 //    int count1 = 0, count2 = 0, count3 = 0, count4 = 0;
+    int pointCount = 0;
     //for each point
     for (int y = 0; y < depthOut.yMax; y++)
     {
@@ -300,19 +319,22 @@ DepthMap MotionStereo::compute(Transf T12, const Mat8u & img2)
                 continue;  
             }
             
-            reconstruct(depthOut.at(x, y), depthOut.sigma(x, y), depthOut.cost(x, y));
+            match(x + y * depthOut.xMax, depthOut.cost(x, y));
+            pointCount++;
         }
     }
+    reconstructMatches(depthOut);
 //    cout << count1 << endl;
 //    cout << count2 << endl;
 //    cout << count3 << endl;
 //    cout << count4 << endl;
-    
+    PROFILE_COUNT("motion_stereo.points", pointCount);
     return depthOut;
 }
 
 DepthMap MotionStereo::compute(Transf T12, const Mat8u & img2, const DepthMap & depthIn)
 {
+    PROFILE_SCOPE("motion_stereo");
     //init necessary data structures
     setTransformation(T12);
     assert(ScaleParameters(depthIn) == ScaleParameters(_params));
@@ -343,15 +365,18 @@ DepthMap MotionStereo::compute(Transf T12, const Mat8u & img2, const DepthMap &
             
             if (not sampleImage(img2)) { count4++; continue;}
             
-            reconstruct(depthOut.at(x, y), depthOut.sigma(x, y), depthOut.cost(x, y));
+            match(x + y * depthOut.xMax, depthOut.cost(x, y));
         }
     }
+    reconstructMatches(depthOut);
 //    cout << count1 << endl;
 //    cout << count2 << endl;
 //    cout << count3 << endl;
 //    cout << count4 << endl << endl;
 //    cout << count_in << endl;
 //    cout << count_out << endl;
+    PROFILE_COUNT("motion_stereo.points",
+            depthOut.xMax * depthOut.yMax - count1 - count2 - count3 - count4);
     return depthOut;
 }
 
@@ -27,6 +27,7 @@ Semi-global block matching algorithm for non-rectified images
 #include "geometry/geometry.h"
 #include "projection/eucm.h"
 #include "utils/curve_rasterizer.h"
+#include "utils/profiler.h"
 #include "reconstruction/eucm_sgm.h"
 #include "reconstruction/depth_map.h"
 
@@ -80,6 +81,31 @@ void EnhancedSgm::computePinf()
     }
 }
 
+template<class Raster>
+void EnhancedSgm::fillUVCache(Raster & raster, int x, int y)
+{
+    raster.steps(-DISPARITY_MARGIN);
+    const int u_vCacheStep = _params.dispMax + 2 * DISPARITY_MARGIN;
+    int32_t * uPtr = (int32_t *)_uCache.row(y).data + x*u_vCacheStep;
+    int32_t * vPtr = (int32_t *)_vCache.row(y).data + x*u_vCacheStep;
+    for (int i = 0; i  < u_vCacheStep; i++, raster.step(), uPtr++, vPtr++)
+    {
+        if (raster.v < 0 or raster.v >= _params.vMax 
+            or raster.u < 0 or raster.u >= _params.uMax)
+        {
+            // coordinate is out of the image
+            *uPtr = -1;
+            *vPtr = -1;
+        }
+        else
+        {
+            // coordinate is within the image
+            *uPtr = raster.u;
+            *vPtr = raster.v;
+        }
+    }
+}
+
 void EnhancedSgm::computeUVCache()
 {
     for (int y = 0; y < _params.yMax; y++)
@@ -88,26 +114,15 @@ void EnhancedSgm::computeUVCache()
         {
             int idx = getLinearIndex(x, y);
             if (not _maskVec[idx]) continue;
-            CurveRasterizer<int, Polynomial2> raster = getCurveRasteriser(CAMERA_2, idx);
-            raster.steps(-DISPARITY_MARGIN);
-            const int u_vCacheStep = _params.dispMax + 2 * DISPARITY_MARGIN;
-            int32_t * uPtr = (int32_t *)_uCache.row(y).data + x*u_vCacheStep;
-            int32_t * vPtr = (int32_t *)_vCache.row(y).data + x*u_vCacheStep;
-            for (int i = 0; i  < u_vCacheStep; i++, raster.step(), uPtr++, vPtr++)
+            if (_params.useEpipolarTable)
             {
-                if (raster.v < 0 or raster.v >= _params.vMax 
-                    or raster.u < 0 or raster.u >= _params.uMax)
-                {
-                    // coordinate is out of the image
-                    *uPtr = -1;
-                    *vPtr = -1;
-                }
-                else
-                {
-                    // coordinate is within the image
-                    *uPtr = raster.u;
-                    *vPtr = raster.v;
-                }
+                EpipolarRaster raster = getEpipolarRaster(idx);
+                fillUVCache(raster, x, y);
+            }
+            else
+            {
+                CurveRasterizer<int, Polynomial2> raster = getCurveRasteriser(CAMERA_2, idx);
+                fillUVCache(raster, x, y);
             }
         }
     }
@@ -117,7 +132,7 @@ void EnhancedSgm::createBuffer()
 {
     if (_params.verbosity > 1) cout << "EnhancedSgm::createBuffer" << endl;
     assert(_params.hypMax > 0);
-    int bufferWidth = _params.xMax*_params.dispMax;
+    int bufferWidth = _params.xMax*_dispWidth;
     _stepBuffer.create(_params.yMax, _params.xMax);
     _errorBuffer.create(_params.yMax, bufferWidth);
     _tableauLeft.create(_params.yMax, bufferWidth);
@@ -127,10 +142,17 @@ void EnhancedSgm::createBuffer()
     _smallDisparity.create(_params.yMax, _params.xMax * _params.hypMax);
     _finalErrorMat.create(_params.yMax, _params.xMax * _params.hypMax);
     _skipBuffer.create(_params.yMax, _params.xMax);
+    _dispOffset.create(_params.yMax, _params.xMax);
+    _dispOffset.setTo(0);
+    _searchBegin.create(_params.yMax, _params.xMax);
+    _searchEnd.create(_params.yMax, _params.xMax);
     if (_params.imageBasedCost) _costBuffer.create(_params.yMax, _params.xMax);
     if (_params.salientPoints) _salientBuffer.create(_params.yMax, _params.xMax);
-    _uCache.create(_params.yMax, _params.xMax * (_params.dispMax + 2*DISPARITY_MARGIN));
-    _vCache.create(_params.yMax, _params.xMax * (_params.dispMax + 2*DISPARITY_MARGIN));
+    if (_params.useUVCache)
+    {
+        _uCache.create(_params.yMax, _params.xMax * (_params.dispMax + 2*DISPARITY_MARGIN));
+        _vCache.create(_params.yMax, _params.xMax * (_params.dispMax + 2*DISPARITY_MARGIN));
+    }
     if (_params.verbosity > 2) 
     {
         cout << "    small disparity size: " << _smallDisparity.size() << endl;
@@ -139,25 +161,198 @@ void EnhancedSgm::createBuffer()
 
 void EnhancedSgm::computeStereo(const Mat8u & img1, const Mat8u & img2, DepthMap & depth)
 {
+    PROFILE_SCOPE("sgm");
+    computeDisparity(img1, img2);
+    reconstructDepth(depth);    
+}
+
+void EnhancedSgm::computeStereo(const Mat8u & img1, const Mat8u & img2, const DepthMap & prior,
+        DepthMap & depth)
+{
+    PROFILE_SCOPE("sgm");
+    computeDisparity(img1, img2, &prior);
+    reconstructDepth(depth);
+}
+
+void EnhancedSgm::computeDisparity(const Mat8u & img1, const Mat8u & img2, const DepthMap * prior)
+{
+    PROFILE_COUNT("sgm.pixels", _params.xMax * _params.yMax);
+    PROFILE_COUNT("sgm.cost_volume", _params.xMax * _params.yMax * _dispWidth);
     _skipBuffer.setTo(0);
+    _searchBegin.setTo(0);
+    _searchEnd.setTo(_dispWidth);
+    if (_params.pyramidLevels > 1) computeDisparityBand(img1, img2);
+    if (prior != NULL) computePriorRange(*prior);
+    
     computeCurveCost(img1, img2);
     
     computeDynamicProgramming();
     
     if (_params.hypMax == 1) reconstructDisparity();
     else reconstructDisparityMH();
+}
+
+void EnhancedSgm::computePriorRange(const DepthMap & prior)
+{
+    PROFILE_SCOPE("sgm.prior");
+    if (not (static_cast<const ScaleParameters &>(prior) == _params))
+    {
+        throw std::runtime_error("EnhancedSgm : the prior depth map has wrong ScaleParameters");
+    }
+    int priorCount = 0;
+    for (int y = 0; y < _params.yMax; y++)
+    {
+        for (int x = 0; x < _params.xMax; x++)
+        {
+            int idx = getLinearIndex(x, y);
+            if (not _maskVec[idx] or _skipBuffer(y, x)) continue;
+            const double d = prior.at(x, y);
+            const double sigma = prior.sigma(x, y);
+            if (d < MIN_DEPTH or sigma >= DEFAULT_SIGMA_DEPTH) continue;
+            const Vector3d bearing = _reconstVec[idx].normalized();
+            
+            // the far point gives the smallest disparity
+            int dispLow = priorDisparity(idx, bearing * (d + _params.priorSigmaScale * sigma));
+            if (dispLow < 0) continue;
+            const double dNear = d - _params.priorSigmaScale * sigma;
+            int dispHigh = _params.dispMax;
+            if (dNear > MIN_DEPTH)
+            {
+                dispHigh = priorDisparity(idx, bearing * dNear);
+                if (dispHigh < 0) continue;
+            }
+            dispLow -= _params.priorDispMargin;
+            dispHigh += _params.priorDispMargin + 1;
+            
+            // to the buffer indices, the prior is ignored if it does not overlap with the band
+            const int offset = _dispOffset(y, x);
+            const int searchBegin = max(_searchBegin(y, x), dispLow - offset);
+            const int searchEnd = min(_searchEnd(y, x), dispHigh - offset);
+            if (searchBegin >= searchEnd) continue;
+            _searchBegin(y, x) = searchBegin;
+            _searchEnd(y, x) = searchEnd;
+            priorCount++;
+        }
+    }
+    PROFILE_COUNT("sgm.prior_pixels", priorCount);
+}
+
+int EnhancedSgm::priorDisparity(const int idx, const Vector3d & X1) const
+{
+    Vector3d X2;
+    transf().inverseTransform(X1, X2);
+    Vector2d pt;
+    if (not _camera2->projectPoint(X2, pt)) return -1;
+    // the rasterizer makes one-pixel steps along the dominant direction of the curve
+    const Vector2d delta = pt - _pinfVec[idx];
+    return round(max(abs(delta[0]), abs(delta[1])));
+}
+
+void EnhancedSgm::createCoarseLevel()
+{
+    // the same depth grid step on the images downscaled twice
+    SgmParameters coarseParams(_params);
+    coarseParams.u0 = _params.u0 / 2;
+    coarseParams.v0 = _params.v0 / 2;
+    coarseParams.uMax = (_params.uMax + 1) / 2;
+    coarseParams.vMax = (_params.vMax + 1) / 2;
+    coarseParams.xMax = (_params.xMax + 1) / 2;
+    coarseParams.yMax = (_params.yMax + 1) / 2;
+    coarseParams.dispMax = (_params.dispMax / 2 + 1) / 2 * 2;  // must stay even
+    coarseParams.epipoleMargin = _params.epipoleMargin / 4;  // squared distance
+    coarseParams.hypMax = 1;
+    coarseParams.salientPoints = false;  // every pixel needs a band
+    coarseParams.pyramidLevels = _params.pyramidLevels - 1;
     
-    reconstructDepth(depth);    
+    vector<double> coarseIntrinsics(_camera1->getParams(), _camera1->getParams() + 6);
+    for (int i = 2; i < 6; i++) coarseIntrinsics[i] /= 2;  // fu, fv, u0, v0
+    EnhancedCamera coarseCamera1(coarseParams.uMax, coarseParams.vMax, coarseIntrinsics.data());
+    coarseIntrinsics.assign(_camera2->getParams(), _camera2->getParams() + 6);
+    for (int i = 2; i < 6; i++) coarseIntrinsics[i] /= 2;
+    EnhancedCamera coarseCamera2(coarseParams.uMax, coarseParams.vMax, coarseIntrinsics.data());
+    
+    // the cameras are cloned
+    _coarseSgm.reset(new EnhancedSgm(transf(), &coarseCamera1, &coarseCamera2, coarseParams));
+}
 
+void EnhancedSgm::computeDisparityBand(const Mat8u & img1, const Mat8u & img2)
+{
+    PROFILE_SCOPE("sgm.coarse");
+    if (_params.verbosity > 0) cout << "EnhancedSgm::computeDisparityBand" << endl;
+    
+    Mat8u coarseImg1, coarseImg2;
+    cv::pyrDown(img1, coarseImg1);
+    cv::pyrDown(img2, coarseImg2);
+    _coarseSgm->computeDisparity(coarseImg1, coarseImg2);
+    const Mat32s & coarseDisparity = _coarseSgm->disparity();
+    const ScaleParameters & coarseParams = _coarseSgm->_params;
+    
+    // a one-pixel step on the coarse image is two steps on the fine one
+    const int maxOffset = _params.dispMax - _dispWidth;
+    std::queue<int> fillQueue;  // the pixels which have a band
+    for (int y = 0; y < _params.yMax; y++)
+    {
+        for (int x = 0; x < _params.xMax; x++)
+        {
+            const int xc = coarseParams.xConv(_params.uConv(x) / 2.);
+            const int yc = coarseParams.yConv(_params.vConv(y) / 2.);
+            // the central coarse estimate or, if it is invalid, one of its neighbors
+            int coarseDisp = -1;
+            for (int i = 0; i < 9 and coarseDisp < 0; i++)
+            {
+                const int xi = xc + (i + 4) % 9 % 3 - 1;  // the central one first
+                const int yi = yc + (i + 4) % 9 / 3 - 1;
+                if (xi < 0 or xi >= coarseParams.xMax or yi < 0 or yi >= coarseParams.yMax) continue;
+                coarseDisp = coarseDisparity(yi, xi);
+            }
+            if (coarseDisp < 0)
+            {
+                _skipBuffer(y, x) = 1;
+                _dispOffset(y, x) = 0;
+                continue;
+            }
+            _dispOffset(y, x) = min(maxOffset, max(0, 2 * coarseDisp - _dispWidth / 2));
+            fillQueue.push(getLinearIndex(x, y));
+        }
+    }
+    
+    // the buffers hold only the band, so the whole range cannot be searched 
+    // for the pixels without a coarse estimate, they take the band of the closest one
+    int filledCount = 0;
+    while (not fillQueue.empty())
+    {
+        const int idx = fillQueue.front();
+        fillQueue.pop();
+        const int x = idx % _params.xMax;
+        const int y = idx / _params.xMax;
+        for (int i = 0; i < 4; i++)
+        {
+            const int xn = x + (i == 0) - (i == 1);
+            const int yn = y + (i == 2) - (i == 3);
+            if (xn < 0 or xn >= _params.xMax or yn < 0 or yn >= _params.yMax) continue;
+            if (not _skipBuffer(yn, xn)) continue;
+            _skipBuffer(yn, xn) = 0;
+            _dispOffset(yn, xn) = _dispOffset(y, x);
+            fillQueue.push(getLinearIndex(xn, yn));
+            filledCount++;
+        }
+    }
+    PROFILE_COUNT("sgm.band_filled", filledCount);
 }
 
 void EnhancedSgm::reconstructDepth(DepthMap & depth) const
 {
+    PROFILE_SCOPE("sgm.depth");
     if (_params.verbosity > 2) 
     {
         cout << "EnhancedSgm::reconstructDepth(DepthMap & depth)" << endl;
     }
     depth = DepthMap(_camera1, _params, _params.hypMax);
+    
+    // the rays are collected for the whole map and triangulated at once
+    DirectionBatch pBatch, q1Batch, q2Batch;
+    vector<int> depthIdxVec;
+    Vector3d q1, q2;
     for (int h = 0; h < _params.hypMax; h++)
     {
         for (int y = 0; y < _params.yMax; y++)
@@ -171,7 +366,7 @@ void EnhancedSgm::reconstructDepth(DepthMap & depth) const
                     depth.cost(x, y, h) = OUT_OF_RANGE;
                     continue;
                 }
-                depth.cost(x, y, h) = _errorBuffer(y, x*_params.dispMax + h);
+                depth.cost(x, y, h) = _errorBuffer(y, x*_dispWidth + h);
                 
                 int idx = getLinearIndex(x, y);
                 if (not _maskVec[idx])
@@ -182,9 +377,7 @@ void EnhancedSgm::reconstructDepth(DepthMap & depth) const
                     continue;
                 }
                 int disparity = _smallDisparity(y, x*_params.hypMax + h);
-                
-                // point on the first image
-                const auto & pt1 = _pointVec1[idx];
+                const int cacheIdx = DISPARITY_MARGIN + disparity;
                 
                 // to compute point on the second image
                 // TODO make virtual rasterizer using the cache
@@ -193,10 +386,20 @@ void EnhancedSgm::reconstructDepth(DepthMap & depth) const
                 if (_params.useUVCache)
                 {
                     const int u_vCacheStep = _params.dispMax + 2 * DISPARITY_MARGIN;
-                    u21 = _uCache(y, x*u_vCacheStep + DISPARITY_MARGIN + disparity);
-                    u22 = _uCache(y, x*u_vCacheStep + DISPARITY_MARGIN + disparity + step);
-                    v21 = _vCache(y, x*u_vCacheStep + DISPARITY_MARGIN + disparity);
-                    v22 = _vCache(y, x*u_vCacheStep + DISPARITY_MARGIN + disparity + step);
+                    u21 = _uCache(y, x*u_vCacheStep + cacheIdx);
+                    u22 = _uCache(y, x*u_vCacheStep + cacheIdx + step);
+                    v21 = _vCache(y, x*u_vCacheStep + cacheIdx);
+                    v22 = _vCache(y, x*u_vCacheStep + cacheIdx + step);
+                }
+                else if (_params.useEpipolarTable)
+                {
+                    EpipolarRaster raster = getEpipolarRaster(idx);
+                    raster.steps(disparity);
+                    u21 = raster.u;
+                    v21 = raster.v;
+                    raster.steps(step);
+                    u22 = raster.u;
+                    v22 = raster.v;
                 }
                 else
                 {       
@@ -209,24 +412,72 @@ void EnhancedSgm::reconstructDepth(DepthMap & depth) const
                     v22 = raster.v;
                 }
                 
-                triangulate(pt1[0], pt1[1], u21, v21, u22, v22,
-                             depth.at(x, y, h), depth.sigma(x, y, h));
-                        
+                if (not _camera2->reconstructPoint(Vector2d(u21, v21), q1) or
+                    not _camera2->reconstructPoint(Vector2d(u22, v22), q2))
+                {
+                    continue;
+                }
+                pBatch.push_back(_reconstVec[idx]);
+                q1Batch.push_back(q1);
+                q2Batch.push_back(q2);
+                depthIdxVec.push_back(x + y*_params.xMax + h*_params.xMax*_params.yMax);
             }
         }
     }
+    
+    const int count = depthIdxVec.size();
+    vector<double> dVec(count), sigmaVec(count);
+    triangulate(pBatch, pBatch, q1Batch, q2Batch, dVec.data(), sigmaVec.data());
+    for (int i = 0; i < count; i++)
+    {
+        const int depthIdx = depthIdxVec[i];
+        if (dVec[i] < TRIANGULATE_DIST_MAX)
+        {
+            depth.at(depthIdx) = dVec[i];
+            depth.sigma(depthIdx) = sigmaVec[i];
+        }
+        else
+        {
+            depth.at(depthIdx) = OUT_OF_RANGE;
+            depth.sigma(depthIdx) = OUT_OF_RANGE;
+        }
+    }
+    PROFILE_COUNT("sgm.triangulated", count);
 }
 
 void EnhancedSgm::skipPixel(int x, int y)
 {
-    uint8_t * outPtr = _errorBuffer.row(y).data + x*_params.dispMax;            
+    uint8_t * outPtr = _errorBuffer.row(y).data + x*_dispWidth;            
     *outPtr = 0;
     _skipBuffer(y, x) = 1;
-    fill(outPtr + 1, outPtr + _params.dispMax, 255);
+    fill(outPtr + 1, outPtr + _dispWidth, 255);
+}
+
+template<class Raster>
+bool EnhancedSgm::sampleCurve(Raster & raster, const Mat8u & img2, const int step,
+        vector<uint8_t> & sampleVec) const
+{
+    raster.setStep(step); 
+    raster.steps(-HALF_LENGTH);
+    for (int i = 0; i < sampleVec.size(); i++, raster.step())
+    {
+        if (raster.v < 0 or raster.v >= img2.rows 
+            or raster.u < 0 or raster.u >= img2.cols)
+        {
+            return false;
+        }
+        if (_params.verbosity > 5)
+        {
+            cout << raster.u << "  " << raster.v << endl;
+        }
+        sampleVec[i] = img2(raster.v, raster.u);
+    }
+    return true;
 }
 
 void EnhancedSgm::computeCurveCost(const Mat8u & img1, const Mat8u & img2)
 {
+    PROFILE_SCOPE("sgm.cost");
     if (_params.verbosity > 0) cout << "EnhancedSgm::computeCurveCost" << endl;
     
     // compute the weights for matching cost
@@ -243,7 +494,7 @@ void EnhancedSgm::computeCurveCost(const Mat8u & img1, const Mat8u & img2)
                 cout << "    x: " << x << " y: " << y << "  idx: " << idx; 
                 cout << "  mask: " << _maskVec[idx] <<  endl;
             }
-            if (not _maskVec[idx])
+            if (not _maskVec[idx] or _skipBuffer(y, x))
             {
                 skipPixel(x, y);
                 continue;
@@ -286,7 +537,9 @@ void EnhancedSgm::computeCurveCost(const Mat8u & img1, const Mat8u & img2)
             {
                 _salientBuffer(y, x) = 1;
             }
-            const int nSteps = ( _params.dispMax  + step - 1 ) / step; 
+            const int searchBegin = _searchBegin(y, x);
+            const int searchEnd = _searchEnd(y, x);
+            const int nSteps = ( searchEnd - searchBegin + step - 1 ) / step; 
                
             //sample the curve 
             vector<uint8_t> sampleVec(nSteps + MARGIN, 0);
@@ -294,10 +547,9 @@ void EnhancedSgm::computeCurveCost(const Mat8u & img1, const Mat8u & img2)
             if (_params.useUVCache)
             {
                 const int u_vCacheStep = _params.dispMax + 2 * DISPARITY_MARGIN;
-                int32_t * uPtr = (int32_t *)_uCache.row(y).data + x*u_vCacheStep;
-                int32_t * vPtr = (int32_t *)_vCache.row(y).data + x*u_vCacheStep;
-                uPtr += DISPARITY_MARGIN - HALF_LENGTH * step;
-                vPtr += DISPARITY_MARGIN - HALF_LENGTH * step;
+                const int cacheBegin = DISPARITY_MARGIN + _dispOffset(y, x) + searchBegin - HALF_LENGTH * step;
+                int32_t * uPtr = (int32_t *)_uCache.row(y).data + x*u_vCacheStep + cacheBegin;
+                int32_t * vPtr = (int32_t *)_vCache.row(y).data + x*u_vCacheStep + cacheBegin;
                 for (int i = 0; i  < nSteps + MARGIN; i++, uPtr += step, vPtr += step)
                 {
                     if (*uPtr < 0 or *vPtr < 0) 
@@ -308,11 +560,16 @@ void EnhancedSgm::computeCurveCost(const Mat8u & img1, const Mat8u & img2)
                     else sampleVec[i] = img2(*vPtr, *uPtr);
                 }
             }
+            else if (_params.useEpipolarTable)
+            {
+                EpipolarRaster raster = getEpipolarRaster(idx);
+                raster.steps(_dispOffset(y, x) + searchBegin);
+                crossedImageBoundary = not sampleCurve(raster, img2, step, sampleVec);
+            }
             else
             {
                 CurveRasterizer<int, Polynomial2> raster = getCurveRasteriser(CAMERA_2, idx);
-                raster.setStep(step); 
-                raster.steps(-HALF_LENGTH);           
+                raster.steps(_dispOffset(y, x) + searchBegin);
                 
                 if (_params.verbosity > 6)
                 {
@@ -327,20 +584,7 @@ void EnhancedSgm::computeCurveCost(const Mat8u & img1, const Mat8u & img2)
                          << " " << surf.kv << " " << surf.k1 << endl;
                 }
                 
-                for (int i = 0; i  < nSteps + MARGIN; i++, raster.step())
-                {
-                    if (raster.v < 0 or raster.v >= img2.rows 
-                        or raster.u < 0 or raster.u >= img2.cols)
-                        {
-                            crossedImageBoundary = true;
-                            break;
-                        }
-                    if (_params.verbosity > 5)
-                    {
-                        cout << raster.u << "  " << raster.v << endl;
-                    }
-                    sampleVec[i] = img2(raster.v, raster.u);
-                }
+                crossedImageBoundary = not sampleCurve(raster, img2, step, sampleVec);
             }
             if (crossedImageBoundary)
             {
@@ -376,7 +620,10 @@ void EnhancedSgm::computeCurveCost(const Mat8u & img1, const Mat8u & img2)
 //            int sum1 = filter(kernelVec.begin(), kernelVec.end(), descriptor.begin(), 0);
             
             // fill up the cost buffer
-            uint8_t * outPtr = _errorBuffer.row(y).data + x*_params.dispMax;
+            uint8_t * const errorPtr = _errorBuffer.row(y).data + x*_dispWidth;
+            fill(errorPtr, errorPtr + searchBegin, 255);
+            fill(errorPtr + searchEnd, errorPtr + _dispWidth, 255);
+            uint8_t * outPtr = errorPtr + searchBegin;
             auto costIter = costVec.begin() + HALF_LENGTH;
             for (int d = 0; d < nSteps; d++, outPtr += step)
             {
@@ -389,7 +636,7 @@ void EnhancedSgm::computeCurveCost(const Mat8u & img1, const Mat8u & img2)
                 *outPtr = min(*costIter, 255);
                 ++costIter;
             }
-            if (step > 1) fillGaps(_errorBuffer.row(y).data + x*_params.dispMax, step);
+            if (step > 1) fillGaps(errorPtr + searchBegin, step, searchEnd - searchBegin);
         }
     }
 //    cout << "Epipoles : " << endl;
@@ -404,7 +651,7 @@ void EnhancedSgm::computeCurveCost(const Mat8u & img1, const Mat8u & img2)
 //        << epipoles().antiEpipole1projected<< epipoles().antiEpipole2projected << endl;
 }
 
-void EnhancedSgm::fillGaps(uint8_t * const data, const int step)
+void EnhancedSgm::fillGaps(uint8_t * const data, const int step, const int length)
 {
     assert(step > 0);
     //linear interpolation for all intermediate points
@@ -412,13 +659,13 @@ void EnhancedSgm::fillGaps(uint8_t * const data, const int step)
     switch (step)
     {
     case 2:
-        for (base = 2; base < _params.dispMax; base += 2)
+        for (base = 2; base < length; base += 2)
         {
             data[base - 1] = (data[base - 2] + data[base]) / 2;
         }
         break;
     case 3:
-        for (base = 3; base < _params.dispMax; base += 3)
+        for (base = 3; base < length; base += 3)
         {
             const uint8_t & val1 = data[base - 3];
             const uint8_t & val2 = data[base];
@@ -427,7 +674,7 @@ void EnhancedSgm::fillGaps(uint8_t * const data, const int step)
         }
         break;
     default:
-        for (base = step; base < _params.dispMax; base += step)
+        for (base = step; base < length; base += step)
         {
             const uint8_t & val1 = data[base - step];
             const uint8_t & val2 = data[base];
@@ -441,25 +688,42 @@ void EnhancedSgm::fillGaps(uint8_t * const data, const int step)
     //for the rest just constant extrapolation
     base -= step;
     const uint8_t & val = data[base];
-    for (int i = base + 1 ; i < _params.dispMax; i++)
+    for (int i = base + 1 ; i < length; i++)
     {
         data[i] = val;
     }
 }
 
-void EnhancedSgm::computeDynamicStep(const int32_t* inCost, const uint8_t * error, int32_t * outCost)
+void EnhancedSgm::computeDynamicStep(const int32_t* inCost, const uint8_t * error, int32_t * outCost,
+        const int shift)
 {
     int bestCost = inCost[0];
-    for (int i = 1; i < _params.dispMax; i++)
+    for (int i = 1; i < _dispWidth; i++)
     {
         bestCost = min(bestCost, inCost[i]);
     }
+    if (shift != 0)
+    {
+        // the bands are not aligned, the disparity i corresponds to i + shift in inCost
+        // and the disparities out of the previous band can be reached only by a jump
+        for (int i = 0; i < _dispWidth; i++)
+        {
+            const int j = i + shift;
+            int & val = outCost[i];
+            val = bestCost + _jumpCost;
+            if (j >= 0 and j < _dispWidth) val = min(val, inCost[j]);
+            if (j >= -1 and j < _dispWidth - 1) val = min(val, inCost[j + 1] + _params.lambdaStep);
+            if (j >= 1 and j <= _dispWidth) val = min(val, inCost[j - 1] + _params.lambdaStep);
+            val += error[i];
+        }
+        return;
+    }
     int & val0 = outCost[0];
     val0 = inCost[0];
     val0 = min(val0, inCost[1] + _params.lambdaStep);
     val0 = min(val0, bestCost + _jumpCost);
     val0 += error[0];
-    for (int i = 1; i < _params.dispMax-1; i++)
+    for (int i = 1; i < _dispWidth-1; i++)
     {
         int & val = outCost[i];
         val = inCost[i];
@@ -468,17 +732,17 @@ void EnhancedSgm::computeDynamicStep(const int32_t* inCost, const uint8_t * erro
         val = min(val, bestCost + _jumpCost);
         val += error[i];
     }
-    int & vald = outCost[_params.dispMax - 1];
-    vald = inCost[_params.dispMax - 1];
-    vald = min(vald, inCost[_params.dispMax - 2] + _params.lambdaStep);
+    int & vald = outCost[_dispWidth - 1];
+    vald = inCost[_dispWidth - 1];
+    vald = min(vald, inCost[_dispWidth - 2] + _params.lambdaStep);
     vald = min(vald, bestCost + _jumpCost);
-    vald += error[_params.dispMax - 1];
+    vald += error[_dispWidth - 1];
 }
 
 void EnhancedSgm::computeDynamicStep2(const int32_t* inCost, const uint32_t * error, int32_t * outCost)
 {
     int bestCost = inCost[0];
-    for (int i = 1; i < _params.dispMax; i++)
+    for (int i = 1; i < _dispWidth; i++)
     {
         bestCost = min(bestCost, inCost[i]);
     }
@@ -487,7 +751,7 @@ void EnhancedSgm::computeDynamicStep2(const int32_t* inCost, const uint32_t * er
     val0 = min(val0, inCost[1] + _params.lambdaStep);
     val0 = min(val0, bestCost + _jumpCost);
     val0 += error[0];
-    for (int i = 1; i < _params.dispMax-1; i++)
+    for (int i = 1; i < _dispWidth-1; i++)
     {
         int & val = outCost[i];
         val = inCost[i];
@@ -496,15 +760,16 @@ void EnhancedSgm::computeDynamicStep2(const int32_t* inCost, const uint32_t * er
         val = min(val, bestCost + _jumpCost);
         val += error[i];
     }
-    int & vald = outCost[_params.dispMax - 1];
-    vald = inCost[_params.dispMax - 1];
-    vald = min(vald, inCost[_params.dispMax - 2] + _params.lambdaStep);
+    int & vald = outCost[_dispWidth - 1];
+    vald = inCost[_dispWidth - 1];
+    vald = min(vald, inCost[_dispWidth - 2] + _params.lambdaStep);
     vald = min(vald, bestCost + _jumpCost);
-    vald += error[_params.dispMax - 1];
+    vald += error[_dispWidth - 1];
 }
 
 void EnhancedSgm::computeDynamicProgramming()
 {
+    PROFILE_SCOPE("sgm.dynamic_programming");
     if (_params.verbosity > 0) cout << "EnhancedSgm::computeDynamicProgramming" << endl;
     if (_params.verbosity > 1) cout << "    left" << endl;
     
@@ -516,13 +781,14 @@ void EnhancedSgm::computeDynamicProgramming()
         int32_t * _tableauRow = (int32_t *)(_tableauLeft.row(y).data);
         uint8_t * errorRow = _errorBuffer.row(y).data;
         // init the first row
-        copy(errorRow, errorRow + _params.dispMax, _tableauRow);
+        copy(errorRow, errorRow + _dispWidth, _tableauRow);
         // fill up the _tableau
         for (int x = 1; x < _params.xMax; x++)
         {
             if (_params.imageBasedCost) _jumpCost = _costBuffer(y, x);
-            computeDynamicStep(_tableauRow + (x - 1)*_params.dispMax,
-                    errorRow + x*_params.dispMax, _tableauRow + x*_params.dispMax);
+            computeDynamicStep(_tableauRow + (x - 1)*_dispWidth,
+                    errorRow + x*_dispWidth, _tableauRow + x*_dispWidth,
+                    _dispOffset(y, x) - _dispOffset(y, x - 1));
         }
     }
     if (_params.verbosity > 1) cout << "    right" << endl;  
@@ -531,47 +797,50 @@ void EnhancedSgm::computeDynamicProgramming()
     {
         int32_t * _tableauRow = (int32_t *)(_tableauRight.row(y).data);
         uint8_t * errorRow = _errorBuffer.row(y).data;
-        int base = (_params.xMax - 1) * _params.dispMax;
-        copy(errorRow + base, errorRow + base + _params.dispMax, _tableauRow + base);
+        int base = (_params.xMax - 1) * _dispWidth;
+        copy(errorRow + base, errorRow + base + _dispWidth, _tableauRow + base);
         
         for (int x = _params.xMax - 2; x >= 0; x--)
         {
             if (_params.imageBasedCost) _jumpCost = _costBuffer(y, x);
-            computeDynamicStep(_tableauRow + (x + 1)*_params.dispMax, 
-                    errorRow + x*_params.dispMax, _tableauRow + x*_params.dispMax);
+            computeDynamicStep(_tableauRow + (x + 1)*_dispWidth, 
+                    errorRow + x*_dispWidth, _tableauRow + x*_dispWidth,
+                    _dispOffset(y, x) - _dispOffset(y, x + 1));
         }
     }
     if (_params.verbosity > 1) cout << "    top" << endl;
     // top-down _tableau init
     for (int x = 0; x < _params.xMax; x++)
     {
-        auto _tableauCol = _tableauTop(Rect(x*_params.dispMax, 0, _params.dispMax, _params.yMax));
-        auto errorCol = _errorBuffer(Rect(x*_params.dispMax, 0, _params.dispMax, _params.yMax));
-        copy(errorCol.data, errorCol.data + _params.dispMax, (int*)(_tableauCol.data));
+        auto _tableauCol = _tableauTop(Rect(x*_dispWidth, 0, _dispWidth, _params.yMax));
+        auto errorCol = _errorBuffer(Rect(x*_dispWidth, 0, _dispWidth, _params.yMax));
+        copy(errorCol.data, errorCol.data + _dispWidth, (int*)(_tableauCol.data));
         for (int y = 1; y < _params.yMax; y++)
         {
             if (_params.imageBasedCost) _jumpCost = _costBuffer(y, x);
             computeDynamicStep((int32_t*)(_tableauCol.row(y-1).data), 
                     errorCol.row(y).data,
-                    (int32_t*)(_tableauCol.row(y).data));
+                    (int32_t*)(_tableauCol.row(y).data),
+                    _dispOffset(y, x) - _dispOffset(y - 1, x));
         }
     }
     if (_params.verbosity > 1) cout << "    bottom" << endl;
     // bottom-up _tableau init
     for (int x = 0; x < _params.xMax; x++)
     {
-        auto _tableauCol = _tableauBottom(Rect(x*_params.dispMax, 0, _params.dispMax, _params.yMax));
-        auto errorCol = _errorBuffer(Rect(x*_params.dispMax, 0, _params.dispMax, _params.yMax));
+        auto _tableauCol = _tableauBottom(Rect(x*_dispWidth, 0, _dispWidth, _params.yMax));
+        auto errorCol = _errorBuffer(Rect(x*_dispWidth, 0, _dispWidth, _params.yMax));
         int vLast = _params.yMax - 1;
         copy(errorCol.row(vLast).data, 
-                errorCol.row(vLast).data + _params.dispMax, 
+                errorCol.row(vLast).data + _dispWidth, 
                 (int32_t*)(_tableauCol.row(vLast).data));
         for (int y = _params.yMax - 2; y >= 0; y--)
         {
             if (_params.imageBasedCost) _jumpCost = _costBuffer(y, x);
             computeDynamicStep((int32_t*)(_tableauCol.row(y+1).data), 
                     errorCol.row(y).data,
-                    (int32_t*)(_tableauCol.row(y).data));
+                    (int32_t*)(_tableauCol.row(y).data),
+                    _dispOffset(y, x) - _dispOffset(y + 1, x));
         }
     }
     
@@ -579,6 +848,7 @@ void EnhancedSgm::computeDynamicProgramming()
 
 void EnhancedSgm::reconstructDisparity()
 {
+    PROFILE_SCOPE("sgm.disparity");
     if (_params.verbosity > 0) cout << "EnhancedSgm::reconstructDisparity" << endl;
 //    int sizeAcc = 0;
 //    int sizeCount = 0;
@@ -601,9 +871,11 @@ void EnhancedSgm::reconstructDisparity()
             int32_t & bestCost = _finalErrorMat(y, x);
             bestCost = INT32_MAX;
             bestDisp = -1;
-            const int base = x * _params.dispMax;
+            const int base = x * _dispWidth;
+            const int offset = _dispOffset(y, x);
             if (_params.verbosity > 4) cout << "Err : ";
-            for (int d = 1; d < _params.dispMax; d++)
+            // the disparity 0 is not considered
+            for (int d = (offset == 0 ? 1 : 0); d < _dispWidth; d++)
             {
                 const int & err = errRow[base + d];
                 if (_params.verbosity > 4) cout << setw(8) << err;
@@ -613,7 +885,7 @@ void EnhancedSgm::reconstructDisparity()
                 
                 if ( bestCost > cost)
                 {
-                    bestDisp = d;
+                    bestDisp = offset + d;
                     bestCost = cost;
                 }
             }
@@ -627,6 +899,7 @@ void EnhancedSgm::reconstructDisparity()
 
 void EnhancedSgm::reconstructDisparityMH()
 {
+    PROFILE_SCOPE("sgm.disparity");
     if (_params.verbosity > 0) cout << "EnhancedSgm::reconstructDisparityMH" << endl;
     const int hypShift = _params.xMax*_params.yMax;
 //    int sizeAcc = 0;
@@ -654,9 +927,9 @@ void EnhancedSgm::reconstructDisparityMH()
             
             //compute the cost vector
 //            vector<int> costVec;
-//            costVec.reserve(_params.dispMax);
-//            int base = x * _params.dispMax;
-//            for (int d = 0; d < _params.dispMax; d++)
+//            costVec.reserve(_dispWidth);
+//            int base = x * _dispWidth;
+//            for (int d = 0; d < _dispWidth; d++)
 //            {
 //                costVec.push_back(dynRow1[base + d] + dynRow2[base + d] 
 //                            + dynRow3[base + d] + dynRow4[base + d] - 2*errRow[base + d]);
@@ -690,9 +963,9 @@ void EnhancedSgm::reconstructDisparityMH()
                 bestErr = INT32_MAX;
                 bestDisp = -1;
                 int acc1 = -1, acc2 = -1, acc3 = -1;
-                for (int d = 0; d < _params.dispMax; d++)
+                for (int d = 0; d < _dispWidth; d++)
                 {
-                    int base = x * _params.dispMax;
+                    int base = x * _dispWidth;
                     if (errRow[base + d] > _params.maxError) continue;
                     acc1 = acc2;
                     acc2 = acc3;
@@ -710,7 +983,7 @@ void EnhancedSgm::reconstructDisparityMH()
                         localMin = (acc2 < acc3 and acc2 <= acc1);
                     } 
                     if (not localMin) continue;
-                    int d2 = d - 1;    
+                    int d2 = _dispOffset(y, x) + d - 1;    
                     if ( bestErr > acc2 and ( acc2 > minCost or 
                             (acc2 == minCost and d2 != minCostDisp) ) )
                     {
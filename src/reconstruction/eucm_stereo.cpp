@@ -33,6 +33,7 @@ StereoParameters::StereoParameters(const ptree & params) :
         else if (pname == "scales")    scaleVec = readVector<int>(item.second);
         else if (pname == "descriptor_response_thresh") descRespThresh = item.second.get_value<int>();
         else if (pname == "num_epipolar_planes") numEpipolarPlanes = item.second.get_value<int>();
+        else if (pname == "epipolar_table") useEpipolarTable = item.second.get_value<bool>();
         else if (pname == "epipole_margin") epipoleMargin = pow(item.second.get_value<int>(), 2);
     }
 }
@@ -68,6 +69,7 @@ void EnhancedStereo::setTransformation(const Transf & T12)
     _t12 = T12.trans();
     _triangulator.setTransformation(T12);
     _epipolarCurves.setTransformation(T12);
+    if (_epipolarTable) _epipolarTable->setTransformation(_epipolarCurves, T12);
 }
 
 int computeError(int v, int thMin, int thMax)
@@ -246,8 +248,6 @@ double EnhancedStereo::triangulate(double u1, double v1, double u2,
     }
 }
 
-//FIXME
-const double TRIANGULATE_DIST_MAX = 100;
 bool EnhancedStereo::triangulate(const double u1, const double v1, const double u21, const double v21,
         const double u22, const double v22, double & d, double & sigma, CameraIdx camIdx) const
 {
@@ -324,3 +324,61 @@ bool EnhancedStereo::triangulate(const Vector2d pt11, const Vector2d pt12, const
     sigma = abs(lambda2 - lambda1);
     d = lambda1;
 }
+
+void EnhancedStereo::triangulate(const Vector2dVec & pt11Vec, const Vector2dVec & pt12Vec,
+        const Vector2dVec & pt21Vec, const Vector2dVec & pt22Vec,
+        vector<double> & dVec, vector<double> & sigmaVec) const
+{
+    assert(pt11Vec.size() == pt12Vec.size());
+    assert(pt11Vec.size() == pt21Vec.size());
+    assert(pt11Vec.size() == pt22Vec.size());
+    const int n = pt11Vec.size();
+    dVec.assign(n, OUT_OF_RANGE);
+    sigmaVec.assign(n, OUT_OF_RANGE);
+    
+    // only the reconstructed points go to the batch
+    DirectionBatch p1Batch, p2Batch, q1Batch, q2Batch;
+    vector<int> idxVec;
+    Vector3d p1, p2, q1, q2;
+    for (int i = 0; i < n; i++)
+    {
+        if (not _camera1->reconstructPoint(pt11Vec[i], p1) or 
+            not _camera1->reconstructPoint(pt12Vec[i], p2) or
+            not _camera2->reconstructPoint(pt21Vec[i], q1) or 
+            not _camera2->reconstructPoint(pt22Vec[i], q2))
+        {
+            continue;
+        }
+        p1Batch.push_back(p1);
+        p2Batch.push_back(p2);
+        q1Batch.push_back(q1);
+        q2Batch.push_back(q2);
+        idxVec.push_back(i);
+    }
+    
+    vector<double> dBatch(idxVec.size()), sigmaBatch(idxVec.size());
+    triangulate(p1Batch, p2Batch, q1Batch, q2Batch, dBatch.data(), sigmaBatch.data());
+    for (int k = 0; k < idxVec.size(); k++)
+    {
+        dVec[idxVec[k]] = dBatch[k];
+        sigmaVec[idxVec[k]] = sigmaBatch[k];
+    }
+}
+
+void EnhancedStereo::triangulate(const DirectionBatch & p1Batch, const DirectionBatch & p2Batch,
+        const DirectionBatch & q1Batch, const DirectionBatch & q2Batch,
+        double * d, double * sigma) const
+{
+    const int n = p1Batch.size();
+    vector<double> lambda2Vec(n);
+    _triangulator.computeRegular(p1Batch, q1Batch, d);
+    _triangulator.computeRegular(p2Batch, q2Batch, lambda2Vec.data());
+    for (int i = 0; i < n; i++)
+    {
+        //TODO change to lambda only?
+        const double pnorm = sqrt(p1Batch.xVec[i] * p1Batch.xVec[i] + 
+                p1Batch.yVec[i] * p1Batch.yVec[i] + p1Batch.zVec[i] * p1Batch.zVec[i]);
+        d[i] *= pnorm;
+        sigma[i] = abs(lambda2Vec[i] * pnorm - d[i]);
+    }
+}
@@ -19,6 +19,13 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "eigen.h"
 #include "geometry/geometry.h"
+#include "utils/parallel.h"
+
+namespace
+{
+    // the batches are solved in parallel by chunks of this size
+    const int TRIANGULATION_CHUNK_SIZE = 1024;
+}
 /*
 
 triangulation is done by solving
@@ -243,3 +250,99 @@ void Triangulator::computeRegular(const Vector3d p, Vector3d q,
     }
 }
 
+void Triangulator::computeRegularRange(const DirectionBatch & pBatch, const DirectionBatch & qBatch,
+        const int begin, const int end, double * res1, double * res2) const
+{
+    const double * px = pBatch.xVec.data();
+    const double * py = pBatch.yVec.data();
+    const double * pz = pBatch.zVec.data();
+    const double * qx0 = qBatch.xVec.data();
+    const double * qy0 = qBatch.yVec.data();
+    const double * qz0 = qBatch.zVec.data();
+    const double tt = t.dot(t);
+    for (int i = begin; i < end; i++)
+    {
+        // q = R * q
+        const double qx = R(0, 0) * qx0[i] + R(0, 1) * qy0[i] + R(0, 2) * qz0[i];
+        const double qy = R(1, 0) * qx0[i] + R(1, 1) * qy0[i] + R(1, 2) * qz0[i];
+        const double qz = R(2, 0) * qx0[i] + R(2, 1) * qy0[i] + R(2, 2) * qz0[i];
+        const double rx = px[i] + qx;
+        const double ry = py[i] + qy;
+        const double rz = pz[i] + qz;
+        const double tp = t[0] * px[i] + t[1] * py[i] + t[2] * pz[i];
+        const double tq = t[0] * qx + t[1] * qy + t[2] * qz;
+        const double tr = t[0] * rx + t[1] * ry + t[2] * rz;
+        const double rp = rx * px[i] + ry * py[i] + rz * pz[i];
+        const double rq = rx * qx + ry * qy + rz * qz;
+        const double delta = tp*rq - tq*rp;
+        if (res1 != NULL) res1[i] = regDiv(tt * rq - tr * tq, delta);
+        if (res2 != NULL) res2[i] = regDiv(tt * rp - tr * tp, delta);
+    }
+}
+
+void Triangulator::computeRegular(const Vector3dVec & pVec, const Vector3dVec & qVec,
+        double * res1, double * res2,
+        double * jac1, double * jac2) const
+{
+    assert(pVec.size() == qVec.size());
+    if (jac1 == NULL and jac2 == NULL and pVec.size() >= 2 * TRIANGULATION_CHUNK_SIZE)
+    {
+        computeRegular(DirectionBatch(pVec), DirectionBatch(qVec), res1, res2);
+        return;
+    }
+    assert(res1 != NULL or res2 != NULL);
+    if (jac1 != NULL)
+    {
+        assert(res1 != NULL);
+    }
+    if (jac2 != NULL)
+    {
+        assert(res2 != NULL);
+    }
+    for (int i = 0; i < pVec.size(); i++)
+    {
+        computeRegular(pVec[i], qVec[i],
+                res1 != NULL ? res1 + i : NULL,
+                res2 != NULL ? res2 + i : NULL,
+                jac1 != NULL ? jac1 + 6 * i : NULL,
+                jac2 != NULL ? jac2 + 6 * i : NULL);
+    }
+}
+
+void Triangulator::computeRegular(const DirectionBatch & pBatch, const DirectionBatch & qBatch,
+        double * res1, double * res2,
+        double * jac1, double * jac2) const
+{
+    assert(pBatch.size() == qBatch.size());
+    assert(res1 != NULL or res2 != NULL);
+    if (jac1 != NULL)
+    {
+        assert(res1 != NULL);
+    }
+    if (jac2 != NULL)
+    {
+        assert(res2 != NULL);
+    }
+    auto solveChunks = [&](int chunkBegin, int chunkEnd)
+    {
+        const int begin = chunkBegin * TRIANGULATION_CHUNK_SIZE;
+        const int end = min(pBatch.size(), chunkEnd * TRIANGULATION_CHUNK_SIZE);
+        if (jac1 == NULL and jac2 == NULL)
+        {
+            computeRegularRange(pBatch, qBatch, begin, end, res1, res2);
+            return;
+        }
+        for (int i = begin; i < end; i++)
+        {
+            computeRegular(pBatch.get(i), qBatch.get(i),
+                    res1 != NULL ? res1 + i : NULL,
+                    res2 != NULL ? res2 + i : NULL,
+                    jac1 != NULL ? jac1 + 6 * i : NULL,
+                    jac2 != NULL ? jac2 + 6 * i : NULL);
+        }
+    };
+    const int numChunks = (pBatch.size() + TRIANGULATION_CHUNK_SIZE - 1) / TRIANGULATION_CHUNK_SIZE;
+    // small batches are not worth the thread pool
+    if (numChunks <= 1) solveChunks(0, numChunks);
+    else parallelFor(0, numChunks, solveChunks);
+}
@@ -0,0 +1,172 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Compares CornerDetector::computeResponse against the original scalar implementation.
+Usage: corner_response_bench [image1 image2 ...]
+Without arguments synthetic checkerboards of typical calibration image sizes are used.
+*/
+
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "timer.h"
+
+#include "calibration/corner_detector.h"
+
+//the original per-pixel implementation, the loop is the one of the scalar
+//CornerDetector::computeResponse unchanged, including the truncating integer
+//division of the gradient used in the response
+double computeResponseReference(const Mat8u & img, const double SIGMA_1, const double SIGMA_2,
+        Mat32f & resp, Mat32f & imgrad)
+{
+    Mat8u src1, src2;
+    const int FILTER_SIZE_1 = 3;
+    GaussianBlur(img, src1, Size(FILTER_SIZE_1, FILTER_SIZE_1), SIGMA_1, SIGMA_1);
+    const int FILTER_SIZE_2 = 1 + 2 * ceil(SIGMA_2);
+    GaussianBlur(img, src2, Size(FILTER_SIZE_2, FILTER_SIZE_2), SIGMA_2, SIGMA_2);
+    Mat32f gradx(img.size()), grady(img.size());
+    resp.create(img.size());
+    imgrad.create(img.size());
+    imgrad.setTo(0);
+    resp.setTo(0);
+    double acc = 0;
+    int count = 0;
+    const int SIZE = 1;
+    const int HSIZE = 1;
+    for (int v = SIZE; v < img.rows - SIZE; v++)
+    {
+        for (int u = SIZE; u < img.cols - SIZE; u++)
+        {
+            //compute sharp gradient
+            double gxSharp = ( src1(v, u + 1) - src1(v, u - 1)  
+- 0.3*(src2(v, u + 1) - src2(v, u - 1)) ) / 2.;
+            double gySharp = ( src1(v + 1, u) - src1(v - 1, u) 
+- 0.3*(src2(v + 1, u) - src2(v - 1, u)) ) / 2.;
+//            double gxSharp = ( src1(v, u + 1) - src1(v, u - 1) ) / 2.;
+//            double gySharp = ( src1(v + 1, u) - src1(v - 1, u) ) / 2.;
+            gradx(v, u) = gxSharp * 0.01;
+            grady(v, u) = gySharp * 0.01;
+            imgrad(v, u) = sqrt(gxSharp*gxSharp + gySharp*gySharp) * 0.01;
+            
+            
+            
+            
+            //We are looking for saddle points, that is negative hessian determinant
+            double iuu = src2(v, u - SIZE) + src2(v, u + SIZE) - 2* src2(v, u);
+            iuu /= SIZE*SIZE;
+            double ivv = src2(v - SIZE, u) + src2(v + SIZE, u) - 2* src2(v, u);
+            ivv /= SIZE*SIZE;
+            double iuv = src2(v - HSIZE, u - HSIZE) + src2(v + HSIZE, u + HSIZE) 
+                            - src2(v  + HSIZE, u - HSIZE) - src2(v - HSIZE, u + HSIZE);
+            iuv /= 4*HSIZE*HSIZE;
+            
+            double gx = (src2(v, u + HSIZE) - src2(v, u - HSIZE) ) / (2 * HSIZE);
+            double gy = (src2(v + HSIZE, u) - src2(v - HSIZE, u) ) / (2 * HSIZE);
+            double gsq = gx * gx + gy * gy;
+            double _respVal = -iuu * ivv + iuv * iuv - 0.001*pow(gsq, 2);
+            if (_respVal > 0.01) 
+            {
+                resp(v, u) = _respVal;
+                acc += _respVal;
+                count++;
+            }
+        }
+    }
+    return acc / count;
+}
+
+//a slightly rotated and blurred checkerboard with noise
+Mat8u syntheticBoard(int cols, int rows)
+{
+    Mat8u img(rows, cols);
+    const double cellSize = cols / 14.;
+    const double c = cos(0.3), s = sin(0.3);
+    mt19937 gen(42);
+    std::normal_distribution<double> noise(0, 3);
+    for (int v = 0; v < rows; v++)
+    {
+        for (int u = 0; u < cols; u++)
+        {
+            double x = (c * (u - cols / 2) - s * (v - rows / 2)) / cellSize;
+            double y = (s * (u - cols / 2) + c * (v - rows / 2)) / cellSize;
+            int val = ((int(floor(x)) + int(floor(y))) % 2 == 0) ? 200 : 40;
+            img(v, u) = max(0, min(255, int(val + noise(gen))));
+        }
+    }
+    GaussianBlur(img, img, Size(5, 5), 1, 1);
+    return img;
+}
+
+void benchmark(const string & name, const Mat8u & img)
+{
+    const int ITER_COUNT = 10;
+    const double SIGMA_1 = 0.7, SIGMA_2 = 1.4;
+
+    CornerDetector detector(8, 5, 3, false);
+    detector.setImage(img);
+
+    Mat32f respRef, imgradRef;
+    double avgRef;
+    Timer timer;
+    for (int i = 0; i < ITER_COUNT; i++)
+    {
+        avgRef = computeResponseReference(img, SIGMA_1, SIGMA_2, respRef, imgradRef);
+    }
+    double timeRef = timer.elapsed() / ITER_COUNT;
+
+    timer.reset();
+    for (int i = 0; i < ITER_COUNT; i++)
+    {
+        detector.computeResponse(SIGMA_1, SIGMA_2);
+    }
+    double timeNew = timer.elapsed() / ITER_COUNT;
+
+    double respErr = cv::norm(respRef, detector.response(), cv::NORM_INF);
+    double imgradErr = cv::norm(imgradRef, detector.gradientNorm(), cv::NORM_INF);
+
+    cout << name << "  " << img.cols << "x" << img.rows << endl;
+    cout << "    reference : " << timeRef * 1e3 << " ms" << endl;
+    cout << "    new       : " << timeNew * 1e3 << " ms" << "   speed-up : " << timeRef / timeNew << endl;
+    cout << "    max |resp diff| : " << respErr << "   max |imgrad diff| : " << imgradErr << endl;
+    cout << "    avgVal : " << avgRef << " / " << detector.averageResponse() << endl;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            Mat8u img = imread(argv[i], 0);
+            if (img.empty())
+            {
+                cout << argv[i] << " : ERROR, file not found" << endl;
+                continue;
+            }
+            benchmark(argv[i], img);
+        }
+    }
+    else
+    {
+        benchmark("synthetic", syntheticBoard(1280, 960));
+        benchmark("synthetic", syntheticBoard(2048, 1536));
+        benchmark("synthetic", syntheticBoard(4000, 3000));
+    }
+    return 0;
+}
+
@@ -18,6 +18,7 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 #include "io.h"
 #include "ocv.h"
 #include "eigen.h"
+#include "utils/profiler.h"
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
@@ -29,16 +30,32 @@ along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
 using boost::property_tree::ptree;
 using boost::property_tree::read_json;
 
+//Usage: calib [--profile <output_prefix>] <info.json> ...
+//with --profile the stage timings are printed at the end and written to
+//<output_prefix>_trace.json and <output_prefix>_profile.txt
 int main(int argc, char** argv) {
     
     GenericCameraCalibration calibration;
     
+    string profilePrefix;
     for (int i = 1; i < argc; i++)
     {
+        if (string(argv[i]) == "--profile" and i + 1 < argc)
+        {
+            profilePrefix = argv[++i];
+            Profiler::instance().setEnabled(true);
+            continue;
+        }
         calibration.addResiduals(argv[i]);
     }
     
     calibration.compute();
     
+    if (not profilePrefix.empty())
+    {
+        Profiler::instance().writeSummary(cout);
+        Profiler::instance().writeReport(profilePrefix);
+    }
+    
     return 0;
 }
@@ -34,6 +34,7 @@ public:
             vector<Matrix6d> & covVec) const
     {
         trajVec.clear();
+        covVec.clear();
         
         //control covariance
         Matrix2d covVW;
@@ -0,0 +1,153 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Save / load round trip of a map file: keyframe poses and images,
+the active frame with its depth map, and the rejection of damaged files
+*/
+
+#include <unistd.h>
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "test_check.h"
+
+#include "geometry/geometry.h"
+#include "projection/eucm.h"
+#include "localization/map_file.h"
+
+bool samePose(const Transf & xi1, const Transf & xi2)
+{
+    return xi1.trans() == xi2.trans() and xi1.rot() == xi2.rot();
+}
+
+bool sameImage(const Mat8u & img1, const Mat8u & img2)
+{
+    if (img1.rows != img2.rows or img1.cols != img2.cols) return false;
+    for (int v = 0; v < img1.rows; v++)
+    {
+        for (int u = 0; u < img1.cols; u++)
+        {
+            if (img1(v, u) != img2(v, u)) return false;
+        }
+    }
+    return true;
+}
+
+// true if MapFile throws on fileName
+bool rejected(const string & fileName)
+{
+    try
+    {
+        MapFile mapFile(fileName);
+    }
+    catch (const std::runtime_error & e)
+    {
+        cout << "    " << e.what() << endl;
+        return true;
+    }
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    const string fileName = (argc > 1) ? argv[1] : "map_file_test.map";
+    
+    double params[6] = {0.5, 1, 300, 300, 320, 240};
+    EnhancedCamera camera(params);
+    ScaleParameters scaleParams;
+    scaleParams.scale = 2;
+    scaleParams.uMax = 64;
+    scaleParams.vMax = 48;
+    scaleParams.xMax = 32;
+    scaleParams.yMax = 24;
+    const int HYP_COUNT = 2;
+    const int DEPTH_SIZE = scaleParams.xMax * scaleParams.yMax * HYP_COUNT;
+    DepthMap depth(&camera, scaleParams, HYP_COUNT);
+    for (int i = 0; i < DEPTH_SIZE; i++)
+    {
+        depth.at(i) = 0.5 * i;
+        depth.sigma(i) = i;
+        depth.cost(i) = -i;
+    }
+    
+    // an odd width checks the row alignment
+    Mat8u img1(48, 64), img2(48, 63);
+    for (int v = 0; v < 48; v++)
+    {
+        for (int u = 0; u < 64; u++) img1(v, u) = u + v;
+        for (int u = 0; u < 63; u++) img2(v, u) = u * v;
+    }
+    
+    const Transf xi1(1, 2, 3, 0.1, 0.2, 0.3), xi2(4, 5, 6, 0, 0, 0);
+    const Transf xiActive(7, 8, 9, 0, 0, 0.5), xiLocal(0.1, 0, 0, 0, 0, 0.01);
+    {
+        MapWriter writer(fileName);
+        writer.addKeyframe(xi1, img1);
+        writer.addKeyframe(xi2, img2);
+        writer.setActiveFrame(xiActive, img2, depth, xiLocal);
+        writer.close();
+    }
+    
+    cout << "round trip" << endl;
+    {
+        MapFile mapFile(fileName);
+        check(mapFile.keyframeCount() == 2 and mapFile.hasActiveFrame(), "frame count");
+        check(samePose(mapFile.keyframePose(0), xi1) and samePose(mapFile.keyframePose(1), xi2),
+                "keyframe poses");
+        check(sameImage(mapFile.keyframeImage(0), img1) and sameImage(mapFile.keyframeImage(1), img2),
+                "keyframe images");
+        check(samePose(mapFile.activePose(), xiActive) and samePose(mapFile.activeLocalPose(), xiLocal),
+                "active poses");
+        check(sameImage(mapFile.activeImage(), img2), "active image");
+        
+        DepthMap depthLoaded = mapFile.activeDepth().toDepthMap(&camera);
+        check(ScaleParameters(depthLoaded) == scaleParams and depthLoaded.getHypMax() == HYP_COUNT,
+                "depth parameters");
+        bool sameDepth = true;
+        for (int i = 0; i < DEPTH_SIZE; i++)
+        {
+            sameDepth = sameDepth and depthLoaded.at(i) == depth.at(i) 
+                    and depthLoaded.sigma(i) == depth.sigma(i) and depthLoaded.cost(i) == depth.cost(i);
+        }
+        check(sameDepth, "depth values");
+    }
+    
+    cout << "damaged files" << endl;
+    ifstream file(fileName, std::ios::binary);
+    const string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+    
+    check(truncate(fileName.c_str(), content.size() - 8) == 0 and rejected(fileName), "truncated file");
+    check(truncate(fileName.c_str(), sizeof(MapFileHeader) / 2) == 0 and rejected(fileName),
+            "truncated header");
+    
+    string badVersion = content;
+    badVersion[4]++;
+    ofstream(fileName, std::ios::binary) << badVersion;
+    check(rejected(fileName), "unknown version");
+    
+    string badMagic = content;
+    badMagic[0] = 'X';
+    ofstream(fileName, std::ios::binary) << badMagic;
+    check(rejected(fileName), "wrong magic");
+    
+    remove(fileName.c_str());
+    return checkSummary();
+}
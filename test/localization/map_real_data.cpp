@@ -39,10 +39,20 @@ int main(int argc, char** argv)
    
     Transf xiMap;
     bool xiMapInit = false;
+    // a previously saved map replaces the map construction,
+    // the trajectories are relocalized against its keyframes
+    if (root.count("map_input"))
+    {
+        odom.loadMap(root.get<string>("map_input"), false);
+        xiMap = readTransform(root.get_child("xi_map"));
+        xiMapInit = true;
+    }
+    
     // construct the map
     int mapCount = 0;
     for (auto & fileName : root.get_child("map_files"))
     {
+        if (root.count("map_input")) break;
         mapCount++;
         ptree trajectoryData;
         read_json(fileName.second.get_value<string>(), trajectoryData);
@@ -75,6 +85,11 @@ int main(int argc, char** argv)
         fgt.close();
         continue;
     }
+    if (root.count("map_output"))
+    {
+        odom.saveMap(root.get<string>("map_output"));
+        cout << "xi_map : " << xiMap << endl;
+    }
     
     // localize    
     int trajCount = 0;
@@ -1,10 +1,14 @@
 // A test to see how we can perform combined localization and reconstruction
 // Uses the data recorded from the Fluence
+// Usage: mapping <config.json> [--profile <output_prefix>]
+// with --profile the per-frame trace and the stage statistics are written to
+// <output_prefix>_trace.json and <output_prefix>_profile.txt
 
 #include "io.h"
 #include "ocv.h"
 #include "timer.h"
 #include "json.h"
+#include "utils/profiler.h"
 
 #include "reconstruction/eucm_sgm.h"
 #include "reconstruction/eucm_motion_stereo.h"
@@ -36,7 +40,12 @@ int main(int argc, char** argv)
     ptree root;
     read_json(argv[1], root);
     
-    
+    string profilePrefix;
+    if (argc > 3 and string(argv[2]) == "--profile")
+    {
+        profilePrefix = argv[3];
+        Profiler::instance().setEnabled(true);
+    }
     
     PhotometricMapping odom(root);
     //FIXME temporary
@@ -158,9 +167,9 @@ int main(int argc, char** argv)
     
         }
         ofstream fkf("kf" + to_string(trajCount) + ".txt");
-        for (auto & kf : odom._frameVec)
+        for (auto & xi : odom._frameXiVec)
         {
-            fkf << kf.xi << endl;
+            fkf << xi << endl;
         }
         fkf.close();
         trajCount++;
@@ -169,6 +178,12 @@ int main(int argc, char** argv)
     fwo.close();
     fgt.close();
     
+    if (not profilePrefix.empty())
+    {
+        Profiler::instance().writeSummary(cout);
+        Profiler::instance().writeReport(profilePrefix);
+    }
+    
 //    for (int i = 0; i < incrementCount; i++, xi = xi.compose(zeta))
 //    {
 //        device.setCameraTransform(xi.compose(odom._xiBaseCam));
@@ -0,0 +1,312 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Timing of the stereo, tracking and mapping pipelines on a deterministic rendered sequence
+Usage: pipeline_bench <config.json> [output_prefix]
+    pipeline_bench data/pipeline_bench.json     run from the repository root,
+                                                the scene and its textures are in data/pipeline_bench/
+The configuration is the one of the mapping test (render, camera_params, xi_base_camera,
+stereo_parameters, mapping_parameters, program) with an optional "benchmark" node:
+    "scales" : [1, 0.5]         image resolution factors wrt the rendering setting
+    "disparities" : [32, 48]    values of disparity_max
+    "frame_count" : 20          length of the sequence, taken from the first program
+    "repetitions" : 3           every stage is timed that many times per frame
+Writes <output_prefix>.json and <output_prefix>.csv (default prefix is pipeline_bench),
+the per-stage breakdown collected by the profiler goes to <output_prefix>_trace.json
+(Chrome trace-event format) and <output_prefix>_profile.txt
+*/
+
+#include "io.h"
+#include "ocv.h"
+#include "timer.h"
+#include "json.h"
+#include "utils/profiler.h"
+
+#include "reconstruction/eucm_sgm.h"
+#include "reconstruction/eucm_motion_stereo.h"
+#include "reconstruction/depth_map.h"
+
+#include "localization/photometric.h"
+#include "localization/sparse_odom.h"
+#include "localization/mapping.h"
+
+#include "render/render.h"
+
+struct StageStats
+{
+    string stage;
+    double scale;
+    int width, height;
+    int dispMax;
+    vector<double> sampleVec; //seconds
+};
+
+//nearest-rank percentile of a sorted vector
+double percentile(const vector<double> & sortedVec, const double p)
+{
+    if (sortedVec.empty()) return 0;
+    int idx = ceil(p / 100. * sortedVec.size()) - 1;
+    return sortedVec[max(0, min(int(sortedVec.size()) - 1, idx))];
+}
+
+ptree makeArray(const vector<double> & valVec)
+{
+    ptree arrayNode;
+    for (auto & val : valVec)
+    {
+        ptree valNode;
+        valNode.put_value(val);
+        arrayNode.push_back(make_pair("", valNode));
+    }
+    return arrayNode;
+}
+
+//the camera intrinsics and the stereo image size are scaled, the margins are kept
+ptree scaledConfig(const ptree & root, const double factor, const int width, const int height,
+        const int dispMax)
+{
+    ptree config = root;
+    vector<double> cameraParams = readVector<double>(root.get_child("camera_params"));
+    for (int i = 2; i < 6; i++) cameraParams[i] *= factor;
+    config.put_child("camera_params", makeArray(cameraParams));
+    
+    ptree & stereoNode = config.get_child("stereo_parameters");
+    stereoNode.erase("xMax");
+    stereoNode.erase("yMax");
+    stereoNode.erase("equal_margins");
+    stereoNode.put("uMax", width);
+    stereoNode.put("vMax", height);
+    stereoNode.put("equal_margins", true);
+    stereoNode.put("stereo_parameters.disparity_max", dispMax);
+    return config;
+}
+
+class PipelineBenchmark
+{
+public:
+    PipelineBenchmark(const ptree & root, const ptree & world, const double factor, const int dispMax) :
+        _factor(factor),
+        _dispMax(dispMax),
+        _width(round(world.get<int>("width") * factor)),
+        _height(round(world.get<int>("height") * factor)),
+        _config(scaledConfig(root, factor, _width, _height, dispMax)),
+        _camera(_width, _height, readVector<double>(_config.get_child("camera_params")).data()),
+        _xiBaseCam(readTransform(root.get_child("xi_base_camera"))),
+        _repetitions(root.get("benchmark.repetitions", 3))
+    {
+        //render the sequence
+        ptree scaledWorld = world;
+        scaledWorld.put("width", _width);
+        scaledWorld.put("height", _height);
+        RenderDevice device(scaledWorld);
+        device.setCamera(&_camera);
+        
+        const int frameCount = root.get("benchmark.frame_count", 20);
+        const ptree & program = root.get_child("program").begin()->second;
+        Transf xi = readTransform(program.get_child("initial"));
+        for (auto & iteration : program.get_child("trajectory"))
+        {
+            Transf zeta = readTransform(iteration.second.get_child("increment"));
+            const int incrementCount = iteration.second.get<int>("step_count");
+            for (int i = 0; i < incrementCount and _xiVec.size() < frameCount; i++, xi = xi.compose(zeta))
+            {
+                _xiVec.push_back(xi);
+                _imgVec.emplace_back();
+                device.setCameraTransform(xi.compose(_xiBaseCam));
+                device.render(_imgVec.back());
+            }
+        }
+        if (_xiVec.size() < 2) throw runtime_error("pipeline_bench : the sequence is too short");
+    }
+    
+    void run(vector<StageStats> & statsVec)
+    {
+        SgmParameters sgmParams(_config.get_child("stereo_parameters"));
+        MotionStereoParameters motionParams(_config.get_child("stereo_parameters"));
+        StageStats sgmSetup = newStage("sgm_setup"), sgmCompute = newStage("sgm_compute");
+        StageStats motionStereo = newStage("motion_stereo_compute");
+        StageStats photoPose = newStage("photometric_compute_pose");
+        StageStats photoPoseMI = newStage("photometric_compute_pose_mi");
+        StageStats sparseFeed = newStage("sparse_odometry_feed_data");
+        StageStats mappingFeed = newStage("mapping_feed_image");
+        
+        for (int rep = 0; rep < _repetitions; rep++)
+        {
+            for (int k = 1; k < _xiVec.size(); k++)
+            {
+                const Mat8u & img1 = _imgVec[k - 1];
+                const Mat8u & img2 = _imgVec[k];
+                const Transf zeta = _xiVec[k - 1].inverseCompose(_xiVec[k]);
+                const Transf T12 = _xiBaseCam.inverseCompose(zeta).compose(_xiBaseCam);
+                
+                Timer timer;
+                EnhancedSgm sgm(T12, &_camera, &_camera, sgmParams);
+                sgmSetup.sampleVec.push_back(timer.elapsed());
+                
+                DepthMap depth;
+                timer.reset();
+                sgm.computeStereo(img1, img2, depth);
+                sgmCompute.sampleVec.push_back(timer.elapsed());
+                
+                MotionStereo motion(&_camera, &_camera, motionParams);
+                motion.setBaseImage(img1);
+                timer.reset();
+                DepthMap depthMotion = motion.compute(T12, img2, depth);
+                motionStereo.sampleVec.push_back(timer.elapsed());
+                
+                //the tracking starts from a fixed perturbation of the true motion
+                const Transf zetaInit = zeta.compose(Transf(0.01, -0.01, 0.02, 0.002, -0.002, 0.003));
+                ScalePhotometric localizer(5, &_camera);
+                localizer.setVerbosity(0);
+                localizer.setXiBaseCam(_xiBaseCam);
+                localizer.setBaseImage(img1);
+                localizer.setDepth(depth);
+                localizer.setTargetImage(img2);
+                timer.reset();
+                localizer.computePose(zetaInit);
+                photoPose.sampleVec.push_back(timer.elapsed());
+                
+                timer.reset();
+                localizer.computePoseMI(zetaInit);
+                photoPoseMI.sampleVec.push_back(timer.elapsed());
+            }
+            
+            SparseOdometry sparseOdom(&_camera, _xiBaseCam);
+            for (int k = 0; k < _xiVec.size(); k++)
+            {
+                Timer timer;
+                sparseOdom.feedData(_imgVec[k], _xiVec[k]);
+                sparseFeed.sampleVec.push_back(timer.elapsed());
+            }
+            
+            PhotometricMapping mapping(_config);
+            mapping.reInit(_xiVec[0]);
+            for (int k = 0; k < _xiVec.size(); k++)
+            {
+                mapping.feedOdometry(_xiVec[k]);
+                Timer timer;
+                mapping.feedImage(_imgVec[k]);
+                mapping.waitMapping();
+                mappingFeed.sampleVec.push_back(timer.elapsed());
+            }
+        }
+        
+        for (auto stats : {sgmSetup, sgmCompute, motionStereo, photoPose, photoPoseMI, sparseFeed, mappingFeed})
+        {
+            statsVec.push_back(stats);
+        }
+    }
+    
+private:
+    StageStats newStage(const string & name) const
+    {
+        StageStats stats;
+        stats.stage = name;
+        stats.scale = _factor;
+        stats.width = _width;
+        stats.height = _height;
+        stats.dispMax = _dispMax;
+        return stats;
+    }
+    
+    double _factor;
+    int _dispMax;
+    int _width, _height;
+    ptree _config;
+    EnhancedCamera _camera;
+    Transf _xiBaseCam;
+    int _repetitions;
+    vector<Transf> _xiVec;
+    vector<Mat8u> _imgVec;
+};
+
+void writeResults(const string & prefix, vector<StageStats> & statsVec)
+{
+    ofstream jsonFile(prefix + ".json");
+    ofstream csvFile(prefix + ".csv");
+    csvFile << "stage,scale,width,height,disp_max,count,mean_ms,p50_ms,p90_ms,p99_ms,max_ms" << endl;
+    jsonFile << "{" << endl << "  \"results\" : [" << endl;
+    for (int i = 0; i < statsVec.size(); i++)
+    {
+        StageStats & stats = statsVec[i];
+        vector<double> & sampleVec = stats.sampleVec;
+        sort(sampleVec.begin(), sampleVec.end());
+        double mean = 0;
+        for (auto & t : sampleVec) mean += t;
+        if (not sampleVec.empty()) mean /= sampleVec.size();
+        const double maxVal = sampleVec.empty() ? 0 : sampleVec.back();
+        const array<double, 5> msArr = {mean * 1e3, percentile(sampleVec, 50) * 1e3,
+                percentile(sampleVec, 90) * 1e3, percentile(sampleVec, 99) * 1e3, maxVal * 1e3};
+        
+        csvFile << stats.stage << "," << stats.scale << "," << stats.width << "," << stats.height 
+            << "," << stats.dispMax << "," << sampleVec.size();
+        for (auto & val : msArr) csvFile << "," << val;
+        csvFile << endl;
+        
+        jsonFile << "    {\"stage\" : \"" << stats.stage << "\", \"scale\" : " << stats.scale
+            << ", \"width\" : " << stats.width << ", \"height\" : " << stats.height
+            << ", \"disp_max\" : " << stats.dispMax << ", \"count\" : " << sampleVec.size()
+            << ", \"mean_ms\" : " << msArr[0] << ", \"p50_ms\" : " << msArr[1]
+            << ", \"p90_ms\" : " << msArr[2] << ", \"p99_ms\" : " << msArr[3]
+            << ", \"max_ms\" : " << msArr[4] << "}" << (i + 1 < statsVec.size() ? "," : "") << endl;
+        
+        cout << setw(30) << stats.stage << setw(6) << stats.scale << setw(5) << stats.dispMax
+            << "   p50 " << setw(10) << msArr[1] << " ms   p90 " << setw(10) << msArr[2] << " ms" << endl;
+    }
+    jsonFile << "  ]" << endl << "}" << endl;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        cout << "Usage: pipeline_bench <config.json> [output_prefix]" << endl;
+        return 1;
+    }
+    ptree root;
+    read_json(argv[1], root);
+    ptree world;
+    read_json(root.get<string>("render"), world);
+    const string prefix = (argc > 2) ? argv[2] : "pipeline_bench";
+    
+    vector<double> scaleVec = {1};
+    vector<int> dispVec = {SgmParameters(root.get_child("stereo_parameters")).dispMax};
+    if (root.get_child_optional("benchmark.scales")) 
+    {
+        scaleVec = readVector<double>(root.get_child("benchmark.scales"));
+    }
+    if (root.get_child_optional("benchmark.disparities"))
+    {
+        dispVec = readVector<int>(root.get_child("benchmark.disparities"));
+    }
+    
+    Profiler::instance().setEnabled(true);
+    vector<StageStats> statsVec;
+    for (auto & factor : scaleVec)
+    {
+        for (auto & dispMax : dispVec)
+        {
+            PipelineBenchmark benchmark(root, world, factor, dispMax);
+            benchmark.run(statsVec);
+        }
+    }
+    writeResults(prefix, statsVec);
+    Profiler::instance().writeReport(prefix);
+    return 0;
+}
+
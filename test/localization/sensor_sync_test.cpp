@@ -0,0 +1,137 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Checks the SpscQueue ordering and drop accounting,
+the pose interpolation and the odometry gap of SensorSync
+*/
+
+#include <thread>
+
+#include "std.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "test_check.h"
+
+#include "geometry/geometry.h"
+#include "utils/spsc_queue.h"
+#include "localization/sensor_sync.h"
+
+void testQueue()
+{
+    cout << "SpscQueue" << endl;
+    SpscQueue<int> queue(4);
+    int val;
+    check(not queue.pop(val), "empty queue");
+    
+    for (int i = 0; i < 3; i++) queue.push(i);
+    bool ordered = true;
+    for (int i = 0; i < 3; i++) ordered = ordered and queue.pop(val) and val == i;
+    check(ordered and not queue.pop(val), "ordering");
+    
+    // 3 pushed so far, the oldest elements are overwritten
+    for (int i = 3; i < 13; i++) queue.push(i);
+    check(queue.size() == 4 and queue.droppedCount() == 6, "overwrite the oldest");
+    queue.pop(val);
+    check(val == 9, "pop after overwrite");
+    
+    // overwrite while the consumer is in the middle of the queue
+    for (int i = 13; i < 16; i++) queue.push(i);
+    vector<int> valVec;
+    while (queue.pop(val)) valVec.push_back(val);
+    check(valVec == vector<int>({12, 13, 14, 15}), "overwrite after a pop");
+    check(4 + valVec.size() + queue.droppedCount() == 16, "popped + dropped == pushed");
+    
+    // concurrent producer, the consumer must get an increasing sequence
+    // and every element must be accounted for
+    const int PUSH_COUNT = 1000000;
+    SpscQueue<int> concurrentQueue(16);
+    std::thread producer([&]()
+    {
+        for (int i = 0; i < PUSH_COUNT; i++) concurrentQueue.push(i);
+    });
+    int popCount = 0;
+    int last = -1;
+    bool increasing = true;
+    while (last < PUSH_COUNT - 1)
+    {
+        if (not concurrentQueue.pop(val)) continue;
+        increasing = increasing and val > last;
+        last = val;
+        popCount++;
+    }
+    producer.join();
+    check(increasing, "concurrent ordering");
+    check(popCount + concurrentQueue.droppedCount() + concurrentQueue.size() == PUSH_COUNT,
+            "concurrent popped + dropped == pushed");
+}
+
+void testInterpolation()
+{
+    cout << "interpolatePose" << endl;
+    TimedPose pose0{1, Transf(0, 0, 0, 0, 0, 0)};
+    TimedPose pose1{3, Transf(1, 2, 0, 0, 0, 0.2)};
+    Transf xi = interpolatePose(pose0, pose1, 1);
+    check((xi.trans() - pose0.xi.trans()).norm() < 1e-12, "start");
+    xi = interpolatePose(pose0, pose1, 3);
+    check((xi.trans() - pose1.xi.trans()).norm() < 1e-12 and
+            (xi.rot() - pose1.xi.rot()).norm() < 1e-12, "end");
+    xi = interpolatePose(pose0, pose1, 2);
+    check(abs(xi.rot()[2] - 0.1) < 1e-12, "middle rotation");
+    xi = interpolatePose(pose1, pose1, 2);
+    check((xi.trans() - pose1.xi.trans()).norm() < 1e-12, "degenerate interval");
+}
+
+void testSync()
+{
+    cout << "SensorSync" << endl;
+    SensorSyncParameters params;
+    params.maxOdometryGap = 0.125;
+    SensorSync sync(params);
+    
+    const Mat8u img(4, 4);
+    TimedImage image;
+    Transf xi;
+    
+    sync.pushImage(0.0625, img);
+    sync.pushImage(0.125, img);
+    sync.pushImage(0.5, img);
+    sync.pushImage(0.75, img);
+    check(not sync.pop(image, xi), "wait for the odometry");
+    
+    sync.pushOdometry(0, Transf(0, 0, 0, 0, 0, 0));
+    sync.pushOdometry(0.25, Transf(1, 0, 0, 0, 0, 0));
+    sync.pushOdometry(0.5, Transf(2, 0, 0, 0, 0, 0));
+    sync.pushOdometry(1, Transf(4, 0, 0, 0, 0, 0));
+    
+    // 0.0625 is 0.1875 away from the next measurement
+    check(sync.pop(image, xi) and image.time == 0.125, "one side too far");
+    check(abs(xi.trans()[0] - 0.5) < 1e-12, "interpolated pose");
+    // the measurements around 0.5 are 0.5 apart but one of them is exact
+    check(sync.pop(image, xi) and image.time == 0.5 and xi.trans()[0] == 2, "exact measurement");
+    // 0.75 is 0.25 away from both measurements
+    check(not sync.pop(image, xi), "both sides too far");
+    check(sync.droppedImageCount() == 2, "unmatched images counted");
+}
+
+int main(int argc, char** argv)
+{
+    testQueue();
+    testInterpolation();
+    testSync();
+    return checkSummary();
+}
@@ -0,0 +1,132 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Compares the sub-pixel BilinearSampler with the nearest-neighbour sampling
+on a linear gradient, where the bilinear interpolation is exact
+*/
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "test_check.h"
+
+#include "utils/curve_rasterizer.h"
+#include "utils/curve_sampler.h"
+
+const int IMAGE_WIDTH = 50;
+const int IMAGE_HEIGHT = 40;
+const double GRAD_U = 2;
+const double GRAD_V = 3;
+
+double gradient(const double u, const double v)
+{
+    return GRAD_U * u + GRAD_V * v;
+}
+
+struct SampleError
+{
+    double maxBilinear = 0, meanBilinear = 0;
+    double maxNearest = 0, meanNearest = 0;
+    int count = 0;
+
+    void add(const Mat8u & img, const BilinearSampler & sampler, const double u, const double v)
+    {
+        const double bilinearErr = abs(sampler(u, v) - gradient(u, v));
+        const double nearestErr = abs(img(round(v), round(u)) - gradient(u, v));
+        maxBilinear = max(maxBilinear, bilinearErr);
+        maxNearest = max(maxNearest, nearestErr);
+        meanBilinear += bilinearErr;
+        meanNearest += nearestErr;
+        count++;
+    }
+
+    void finish()
+    {
+        meanBilinear /= count;
+        meanNearest /= count;
+        cout << "bilinear : max " << maxBilinear << " mean " << meanBilinear << endl;
+        cout << "nearest  : max " << maxNearest << " mean " << meanNearest << endl;
+    }
+};
+
+int main(int argc, char** argv)
+{
+    Mat8u img(IMAGE_HEIGHT, IMAGE_WIDTH);
+    for (int v = 0; v < IMAGE_HEIGHT; v++)
+    {
+        for (int u = 0; u < IMAGE_WIDTH; u++)
+        {
+            img(v, u) = gradient(u, v);
+        }
+    }
+    BilinearSampler sampler(img);
+
+    // the pixel centers are sampled exactly
+    bool exact = true;
+    for (int v = 0; v < IMAGE_HEIGHT - 1; v++)
+    {
+        for (int u = 0; u < IMAGE_WIDTH - 1; u++)
+        {
+            exact = exact and sampler(u, v) == img(v, u);
+        }
+    }
+    check(exact, "pixel centers");
+
+    check(sampler.inside(0, 0) and sampler.inside(IMAGE_WIDTH - 1.1, IMAGE_HEIGHT - 1.1)
+            and not sampler.inside(-0.1, 0) and not sampler.inside(0, IMAGE_HEIGHT - 1),
+            "interpolation domain");
+
+    // the position is rounded to 1/16 px and the value to an integer
+    const double tolerance = 0.5 + (GRAD_U + GRAD_V) / (2 * BilinearSampler::SUBPIXEL_COUNT);
+
+    // random sub-pixel positions
+    mt19937 gen(42);
+    std::uniform_real_distribution<double> uDist(0, IMAGE_WIDTH - 1.1), vDist(0, IMAGE_HEIGHT - 1.1);
+    SampleError randomError;
+    for (int i = 0; i < 10000; i++)
+    {
+        randomError.add(img, sampler, uDist(gen), vDist(gen));
+    }
+    randomError.finish();
+    check(randomError.maxBilinear <= tolerance, "random positions, bilinear max error");
+    check(randomError.meanBilinear < 0.5 * randomError.meanNearest,
+            "random positions, bilinear better than nearest");
+
+    // along a circle with quarter-pixel steps, the way the motion stereo samples the epipolar curves
+    const int r = 12;
+    Polynomial2 circle = Polynomial2::Circle(IMAGE_WIDTH / 2, IMAGE_HEIGHT / 2, r);
+    CurveSampler<Polynomial2> curve(Vector2d(IMAGE_WIDTH / 2 + r + 0.3, IMAGE_HEIGHT / 2),
+            Vector2d(IMAGE_WIDTH / 2, 0), circle);
+    curve.setStep(0.25);
+    SampleError curveError;
+    bool onCurve = true;
+    for (int i = 0; i < 300; i++, curve.step())
+    {
+        const double radius = hypot(curve.u - IMAGE_WIDTH / 2, curve.v - IMAGE_HEIGHT / 2);
+        onCurve = onCurve and abs(radius - r) < 1e-2;
+        curveError.add(img, sampler, curve.u, curve.v);
+    }
+    curveError.finish();
+    check(onCurve, "curve sampler stays on the curve");
+    check(curveError.maxBilinear <= tolerance, "circle, bilinear max error");
+    check(curveError.meanBilinear < 0.5 * curveError.meanNearest,
+            "circle, bilinear better than nearest");
+
+    return checkSummary();
+}
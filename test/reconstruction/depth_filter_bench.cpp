@@ -0,0 +1,152 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Compares DepthMap::filterNoise against the original implementation
+on synthetic depth maps of typical sizes
+*/
+
+#include "io.h"
+#include "std.h"
+#include "eigen.h"
+#include "timer.h"
+
+#include "projection/eucm.h"
+#include "reconstruction/depth_map.h"
+
+//the original implementation, which works on a full copy of the depth map
+void filterNoiseReference(DepthMap & depth)
+{
+    const int minMatches = 2;
+    DepthMap myCopy = depth;
+
+    const array<int, 8> dxArr =  {-1,  0,  1,  1,  1,  0, -1, -1};
+    const array<int, 8> dyArr  = { 1,  1,  1,  0, -1, -1, -1,  0};
+    
+    const int CENTRAL_WEIGHT = 5;
+    for (int y = 1; y < depth.getHeight() - 1; ++y)
+    {
+        for (int x = 1; x < depth.getWidth() - 1; ++x)
+        {
+            double depthVal = myCopy.at(x, y);
+            if (depthVal == OUT_OF_RANGE) continue;
+            double sigmaVal = myCopy.sigma(x, y);
+            int countFilled = 0, countMatches = 0;
+            double acc = depthVal * CENTRAL_WEIGHT;
+            for (int i = 0; i < 8; i++)
+            {
+                int x2 = x + dxArr[i];
+                int y2 = y + dyArr[i];
+                double neighDepthVal = myCopy.at(x2, y2);
+                if (neighDepthVal == OUT_OF_RANGE) continue;
+                countFilled++;
+                double err = abs(depthVal - neighDepthVal);
+                if (err > sigmaVal or err > 3*myCopy.sigma(x2, y2)) continue;
+                countMatches++;
+                acc += neighDepthVal;
+            }
+            if (countMatches < minMatches and countMatches < countFilled or countFilled < 2)
+            {
+                depth.at(x, y) = OUT_OF_RANGE;
+                depth.sigma(x, y) = OUT_OF_RANGE;
+            }
+            else
+            {
+                depth.at(x, y) = acc / (countMatches + CENTRAL_WEIGHT);
+            }
+        }
+    }
+}
+
+//piecewise planar depth with noise, outliers and holes
+DepthMap syntheticDepth(const ICamera * camera, int width, int height)
+{
+    ScaleParameters params;
+    params.scale = 1;
+    params.uMax = width;
+    params.vMax = height;
+    params.xMax = width;
+    params.yMax = height;
+    DepthMap depth(camera, params);
+    mt19937 gen(42);
+    std::normal_distribution<double> noise(0, 0.05);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            const double r = uniform(gen);
+            if (r < 0.15) continue; // hole
+            double d = (x < width / 2) ? 2 + 0.002 * y : 5 - 0.001 * x;
+            if (r > 0.95) d = 0.5 + 10 * uniform(gen); // outlier
+            depth.at(x, y) = d + noise(gen);
+            depth.sigma(x, y) = 0.1 + 0.1 * uniform(gen);
+        }
+    }
+    return depth;
+}
+
+void benchmark(const ICamera * camera, int width, int height)
+{
+    const int ITER_COUNT = 20;
+    const DepthMap depth = syntheticDepth(camera, width, height);
+    
+    DepthMap depthRef(depth), depthNew(depth);
+    double timeRef = 0, timeNew = 0;
+    for (int i = 0; i < ITER_COUNT; i++)
+    {
+        depthRef = depth;
+        Timer timer;
+        filterNoiseReference(depthRef);
+        timeRef += timer.elapsed();
+        
+        depthNew = depth;
+        timer.reset();
+        depthNew.filterNoise();
+        timeNew += timer.elapsed();
+    }
+    
+    int diffCount = 0;
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            if (depthRef.at(x, y) != depthNew.at(x, y) or depthRef.sigma(x, y) != depthNew.sigma(x, y))
+            {
+                diffCount++;
+            }
+        }
+    }
+    
+    cout << width << "x" << height << endl;
+    cout << "    reference : " << timeRef / ITER_COUNT * 1e3 << " ms" << endl;
+    cout << "    new       : " << timeNew / ITER_COUNT * 1e3 << " ms" 
+            << "   speed-up : " << timeRef / timeNew << endl;
+    cout << "    different pixels : " << diffCount << endl;
+}
+
+int main(int argc, char** argv)
+{
+    const array<double, 6> cameraParams = {0.5, 1, 300, 300, 320, 240};
+    EnhancedCamera camera(640, 480, cameraParams.data());
+    benchmark(&camera, 160, 120);
+    benchmark(&camera, 320, 240);
+    benchmark(&camera, 640, 480);
+    benchmark(&camera, 1280, 960);
+    return 0;
+}
+
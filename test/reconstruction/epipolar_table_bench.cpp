@@ -0,0 +1,146 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Compares EpipolarTable against the CurveRasterizer tracing of the epipolar curves:
+deviation of the sampled pixels and time for different grid densities
+*/
+
+#include "std.h"
+#include "io.h"
+#include "eigen.h"
+#include "timer.h"
+
+#include "geometry/geometry.h"
+#include "projection/eucm.h"
+#include "reconstruction/eucm_epipolar.h"
+#include "reconstruction/epipolar_table.h"
+#include "utils/curve_rasterizer.h"
+
+const int IMAGE_WIDTH = 640;
+const int IMAGE_HEIGHT = 480;
+const int HALF_LENGTH = 20;
+const int LENGTH = 88;
+const int EPIPOLE_MARGIN = 2500;  // squared distance, the StereoParameters default
+
+bool inImage(int u, int v)
+{
+    return u >= 0 and u < IMAGE_WIDTH and v >= 0 and v < IMAGE_HEIGHT;
+}
+
+void benchmark(const EnhancedCamera & camera, const Transf & T12, int gridStep)
+{
+    EnhancedEpipolar curves(&camera, &camera, T12, 2000);
+    StereoEpipoles epipoles(&camera, &camera, T12);
+    const Matrix3d R21 = T12.rotMatInv();
+    
+    Vector3dVec X1Vec, X2Vec;
+    vector<Vector2i> pinfVec;
+    for (int v = gridStep / 2; v < IMAGE_HEIGHT; v += gridStep)
+    {
+        for (int u = gridStep / 2; u < IMAGE_WIDTH; u += gridStep)
+        {
+            Vector3d X1;
+            if (not camera.reconstructPoint(Vector2d(u, v), X1)) continue;
+            Vector3d X2 = R21 * X1;
+            Vector2d pinf;
+            if (not camera.projectPoint(X2, pinf)) continue;
+            //the curves are not defined close to the epipoles
+            if (epipoles.chooseEpipole(CAMERA_1, Vector2i(u, v), EPIPOLE_MARGIN) & EPIPOLE_TOO_CLOSE) continue;
+            if (epipoles.chooseEpipole(CAMERA_2, round(pinf), EPIPOLE_MARGIN) & EPIPOLE_TOO_CLOSE) continue;
+            X1Vec.push_back(X1);
+            X2Vec.push_back(X2);
+            pinfVec.push_back(round(pinf));
+        }
+    }
+    
+    //reference pixels, -1 out of the image
+    const int count = X1Vec.size();
+    vector<int> uRefVec(count * LENGTH), vRefVec(count * LENGTH);
+    Timer timer;
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t inv = epipoles.chooseEpipole(CAMERA_2, pinfVec[i], 0);
+        CurveRasterizer<int, Polynomial2> raster(pinfVec[i], epipoles.getPx(CAMERA_2, inv),
+                curves.get(CAMERA_2, X1Vec[i]));
+        if (inv & EPIPOLE_INVERTED) raster.setStep(-1);
+        raster.steps(-HALF_LENGTH);
+        for (int k = 0; k < LENGTH; k++, raster.step())
+        {
+            bool valid = inImage(raster.u, raster.v);
+            uRefVec[i * LENGTH + k] = valid ? raster.u : -1;
+            vRefVec[i * LENGTH + k] = valid ? raster.v : -1;
+        }
+    }
+    const double timeRef = timer.elapsed();
+    
+    //the first pass builds the plane sequences
+    EpipolarTable table(&camera, IMAGE_WIDTH, IMAGE_HEIGHT);
+    table.setTransformation(curves, T12);
+    double timeTable[2];
+    double sumDev = 0, maxDev = 0;
+    int devCount = 0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        timer.reset();
+        for (int i = 0; i < count; i++)
+        {
+            EpipolarRaster raster = table.raster(X1Vec[i], X2Vec[i]);
+            raster.steps(-HALF_LENGTH);
+            //the table skips the parts of the curves out of the image,
+            //so the sequences are only compared until one of them leaves it
+            bool inside = true;
+            for (int k = 0; k < LENGTH; k++, raster.step())
+            {
+                inside = inside and raster.u >= 0 and uRefVec[i * LENGTH + k] >= 0;
+                if (pass == 0 or not inside) continue;
+                double dev = max(abs(raster.u - uRefVec[i * LENGTH + k]),
+                                abs(raster.v - vRefVec[i * LENGTH + k]));
+                sumDev += dev;
+                maxDev = max(maxDev, dev);
+                devCount++;
+            }
+        }
+        timeTable[pass] = timer.elapsed();
+    }
+    
+    cout << "    grid step " << gridStep << ", " << count << " pixels" << endl;
+    cout << "        rasterizer  : " << timeRef * 1e3 << " ms" << endl;
+    cout << "        table cold  : " << timeTable[0] * 1e3 << " ms" << endl;
+    cout << "        table warm  : " << timeTable[1] * 1e3 << " ms" << endl;
+    cout << "        deviation   : mean " << sumDev / max(devCount, 1) << " max " << maxDev << " px" << endl;
+}
+
+int main(int argc, char** argv)
+{
+    double params[6] = {0.6, 1.0, 300, 300, 320, 240};
+    EnhancedCamera camera(params);
+    vector<Transf> transfVec = {
+        Transf(0.3, 0.05, 0.1, 0.02, -0.03, 0.01),
+        Transf(0.02, 0.01, 0.4, 0.01, 0.02, -0.05),
+        Transf(-0.1, 0.2, -0.3, 0.1, 0.0, 0.03)
+    };
+    for (auto & T12 : transfVec)
+    {
+        cout << "T12 : " << T12 << endl;
+        for (int gridStep : {8, 2, 1})
+        {
+            benchmark(camera, T12, gridStep);
+        }
+    }
+    return 0;
+}
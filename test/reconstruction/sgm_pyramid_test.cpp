@@ -0,0 +1,160 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Accuracy of the coarse-to-fine SGM against the flat one on a synthetic scene:
+a textured plane parallel to the image plane seen by two translated cameras
+*/
+
+#include "std.h"
+#include "io.h"
+#include "ocv.h"
+#include "eigen.h"
+#include "json.h"
+#include "timer.h"
+#include "test_check.h"
+
+#include "geometry/geometry.h"
+#include "projection/eucm.h"
+#include "reconstruction/eucm_sgm.h"
+#include "reconstruction/depth_map.h"
+
+const int IMAGE_WIDTH = 640;
+const int IMAGE_HEIGHT = 480;
+const double PLANE_DEPTH = 3;
+const double CELL_SIZE = 0.03;  // texture grain on the plane, about 3 px
+
+// value noise: bilinear interpolation of random values on a grid
+double texture(const double x, const double y)
+{
+    auto hash = [](int64_t i, int64_t j) -> double
+    {
+        uint64_t h = uint64_t(i * 73856093) ^ uint64_t(j * 19349663);
+        h ^= h >> 13;
+        h *= 0x5bd1e995;
+        h ^= h >> 15;
+        return (h % 256) / 255.;
+    };
+    const double xs = x / CELL_SIZE, ys = y / CELL_SIZE;
+    const int64_t i = floor(xs), j = floor(ys);
+    const double a = xs - i, b = ys - j;
+    return (1 - a) * (1 - b) * hash(i, j) + a * (1 - b) * hash(i + 1, j)
+            + (1 - a) * b * hash(i, j + 1) + a * b * hash(i + 1, j + 1);
+}
+
+// the plane z = PLANE_DEPTH in the first camera frame seen from the camera xi
+void renderPlane(const EnhancedCamera & camera, const Transf & xi, Mat8u & img)
+{
+    img.create(IMAGE_HEIGHT, IMAGE_WIDTH);
+    const Matrix3d R = xi.rotMat();
+    const Vector3d t = xi.trans();
+    for (int v = 0; v < IMAGE_HEIGHT; v++)
+    {
+        for (int u = 0; u < IMAGE_WIDTH; u++)
+        {
+            Vector3d ray;
+            img(v, u) = 0;
+            if (not camera.reconstructPoint(Vector2d(u, v), ray)) continue;
+            ray = R * ray;
+            if (ray[2] < 1e-3) continue;
+            const double s = (PLANE_DEPTH - t[2]) / ray[2];
+            img(v, u) = 30 + 200 * texture(t[0] + s * ray[0], t[1] + s * ray[1]);
+        }
+    }
+}
+
+struct Accuracy
+{
+    double medianError = 0;  // relative to the ground truth
+    double goodRatio = 0;    // pixels with a relative error below 5%
+    double time = 0;
+};
+
+Accuracy evaluate(const EnhancedCamera & camera, const Transf & T12, const SgmParameters & params,
+        const Mat8u & img1, const Mat8u & img2)
+{
+    EnhancedSgm sgm(T12, &camera, &camera, params);
+    DepthMap depth;
+    sgm.computeStereo(img1, img2, depth);  // the caches are filled by the first run
+    Timer timer;
+    sgm.computeStereo(img1, img2, depth);
+    Accuracy result;
+    result.time = timer.elapsed();
+    
+    vector<double> errorVec;
+    int pixelCount = 0;
+    for (int y = 0; y < params.yMax; y++)
+    {
+        for (int x = 0; x < params.xMax; x++)
+        {
+            Vector3d ray;
+            if (not camera.reconstructPoint(Vector2d(params.uConv(x), params.vConv(y)), ray)) continue;
+            pixelCount++;
+            if (depth.at(x, y) < MIN_DEPTH) continue;
+            const double depthGT = PLANE_DEPTH * ray.norm() / ray[2];
+            errorVec.push_back(abs(depth.at(x, y) - depthGT) / depthGT);
+        }
+    }
+    if (errorVec.empty()) return result;
+    sort(errorVec.begin(), errorVec.end());
+    result.medianError = errorVec[errorVec.size() / 2];
+    result.goodRatio = double(std::lower_bound(errorVec.begin(), errorVec.end(), 0.05) - errorVec.begin())
+            / pixelCount;
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    double cameraParams[6] = {0.6, 1.0, 300, 300, 320, 240};
+    EnhancedCamera camera(IMAGE_WIDTH, IMAGE_HEIGHT, cameraParams);
+    
+    ptree root;
+    root.put("scale", 2);
+    root.put("u0", 20);
+    root.put("v0", 20);
+    root.put("uMax", IMAGE_WIDTH);
+    root.put("vMax", IMAGE_HEIGHT);
+    root.put("equal_margins", true);
+    root.put_child("stereo_parameters", ptree());
+    root.put_child("sgm_stereo_parameters", ptree());
+    SgmParameters flatParams(root);
+    flatParams.dispMax = 64;
+    flatParams.salientPoints = false;
+    
+    SgmParameters pyramidParams(flatParams);
+    pyramidParams.pyramidLevels = 2;
+    
+    // the disparity on the plane goes from about 20 to 30 px, 
+    // so that it is not centered in the search range
+    const Transf T12(0.25, 0.02, 0, 0, 0, 0);
+    Mat8u img1, img2;
+    renderPlane(camera, Transf(0, 0, 0, 0, 0, 0), img1);
+    renderPlane(camera, T12, img2);
+    
+    Accuracy flat = evaluate(camera, T12, flatParams, img1, img2);
+    Accuracy pyramid = evaluate(camera, T12, pyramidParams, img1, img2);
+    
+    cout << "flat    : median error " << flat.medianError * 100 << " %, within 5% : "
+            << flat.goodRatio * 100 << " %, " << flat.time * 1e3 << " ms" << endl;
+    cout << "pyramid : median error " << pyramid.medianError * 100 << " %, within 5% : "
+            << pyramid.goodRatio * 100 << " %, " << pyramid.time * 1e3 << " ms" << endl;
+    
+    // the pyramid must not lose more than a few pixels nor be less accurate
+    check(pyramid.goodRatio > 0.95 * flat.goodRatio, "pyramid, pixels within 5%");
+    check(pyramid.medianError < 1.2 * flat.medianError + 1e-3, "pyramid, median error");
+    return checkSummary();
+}
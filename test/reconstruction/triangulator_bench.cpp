@@ -0,0 +1,104 @@
+/*
+This file is part of visgeom.
+
+visgeom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+visgeom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with visgeom.  If not, see <http://www.gnu.org/licenses/>.
+*/ 
+
+/*
+Compares the batched Triangulator::computeRegular against the scalar one,
+with and without the jacobians,
+on random ray pairs
+*/
+
+#include "io.h"
+#include "std.h"
+#include "eigen.h"
+#include "timer.h"
+
+#include "geometry/geometry.h"
+#include "reconstruction/triangulator.h"
+
+void benchmark(const Triangulator & triangulator, const Transf & T12, int count)
+{
+    const int ITER_COUNT = 10;
+    mt19937 gen(42);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    Vector3dVec pVec(count), qVec(count);
+    for (int i = 0; i < count; i++)
+    {
+        Vector3d X(3 * uniform(gen), 3 * uniform(gen), 7 + 5 * uniform(gen));
+        Vector3d X2;
+        T12.inverseTransform(X, X2);
+        pVec[i] = X.normalized();
+        qVec[i] = X2 + 0.01 * Vector3d(uniform(gen), uniform(gen), uniform(gen));
+    }
+    const DirectionBatch pBatch(pVec), qBatch(qVec);
+    
+    vector<double> lambdaRef(count), lambdaNew(count);
+    double timeRef = 0, timeNew = 0;
+    for (int iter = 0; iter < ITER_COUNT; iter++)
+    {
+        Timer timer;
+        for (int i = 0; i < count; i++)
+        {
+            triangulator.computeRegular(pVec[i], qVec[i], &lambdaRef[i]);
+        }
+        timeRef += timer.elapsed();
+        
+        timer.reset();
+        triangulator.computeRegular(pBatch, qBatch, lambdaNew.data());
+        timeNew += timer.elapsed();
+    }
+    
+    double maxDiff = 0;
+    for (int i = 0; i < count; i++)
+    {
+        maxDiff = max(maxDiff, abs(lambdaRef[i] - lambdaNew[i]) / abs(lambdaRef[i]));
+    }
+    
+    cout << count << " points" << endl;
+    cout << "    scalar  : " << timeRef / ITER_COUNT * 1e3 << " ms" << endl;
+    cout << "    batched : " << timeNew / ITER_COUNT * 1e3 << " ms" 
+            << "   speed-up : " << timeRef / timeNew << endl;
+    cout << "    max relative difference : " << maxDiff << endl;
+    
+    // with the jacobians, as in the cost functions, the vector overload stays scalar
+    vector<double> jacRef(6 * count), jacNew(6 * count);
+    double timeJacRef = 0, timeJacNew = 0;
+    for (int iter = 0; iter < ITER_COUNT; iter++)
+    {
+        Timer timer;
+        triangulator.computeRegular(pVec, qVec, lambdaRef.data(), NULL, jacRef.data());
+        timeJacRef += timer.elapsed();
+        
+        timer.reset();
+        triangulator.computeRegular(DirectionBatch(pVec), DirectionBatch(qVec), 
+                lambdaNew.data(), NULL, jacNew.data());
+        timeJacNew += timer.elapsed();
+    }
+    cout << "    with jacobians, scalar  : " << timeJacRef / ITER_COUNT * 1e3 << " ms" << endl;
+    cout << "    with jacobians, batched : " << timeJacNew / ITER_COUNT * 1e3 << " ms" 
+            << "   speed-up : " << timeJacRef / timeJacNew << endl;
+}
+
+int main(int argc, char** argv)
+{
+    Transf T12(0.3, 0.05, 0.1, 0.02, -0.03, 0.01);
+    Triangulator triangulator(T12, 1e-3);
+    for (int count : {200, 1000, 76800, 307200})
+    {
+        benchmark(triangulator, T12, count);
+    }
+    return 0;
+}